@@ -1,6 +1,7 @@
 package net.sf.osra;
 
 import java.io.Writer;
+import java.nio.ByteBuffer;
 
 /**
  * JNI bridge for OSRA library.
@@ -54,5 +55,114 @@ public class OsraLib {
 					  boolean show_page,
 					  boolean outputCoordinates, 
 					  boolean outputAvgBondLength);
+
+	/**
+	 * Process the image in the given direct buffer with OSRA library. Unlike {@link #processImage(byte[], Writer, int,
+	 * boolean, int, double, int, boolean, boolean, String, String, boolean, boolean, boolean, boolean, boolean)} the
+	 * image is read straight from the buffer memory, without copying. The image is taken from the buffer position up
+	 * to its limit.
+	 * 
+	 * @param imageData
+	 *            the direct buffer with the image binary data
+	 * @see #processImage(byte[], Writer, int, boolean, int, double, int, boolean, boolean, String, String, boolean,
+	 *      boolean, boolean, boolean, boolean) for other parameters
+	 * @return 0, if the call succeeded or negative value in case of error
+	 */
+    public static int processImage(ByteBuffer imageData, Writer outputStructureWriter,
+					  int rotate, boolean invert, int input_resolution, double threshold, int do_unpaper, boolean jaggy, boolean adaptive_option,
+					  String format,
+					  String embeddedFormat,
+					  boolean outputConfidence,
+					  boolean show_resolution_guess,
+					  boolean show_page,
+					  boolean outputCoordinates,
+					  boolean outputAvgBondLength) {
+		if (!imageData.isDirect()) {
+			throw new IllegalArgumentException("Image data should be in a direct buffer");
+		}
+
+		return processImageBuffer(imageData, imageData.position(), imageData.remaining(), outputStructureWriter, rotate,
+					invert, input_resolution, threshold, do_unpaper, jaggy, adaptive_option, format, embeddedFormat,
+					outputConfidence, show_resolution_guess, show_page, outputCoordinates, outputAvgBondLength);
+	}
+
+    private static native int processImageBuffer(ByteBuffer imageData, int offset, int length, Writer outputStructureWriter,
+					  int rotate, boolean invert, int input_resolution, double threshold, int do_unpaper, boolean jaggy, boolean adaptive_option,
+					  String format,
+					  String embeddedFormat,
+					  boolean outputConfidence,
+					  boolean show_resolution_guess,
+					  boolean show_page,
+					  boolean outputCoordinates,
+					  boolean outputAvgBondLength);
+
+	/**
+	 * Process the given image with OSRA library and pass the found structures to the listener one by one, as soon
+	 * as the page they are on is processed. Unlike the writer, the listener gets the page, the box, the confidence
+	 * and the average bond length of every structure without parsing the output. Every page of a multi-page
+	 * document is processed at the resolution that suits it best.
+	 * 
+	 * @param imageData
+	 *            the image binary data
+	 * @param listener
+	 *            the listener to receive the found structures in given format
+	 * @see #processImage(byte[], Writer, int, boolean, int, double, int, boolean, boolean, String, String, boolean,
+	 *      boolean, boolean, boolean, boolean) for other parameters
+	 * @return 0, if the call succeeded or negative value in case of error
+	 */
+    public static int processImage(byte[] imageData, OsraStructureListener listener,
+					  int rotate, boolean invert, int input_resolution, double threshold, int do_unpaper, boolean jaggy, boolean adaptive_option,
+					  String format,
+					  String embeddedFormat,
+					  boolean outputConfidence,
+					  boolean show_resolution_guess,
+					  boolean show_page,
+					  boolean outputCoordinates,
+					  boolean outputAvgBondLength) {
+		return processImageToListener(imageData, null, 0, imageData.length, listener, rotate, invert, input_resolution,
+					threshold, do_unpaper, jaggy, adaptive_option, format, embeddedFormat, outputConfidence,
+					show_resolution_guess, show_page, outputCoordinates, outputAvgBondLength);
+	}
+
+	/**
+	 * Process the image in the given direct buffer with OSRA library and pass the found structures to the listener
+	 * one by one. The image is taken from the buffer position up to its limit.
+	 * 
+	 * @param imageData
+	 *            the direct buffer with the image binary data
+	 * @param listener
+	 *            the listener to receive the found structures in given format
+	 * @see #processImage(byte[], OsraStructureListener, int, boolean, int, double, int, boolean, boolean, String,
+	 *      String, boolean, boolean, boolean, boolean, boolean) for other parameters
+	 * @return 0, if the call succeeded or negative value in case of error
+	 */
+    public static int processImage(ByteBuffer imageData, OsraStructureListener listener,
+					  int rotate, boolean invert, int input_resolution, double threshold, int do_unpaper, boolean jaggy, boolean adaptive_option,
+					  String format,
+					  String embeddedFormat,
+					  boolean outputConfidence,
+					  boolean show_resolution_guess,
+					  boolean show_page,
+					  boolean outputCoordinates,
+					  boolean outputAvgBondLength) {
+		if (!imageData.isDirect()) {
+			throw new IllegalArgumentException("Image data should be in a direct buffer");
+		}
+
+		return processImageToListener(null, imageData, imageData.position(), imageData.remaining(), listener, rotate,
+					invert, input_resolution, threshold, do_unpaper, jaggy, adaptive_option, format, embeddedFormat,
+					outputConfidence, show_resolution_guess, show_page, outputCoordinates, outputAvgBondLength);
+	}
+
+    private static native int processImageToListener(byte[] imageArray, ByteBuffer imageBuffer, int offset, int length,
+					  OsraStructureListener listener,
+					  int rotate, boolean invert, int input_resolution, double threshold, int do_unpaper, boolean jaggy, boolean adaptive_option,
+					  String format,
+					  String embeddedFormat,
+					  boolean outputConfidence,
+					  boolean show_resolution_guess,
+					  boolean show_page,
+					  boolean outputCoordinates,
+					  boolean outputAvgBondLength);
 }
 
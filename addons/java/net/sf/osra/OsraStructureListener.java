@@ -0,0 +1,34 @@
+package net.sf.osra;
+
+/**
+ * Receives the structures found by OSRA library one by one, as soon as they are recognized. See
+ * {@link OsraLib#processImage(byte[], OsraStructureListener, int, boolean, int, double, int, boolean, boolean, String, String, boolean, boolean, boolean, boolean, boolean)}.
+ * <p>
+ * The calls never overlap, but may come from the threads other than the one that has called the library.
+ * An exception thrown by the listener stops the delivery and is rethrown to the caller of the library.
+ */
+public interface OsraStructureListener {
+
+	/**
+	 * Called for every recognized structure (or reaction).
+	 *
+	 * @param structure
+	 *            the structure in the requested format, the same text as written to the writer
+	 * @param page
+	 *            the page number, starting from 1
+	 * @param x1
+	 *            the left coordinate of the structure box on the page, in pixels of the input image
+	 * @param y1
+	 *            the top coordinate of the box
+	 * @param x2
+	 *            the right coordinate of the box
+	 * @param y2
+	 *            the bottom coordinate of the box
+	 * @param confidence
+	 *            the confidence estimate, 0 for reactions
+	 * @param avgBondLength
+	 *            the average bond length in pixels of the input image, 0 for reactions
+	 */
+	void structureFound(String structure, int page, int x1, int y1, int x2, int y2, double confidence,
+				double avgBondLength);
+}
@@ -61,31 +61,22 @@ int main(int argc, char **argv)
 
   is.read(buf, buf_size);
 
-  // Call OSRA:
-  const int result = osra_process_image(
-                       buf,
-                       buf_size,
-                       cout,
-                       0,
-                       false,
-                       0,
-                       0,
-                       0,
-                       false,
-                       false,
-                       "sdf",
-                       "",
-                       true,
-                       false,
-                       false,
-                       true,
-                       true,
-                       "",
-                       "",
-                       "",
-                       false,
-                       false
-                     );
+  // Call OSRA. The context keeps the dictionaries loaded, so it can be reused for any number of images:
+  int result;
+  osra_context_t *context = osra_create_context("", "", "", false, &result);
+
+  if (context != NULL)
+    {
+      osra_options_t options;
+      options.output_format = "sdf";
+      options.show_confidence = true;
+      options.show_coordinates = true;
+      options.show_avg_bond_length = true;
+
+      result = osra_process_image(context, buf, buf_size, cout, options);
+
+      osra_destroy_context(context);
+    }
 
   // Release the allocated resources:
   is.close();
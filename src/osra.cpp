@@ -17,14 +17,186 @@
  St, Fifth Floor, Boston, MA 02110-1301, USA
  *****************************************************************************/
 
+#include <stdio.h> // fdopen(), fprintf(), fclose()
 #include <string.h> // strncpy()
+#include <unistd.h> // dup()
 #include <libgen.h> // dirname()
+#include <dirent.h> // opendir(), readdir(), closedir()
+#include <sys/stat.h> // stat()
+
+#include <string> // std::string
+#include <vector> // std::vector
+#include <algorithm> // std::sort()
+#include <iostream> // std::cin, std::cout, std::cerr
+#include <fstream> // std::ifstream, std::ofstream
+#include <sstream> // std::ostringstream
+
+#ifdef _OPENMP
+#include <omp.h> // omp_get_max_threads()
+#endif
 
 #include <tclap/CmdLine.h>
 
+#include "osra.h" // ERROR_*
 #include "osra_lib.h"
 #include "config.h" // PACKAGE_VERSION
 
+// Function: read_input_list()
+//
+// Reads the input file names, one per line, skipping the empty lines.
+void read_input_list(std::istream &list, std::vector<std::string> &inputs)
+{
+  std::string line;
+  while (std::getline(list, line))
+    {
+      if (!line.empty() && line[line.length() - 1] == '\r')
+        line.erase(line.length() - 1);
+      if (!line.empty())
+        inputs.push_back(line);
+    }
+}
+
+// Function: list_batch_inputs()
+//
+// Collects the inputs of a batch.
+//
+// Parameters:
+//      source - a directory (all regular files in it are taken in the name order), a file with one input file name per line
+//               or "-" to read the input file names from stdin
+//      inputs - the collected input file names
+//
+// Returns:
+//      false, if the source cannot be read
+bool list_batch_inputs(const std::string &source, std::vector<std::string> &inputs)
+{
+  if (source == "-")
+    {
+      read_input_list(std::cin, inputs);
+      return true;
+    }
+
+  struct stat source_stat;
+  if (stat(source.c_str(), &source_stat) != 0)
+    return false;
+
+  if (S_ISDIR(source_stat.st_mode))
+    {
+      DIR *dir = opendir(source.c_str());
+      if (dir == NULL)
+        return false;
+
+      for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+        {
+          if (entry->d_name[0] == '.')
+            continue;
+          std::string input = source + "/" + entry->d_name;
+          struct stat input_stat;
+          if (stat(input.c_str(), &input_stat) == 0 && S_ISREG(input_stat.st_mode))
+            inputs.push_back(input);
+        }
+      closedir(dir);
+
+      std::sort(inputs.begin(), inputs.end());
+      return true;
+    }
+
+  std::ifstream list(source.c_str());
+  if (!list.is_open())
+    return false;
+  read_input_list(list, inputs);
+  return true;
+}
+
+// Function: process_batch()
+//
+// Recognizes the structures in all the inputs with a pool of workers sharing one context. The structures
+// are tagged with the input file name and written out in the input order as soon as they are ready.
+//
+// Parameters:
+//      context - recognition context
+//      inputs - input file names
+//      options - recognition options common for all inputs
+//      jobs - number of inputs processed concurrently, 0 means as many as there are available cores
+//      out_stream - stream to write the structures to
+//
+// Returns:
+//      0, if all inputs were processed successfully, otherwise the error code of the first failed input
+//      (every failed input is also reported on stderr)
+int process_batch(const osra_context_t *context, const std::vector<std::string> &inputs, const osra_options_t &options,
+                  int jobs, std::ostream &out_stream)
+{
+  // The first recognition closes stderr to hide the OCR warnings (see osra_process_image()), so the failed inputs
+  // are reported through a copy of it taken beforehand:
+  FILE *error_stream = NULL;
+  int error_fd = dup(fileno(stderr));
+  if (error_fd >= 0)
+    error_stream = fdopen(error_fd, "w");
+
+#ifdef _OPENMP
+  if (jobs <= 0)
+    jobs = omp_get_max_threads();
+#else
+  jobs = 1;
+#endif
+  if (jobs < 1)
+    jobs = 1;
+
+  int result = 0;
+  std::vector<std::string> results(inputs.size());
+  std::vector<char> done(inputs.size(), 0);
+  unsigned int next_output = 0;
+
+  #pragma omp parallel for num_threads(jobs) schedule(dynamic) default(shared)
+  for (int i = 0; i < (int) inputs.size(); i++)
+    {
+      osra_options_t input_options = options;
+      input_options.source = inputs[i];
+      // Structure images of different inputs should not overwrite each other:
+      if (!options.output_image_file_prefix.empty())
+        {
+          std::ostringstream prefix;
+          prefix << options.output_image_file_prefix << i << '_';
+          input_options.output_image_file_prefix = prefix.str();
+        }
+
+      std::ostringstream structures;
+      int err;
+      try
+        {
+          err = osra_process_image_file(context, inputs[i], structures, input_options);
+        }
+      catch (...)
+        {
+          // Broken input should not stop the whole batch:
+          err = ERROR_UNKNOWN_IMAGE_TYPE;
+        }
+
+      #pragma omp critical (batch_output)
+      {
+        if (err != 0 && result == 0)
+          result = err;
+        if (err != 0 && error_stream != NULL)
+          {
+            fprintf(error_stream, "Cannot process \"%s\" (error %d)\n", inputs[i].c_str(), err);
+            fflush(error_stream);
+          }
+        results[i] = structures.str();
+        done[i] = 1;
+        for (; next_output < inputs.size() && done[next_output]; next_output++)
+          {
+            out_stream << results[next_output];
+            out_stream.flush();
+            std::string().swap(results[next_output]);
+          }
+      }
+    }
+
+  if (error_stream != NULL)
+    fclose(error_stream);
+
+  return result;
+}
+
 int main(int argc,
          char **argv
         )
@@ -111,15 +283,33 @@ int main(int argc,
   //
   // Input-output options
   //
-  TCLAP::UnlabeledValueArg<std::string> input_file_option("in", "input file", true, "", "filename");
+  TCLAP::UnlabeledValueArg<std::string> input_file_option("in", "input file", false, "", "filename");
   cmd.add(input_file_option);
 
+  TCLAP::ValueArg<std::string> batch_option("", "batch", "Process many input files in one run: all files in a directory, the files listed in a file (one per line) or, if \"-\" is given, listed on stdin", false, "", "directory/list file/-");
+  cmd.add(batch_option);
+
+  TCLAP::ValueArg<int> jobs_option("", "jobs", "Number of input files processed in parallel in batch mode", false, 0, "default: all cores");
+  cmd.add(jobs_option);
+
   TCLAP::ValueArg<std::string> output_file_option("w", "write", "Write recognized structures to text file", false, "", "filename");
   cmd.add(output_file_option);
 
   TCLAP::SwitchArg show_learning_option("", "learn", "Print out all structure guesses with confidence parameters", false);
   cmd.add(show_learning_option);
 
+  TCLAP::ValueArg<int> threads_option("", "threads", "Number of threads for processing pages and structures in parallel", false, 0, "default: all cores");
+  cmd.add(threads_option);
+
+  TCLAP::ValueArg<double> early_exit_option("", "early-exit", "Skip the remaining resolution passes for a box once a pass gives structures with at least this confidence", false, 0, "default: off");
+  cmd.add(early_exit_option);
+
+  TCLAP::SwitchArg stream_option("", "stream", "Write out the structures of every page as soon as it is processed", false);
+  cmd.add(stream_option);
+
+  TCLAP::SwitchArg pdf_region_option("", "pdf-region", "Experimental: render only the part of PDF pages holding the structures, as located at a low resolution (recall and speed not measured yet)", false);
+  cmd.add(pdf_region_option);
+
   cmd.parse(argc, argv);
 
   // Calculating the current dir:
@@ -128,6 +318,71 @@ int main(int argc,
   progname[sizeof(progname) - 1] = '\0';
   std::string osra_dir = dirname(progname);
 
+  if (input_file_option.getValue().empty() == batch_option.getValue().empty())
+    {
+      std::cerr << "Either an input file or a batch source (--batch) should be given." << std::endl;
+      return ERROR_ILLEGAL_ARGUMENT_COMBINATION;
+    }
+
+  if (!batch_option.getValue().empty())
+    {
+      osra_options_t options;
+      options.rotate = rotate_option.getValue();
+      options.invert = invert_option.getValue();
+      options.input_resolution = resolution_option.getValue();
+      options.threshold = threshold_option.getValue();
+      options.do_unpaper = do_unpaper_option.getValue();
+      options.jaggy = jaggy_option.getValue();
+      options.adaptive = adaptive_option.getValue();
+      options.output_format = output_format_option.getValue();
+      options.embedded_format = embedded_format_option.getValue();
+      options.show_confidence = show_confidence_option.getValue();
+      options.show_resolution_guess = show_resolution_guess_option.getValue();
+      options.show_page = show_page_option.getValue();
+      options.show_coordinates = show_coordinates_option.getValue();
+      options.show_avg_bond_length = show_avg_bond_length_option.getValue();
+      options.show_learning = show_learning_option.getValue();
+      options.debug = debug_option.getValue();
+      options.verbose = verbose_option.getValue();
+      options.output_image_file_prefix = output_image_file_prefix_option.getValue();
+      options.resize = resize_option.getValue();
+      // The preview is not written, as all inputs would write it into the same file
+      options.num_threads = threads_option.getValue();
+      options.early_exit_confidence = early_exit_option.getValue();
+      options.stream_pages = stream_option.getValue();
+      options.pdf_region = pdf_region_option.getValue();
+
+      std::vector<std::string> inputs;
+      if (!list_batch_inputs(batch_option.getValue(), inputs))
+        {
+          std::cerr << "Cannot read the input list from \"" << batch_option.getValue() << '"' << std::endl;
+          return ERROR_INPUT_LIST_OPEN_FAILED;
+        }
+
+      int result;
+      osra_context_t *context = osra_create_context(osra_dir, spelling_file_option.getValue(),
+                                superatom_file_option.getValue(), verbose_option.getValue(), &result);
+      if (context == NULL)
+        return result;
+
+      std::ofstream outfile;
+      if (!output_file_option.getValue().empty())
+        {
+          outfile.open(output_file_option.getValue().c_str(), std::ios::out | std::ios::trunc);
+          if (outfile.bad() || !outfile.is_open())
+            {
+              std::cerr << "Cannot open file \"" << output_file_option.getValue() << "\" for output" << std::endl;
+              osra_destroy_context(context);
+              return ERROR_OUTPUT_FILE_OPEN_FAILED;
+            }
+        }
+
+      result = process_batch(context, inputs, options, jobs_option.getValue(), outfile.is_open() ? outfile : std::cout);
+
+      osra_destroy_context(context);
+      return result;
+    }
+
   int result = osra_process_image(
                  input_file_option.getValue(),
                  output_file_option.getValue(),
@@ -153,7 +408,11 @@ int main(int argc,
                  verbose_option.getValue(),
                  output_image_file_prefix_option.getValue(),
                  resize_option.getValue(),
-		 preview_option.getValue()
+		 preview_option.getValue(),
+                 threads_option.getValue(),
+                 early_exit_option.getValue(),
+                 stream_option.getValue(),
+                 pdf_region_option.getValue()
                );
 
   return result;
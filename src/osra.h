@@ -99,6 +99,23 @@ bond_s(int i=0, int j=0, const potrace_path_t* p=NULL) :
 //      defines bond_t type based on bond_s struct
 typedef struct bond_s bond_t;
 
+// struct: bitmap_s
+//      binarized image: one byte per pixel, rows follow one another without padding
+//      (pixel x,y is at y * width + x), see <binarize_image()> and <get_pixel()>
+struct bitmap_s
+{
+bitmap_s() : width(0), height(0) {}
+  // ints: width, height
+  //    dimensions of the bitmap
+  int width, height;
+  // vector: pixels
+  //    1 for set pixel, 0 for background
+  std::vector<unsigned char> pixels;
+};
+// typedef: bitmap_t
+//      defines bitmap_t type based on bitmap_s struct
+typedef struct bitmap_s bitmap_t;
+
 // Section: Constants
 //
 // Constants: global defines
@@ -141,6 +158,11 @@ typedef struct bond_s bond_t;
 // STRUCTURE_COUNT - threshold number of structures to compute limits on average bond length
 // SPELLING_TXT - spelling file for OCR corrections
 // SUPERATOM_TXT - superatom file for mapping labels to SMILES
+// PDF_PREVIEW_RESOLUTION - resolution of the preview render used to locate the structures on a PDF page
+// PDF_REGION_MARGIN - margin around the structures located on a PDF page, in inches
+// PDF_REGION_MAX_COVERAGE - largest part of a PDF page rendered as a region, larger regions get the whole page rendered
+// PDF_MIN_NATIVE_RESOLUTION, PDF_MAX_NATIVE_RESOLUTION - range of native resolutions a scanned PDF page is rendered at
+// PDF_NATIVE_RESOLUTION_TOLERANCE - allowed difference between the horizontal and vertical resolutions of a page scan
 #define PI 3.14159265358979323846
 #define MAX_ATOMS 10000
 #define MAX_FONT_HEIGHT 22
@@ -181,6 +203,12 @@ typedef struct bond_s bond_t;
 #define STRUCTURE_COUNT 20
 #define SPELLING_TXT "spelling.txt"
 #define SUPERATOM_TXT "superatom.txt"
+#define PDF_PREVIEW_RESOLUTION 150
+#define PDF_REGION_MARGIN 0.25
+#define PDF_REGION_MAX_COVERAGE 0.6
+#define PDF_MIN_NATIVE_RESOLUTION 100
+#define PDF_MAX_NATIVE_RESOLUTION 600
+#define PDF_NATIVE_RESOLUTION_TOLERANCE 0.01
 #define RECOGNIZED_CHARS "oOcCnNHFsSBuUgMeEXYZRPp23456789AmThD"
 
 #define ERROR_SPELLING_FILE_IS_MISSING          -1
@@ -195,5 +223,6 @@ typedef struct bond_s bond_t;
 // (b) The format libraries are installed, but do not correspond to /usr/lib/libopenbabel.so.y.y.y. Check they correspond to the same OpenBabel version.
 // (c) You need to preload OpenBabel e.g. using LD_PRELOAD=/usr/lib/libopenbabel.so
 #define ERROR_UNKNOWN_OPENBABEL_FORMAT          -6
+#define ERROR_INPUT_LIST_OPEN_FAILED            -7
 
 #endif
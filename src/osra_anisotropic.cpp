@@ -20,126 +20,175 @@
 #define cimg_use_magick
 #define cimg_plugin "greycstoration.h"
 
+#include <vector> // std::vector
+
 #include "CImg.h"
 
 using namespace cimg_library;
 using namespace Magick;
 
-Image anisotropic_smoothing(const Image &image, int width, int height, const float amplitude, const float sharpness,
-                            const float anisotropy, const float alpha, const float sigma)
+// Function: image_to_cimg()
+//
+// Copies the gray levels of the image into a CImg, row by row through the pixel cache
+void image_to_cimg(const Image &image, int width, int height, CImg<unsigned char> &source)
 {
+  source.assign(width, height, 1, 1, 0);
+  for (int j = 0; j < height; j++)
+    {
+      const PixelPacket *row = image.getConstPixels(0, j, width, 1);
+      if (row == NULL)
+        continue;
+      unsigned char *out = source.ptr(0, j);
+      for (int i = 0; i < width; i++)
+        out[i] = (unsigned char) (255 * ((double) row[i].red / MaxRGB));
+    }
+}
 
+// Function: cimg_to_image()
+//
+// Creates a gray-level image from a CImg, written row by row through the pixel cache
+Image cimg_to_image(const CImg<unsigned char> &dest)
+{
+  const int width = dest.dimx();
+  const int height = dest.dimy();
   Image res(Geometry(width, height), "white");
   res.type(GrayscaleType);
-  #pragma omp critical
-  {
-    CImg<unsigned char> source(width, height, 1, 1, 0);
-    unsigned char color[1] = { 0 };
-    unsigned char cc;
-    ColorGray c;
-
-    for (int i = 0; i < width; i++)
-      for (int j = 0; j < height; j++)
+  res.modifyImage();
+  res.classType(DirectClass);
+  for (int j = 0; j < height; j++)
+    {
+      PixelPacket *row = res.getPixels(0, j, width, 1);
+      if (row == NULL)
+        continue;
+      const unsigned char *in = dest.ptr(0, j);
+      for (int i = 0; i < width; i++)
         {
-          c = image.pixelColor(i, j);
-          color[0] = (unsigned char) (255 * c.shade());
-          source.draw_point(i, j, color);
+          row[i].red = row[i].green = row[i].blue = (Quantum) (MaxRGB * ((1. * in[i]) / 255));
+          row[i].opacity = OpaqueOpacity;
         }
-    CImg<unsigned char> dest(source);
-    const float gfact = 1.;
-    //const float amplitude = 5.; // 20
-    // const float sharpness = 0.3;
-    //const float anisotropy = 1.;
-    //const float alpha = .2; //0.6
-    //const float sigma = 1.1; // 2.
-    const float dl = 0.8;
-    const float da = 30.;
-    const float gauss_prec = 2.;
-    const unsigned int interp = 0;
-    const bool fast_approx = true;
-    const unsigned int tile = 512;
-    const unsigned int btile = 4;
-    const unsigned int threads = 1; // orig - 2
-
-    dest.greycstoration_run(amplitude, sharpness, anisotropy, alpha, sigma, gfact, dl, da, gauss_prec, interp,
-                            fast_approx, tile, btile, threads);
-    do
-      {
-        cimg::wait(1);
-      }
-    while (dest.greycstoration_is_running());
-
-    for (int i = 0; i < width; i++)
-      for (int j = 0; j < height; j++)
-        {
-          cc = dest(i, j);
-          c.shade(1. * cc / 255);
-          res.pixelColor(i, j, c);
-        }
-  }
+      res.syncPixels();
+    }
   return (res);
 }
 
-Image anisotropic_scaling(const Image &image, int width, int height, int nw, int nh)
+// Function: greycstoration_tiles()
+//
+// Runs GREYCstoration on the image the same way greycstoration_run() does with a single thread: the image is cut into
+// tiles with borders, and each tile is smoothed separately. Here the tiles are smoothed in parallel on the calling
+// thread team, and the result is ready on return.
+void greycstoration_tiles(CImg<unsigned char> &image, const CImg<unsigned char> &mask, const float amplitude,
+                          const float sharpness, const float anisotropy, const float alpha, const float sigma,
+                          const float gfact, const float dl, const float da, const float gauss_prec,
+                          const unsigned int interp, const bool fast_approx, const int tile, const int btile)
 {
-
-  Image res(Geometry(nw, nh), "white");
-  res.type(GrayscaleType);
-  #pragma omp critical
-  {
-    CImg<unsigned char> source(width, height, 1, 1, 0);
-    unsigned char color[1] = { 0 };
-    unsigned char cc;
-    ColorGray c;
-
-
-    for (int i = 0; i < width; i++)
-      for (int j = 0; j < height; j++)
-        {
-          c = image.pixelColor(i, j);
-          color[0] = (unsigned char) (255 * c.shade());
-          source.draw_point(i, j, color);
-        }
-
-    //const float gfact = (sizeof(T) == 2) ? 1.0f / 256 : 1.0f;
-    const float gfact = 1.;
-    const float amplitude = 20.; // 40 20!
-    const float sharpness = 0.2; // 0.2! 0.3
-    const float anisotropy = 1.;
-    const float alpha = .6; //0.6! 0.8
-    const float sigma = 2.; //1.1 2.!
-    const float dl = 0.8;
-    const float da = 30.;
-    const float gauss_prec = 2.;
-    const unsigned int interp = 0;
-    const bool fast_approx = true;
-    const unsigned int tile = 512; // 512 0
-    const unsigned int btile = 4;
-    const unsigned int threads = 1; // 2 1
-
-    const unsigned int init = 5;
-    CImg<unsigned char> mask;
-
-    mask.assign(source.dimx(), source.dimy(), 1, 1, 255);
-    mask = !mask.resize(nw, nh, 1, 1, 4);
-    source.resize(nw, nh, 1, -100, init);
-    CImg<unsigned char> dest(source);
-
-    dest.greycstoration_run(mask, amplitude, sharpness, anisotropy, alpha, sigma, gfact, dl, da, gauss_prec, interp,
-                            fast_approx, tile, btile, threads);
-    do
+  const int width = image.dimx();
+  const int height = image.dimy();
+
+  // Each tile reports to its own progress counter, with no stop requests and no locking (see greycstoration.h):
+  if (tile == 0 || (tile >= width && tile >= height))
+    {
+      unsigned long counter = 0;
+      bool stop_request = false;
+      image.greycstoration_params[0].counter = &counter;
+      image.greycstoration_params[0].stop_request = &stop_request;
+      image.blur_anisotropic(mask, amplitude, sharpness, anisotropy, alpha, sigma, dl, da, gauss_prec, interp,
+                             fast_approx, gfact);
+      image.greycstoration_params[0].counter = NULL;
+      image.greycstoration_params[0].stop_request = NULL;
+      return;
+    }
+
+  std::vector<int> tile_x, tile_y;
+  for (int y = 0; y < height; y += tile)
+    for (int x = 0; x < width; x += tile)
       {
-        cimg::wait(1);
+        tile_x.push_back(x);
+        tile_y.push_back(y);
       }
-    while (dest.greycstoration_is_running());
 
-    for (int i = 0; i < nw; i++)
-      for (int j = 0; j < nh; j++)
-        {
-          cc = dest(i, j);
-          c.shade(1. * cc / 255);
-          res.pixelColor(i, j, c);
-        }
-  }
-  return (res);
+  const int n = tile_x.size();
+  std::vector<CImg<unsigned char> > results(n);
+  #pragma omp parallel for schedule(dynamic) default(shared)
+  for (int t = 0; t < n; t++)
+    {
+      const int x = tile_x[t];
+      const int y = tile_y[t];
+      const int xe = std::min(x + tile - 1, width - 1);
+      const int ye = std::min(y + tile - 1, height - 1);
+      CImg<unsigned char> img = image.get_crop(x - btile, y - btile, xe + btile, ye + btile, true);
+      CImg<unsigned char> mask_tile = mask.is_empty() ? mask : mask.get_crop(x - btile, y - btile, xe + btile, ye + btile, true);
+      unsigned long counter = 0;
+      bool stop_request = false;
+      img.greycstoration_params[0].counter = &counter;
+      img.greycstoration_params[0].stop_request = &stop_request;
+      img.blur_anisotropic(mask_tile, amplitude, sharpness, anisotropy, alpha, sigma, dl, da, gauss_prec, interp,
+                           fast_approx, gfact);
+      results[t] = img.crop(btile, btile, img.dimx() - btile, img.dimy() - btile);
+    }
+
+  // The tiles overlap by a pixel; they are drawn in order, as greycstoration_run() does:
+  CImg<unsigned char> dest(image);
+  for (int t = 0; t < n; t++)
+    dest.draw_image(results[t], tile_x[t], tile_y[t]);
+  image.swap(dest);
+}
+
+Image anisotropic_smoothing(const Image &image, int width, int height, const float amplitude, const float sharpness,
+                            const float anisotropy, const float alpha, const float sigma)
+{
+  CImg<unsigned char> dest;
+  image_to_cimg(image, width, height, dest);
+
+  const float gfact = 1.;
+  //const float amplitude = 5.; // 20
+  // const float sharpness = 0.3;
+  //const float anisotropy = 1.;
+  //const float alpha = .2; //0.6
+  //const float sigma = 1.1; // 2.
+  const float dl = 0.8;
+  const float da = 30.;
+  const float gauss_prec = 2.;
+  const unsigned int interp = 0;
+  const bool fast_approx = true;
+  const unsigned int tile = 512;
+  const unsigned int btile = 4;
+
+  const CImg<unsigned char> mask;
+  greycstoration_tiles(dest, mask, amplitude, sharpness, anisotropy, alpha, sigma, gfact, dl, da, gauss_prec, interp,
+                       fast_approx, tile, btile);
+
+  return (cimg_to_image(dest));
+}
+
+Image anisotropic_scaling(const Image &image, int width, int height, int nw, int nh)
+{
+  CImg<unsigned char> source;
+  image_to_cimg(image, width, height, source);
+
+  //const float gfact = (sizeof(T) == 2) ? 1.0f / 256 : 1.0f;
+  const float gfact = 1.;
+  const float amplitude = 20.; // 40 20!
+  const float sharpness = 0.2; // 0.2! 0.3
+  const float anisotropy = 1.;
+  const float alpha = .6; //0.6! 0.8
+  const float sigma = 2.; //1.1 2.!
+  const float dl = 0.8;
+  const float da = 30.;
+  const float gauss_prec = 2.;
+  const unsigned int interp = 0;
+  const bool fast_approx = true;
+  const unsigned int tile = 512; // 512 0
+  const unsigned int btile = 4;
+
+  const unsigned int init = 5;
+  CImg<unsigned char> mask;
+
+  mask.assign(source.dimx(), source.dimy(), 1, 1, 255);
+  mask = !mask.resize(nw, nh, 1, 1, 4);
+  source.resize(nw, nh, 1, -100, init);
+
+  greycstoration_tiles(source, mask, amplitude, sharpness, anisotropy, alpha, sigma, gfact, dl, da, gauss_prec, interp,
+                       fast_approx, tile, btile);
+
+  return (cimg_to_image(source));
 }
@@ -23,7 +23,9 @@
 //
 
 #include <math.h> // fabs(double)
-#include <float.h> // FLT_MAX
+#include <float.h> // FLT_MAX, DBL_MAX
+#include <limits.h> // INT_MAX
+#include <string.h> // strncpy()
 #include <fstream> // std::ofstream, std::ifstream
 
 #include "osra_segment.h"
@@ -79,6 +81,32 @@ int get_pixel(const Image &image, const ColorGray &bg, unsigned int x, unsigned
   return (0);
 }
 
+void binarize_image(const Image &image, const ColorGray &bg, double THRESHOLD, bitmap_t &bitmap)
+{
+  bitmap.width = image.columns();
+  bitmap.height = image.rows();
+  bitmap.pixels.assign(bitmap.width * bitmap.height, 0);
+
+  if (bitmap.width == 0 || bitmap.height == 0)
+    return;
+
+  const double bg_shade = bg.shade();
+
+  // The same test as in get_pixel(): gray level of a pixel is taken from its red channel, as ColorGray::shade() does.
+  // The pixels are fetched row by row, as one request for the whole image may be huge:
+  for (int y = 0; y < bitmap.height; y++)
+    {
+      const PixelPacket *row = image.getConstPixels(0, y, bitmap.width, 1);
+      if (row == NULL)
+        continue;
+
+      unsigned char *out = &bitmap.pixels[y * bitmap.width];
+      for (int x = 0; x < bitmap.width; x++)
+        if (fabs((double) row[x].red / MaxRGB - bg_shade) > THRESHOLD)
+          out[x] = 1;
+    }
+}
+
 void delete_curve(std::vector<atom_t> &atom, std::vector<bond_t> &bond, int n_atom, int n_bond,
                   const potrace_path_t * const curve)
 {
@@ -204,6 +232,183 @@ bool terminal_bond(int a, int b, const std::vector<bond_t> &bond, int n_bond)
   return (terminal);
 }
 
+// Function: add_atom_bond()
+//
+// Lists the bond at the atom, unless it is there already
+static void add_atom_bond(atom_bonds_t &index, int a, int b)
+{
+  if (a < 0)
+    return;
+  if (a >= (int) index.bonds.size())
+    index.bonds.resize(a + 1);
+  std::vector<int> &bonds = index.bonds[a];
+  if (std::find(bonds.begin(), bonds.end(), b) == bonds.end())
+    bonds.push_back(b);
+}
+
+// Function: remove_atom_bond()
+//
+// Takes the bond off the list of the atom
+static void remove_atom_bond(atom_bonds_t &index, int a, int b)
+{
+  if (a < 0 || a >= (int) index.bonds.size())
+    return;
+  std::vector<int> &bonds = index.bonds[a];
+  std::vector<int>::iterator it = std::find(bonds.begin(), bonds.end(), b);
+  if (it != bonds.end())
+    {
+      *it = bonds.back();
+      bonds.pop_back();
+    }
+}
+
+void index_atom_bonds(const std::vector<bond_t> &bond, int n_bond, int n_atom, atom_bonds_t &index)
+{
+  index.bonds.assign(n_atom, std::vector<int>());
+  for (int i = 0; i < n_bond; i++)
+    {
+      add_atom_bond(index, bond[i].a, i);
+      add_atom_bond(index, bond[i].b, i);
+    }
+}
+
+void set_bond_ends(std::vector<bond_t> &bond, int b, int atom_a, int atom_b, atom_bonds_t &index)
+{
+  remove_atom_bond(index, bond[b].a, b);
+  remove_atom_bond(index, bond[b].b, b);
+  bond[b].a = atom_a;
+  bond[b].b = atom_b;
+  add_atom_bond(index, atom_a, b);
+  add_atom_bond(index, atom_b, b);
+}
+
+bool terminal_bond(int a, int b, const std::vector<bond_t> &bond, const atom_bonds_t &index)
+{
+  if (a < 0 || a >= (int) index.bonds.size())
+    return (true);
+
+  const std::vector<int> &bonds = index.bonds[a];
+  for (unsigned int l = 0; l < bonds.size(); l++)
+    if (bonds[l] != b && bond[bonds[l]].exists)
+      return (false);
+
+  return (true);
+}
+
+// Function: finite_point()
+//
+// Tells if both coordinates are finite (neither infinite nor NaN)
+static bool finite_point(double x, double y)
+{
+  return fabs(x) <= DBL_MAX && fabs(y) <= DBL_MAX;
+}
+
+// Function: grid_position()
+//
+// Finds the column or row of the coordinate, clamped to the grid; NaN goes to the first cell
+static int grid_position(double offset, double cell, int size)
+{
+  double position = floor(offset / cell);
+  if (!(position > 0))
+    return 0;
+  if (position > size - 1)
+    return size - 1;
+  return (int) position;
+}
+
+void build_atom_grid(const std::vector<atom_t> &atom, int n_atom, double cell, bool existing_only, atom_grid_t &grid)
+{
+  grid.cells.clear();
+  grid.atom_cell.assign(n_atom, -1);
+  grid.columns = grid.rows = 0;
+
+  double min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+  for (int i = 0; i < n_atom; i++)
+    if ((atom[i].exists || !existing_only) && finite_point(atom[i].x, atom[i].y))
+      {
+        min_x = std::min(min_x, atom[i].x);
+        min_y = std::min(min_y, atom[i].y);
+        max_x = std::max(max_x, atom[i].x);
+        max_y = std::max(max_y, atom[i].y);
+      }
+  if (min_x > max_x)
+    return;
+
+  // No more cells along a side than the square root of the number of atoms, so that there are about as many cells
+  // as atoms at most:
+  int side = (int) sqrt((double) n_atom) + 1;
+  if (!(cell > 0))
+    cell = 1;
+  cell = std::max(cell, std::max(max_x - min_x, max_y - min_y) / side);
+  grid.x0 = min_x;
+  grid.y0 = min_y;
+  grid.cell = cell;
+  grid.columns = grid_position(max_x - min_x, cell, side + 1) + 1;
+  grid.rows = grid_position(max_y - min_y, cell, side + 1) + 1;
+  grid.cells.resize(grid.columns * grid.rows);
+
+  for (int i = 0; i < n_atom; i++)
+    if ((atom[i].exists || !existing_only) && finite_point(atom[i].x, atom[i].y))
+      move_grid_atom(grid, i, atom[i].x, atom[i].y);
+}
+
+void find_atoms_near(const atom_grid_t &grid, double x, double y, double dist, std::vector<int> &found)
+{
+  found.clear();
+  if (grid.cells.empty() || !finite_point(x, y))
+    return;
+
+  // One more cell around the box of the distance, so that no atom is missed to rounding:
+  int left = grid_position(x - dist - grid.x0, grid.cell, grid.columns);
+  int right = grid_position(x + dist - grid.x0, grid.cell, grid.columns);
+  int top = grid_position(y - dist - grid.y0, grid.cell, grid.rows);
+  int bottom = grid_position(y + dist - grid.y0, grid.cell, grid.rows);
+  if (!(dist >= 0 && dist < FLT_MAX))
+    {
+      left = top = 0;
+      right = grid.columns - 1;
+      bottom = grid.rows - 1;
+    }
+  left = std::max(left - 1, 0);
+  top = std::max(top - 1, 0);
+  right = std::min(right + 1, grid.columns - 1);
+  bottom = std::min(bottom + 1, grid.rows - 1);
+
+  for (int row = top; row <= bottom; row++)
+    for (int column = left; column <= right; column++)
+      {
+        const std::vector<int> &atoms = grid.cells[row * grid.columns + column];
+        found.insert(found.end(), atoms.begin(), atoms.end());
+      }
+}
+
+void move_grid_atom(atom_grid_t &grid, int a, double x, double y)
+{
+  remove_grid_atom(grid, a);
+  if (grid.cells.empty() || !finite_point(x, y))
+    return;
+
+  int cell = grid_position(y - grid.y0, grid.cell, grid.rows) * grid.columns
+             + grid_position(x - grid.x0, grid.cell, grid.columns);
+  grid.cells[cell].push_back(a);
+  grid.atom_cell[a] = cell;
+}
+
+void remove_grid_atom(atom_grid_t &grid, int a)
+{
+  if (grid.atom_cell[a] < 0)
+    return;
+
+  std::vector<int> &atoms = grid.cells[grid.atom_cell[a]];
+  std::vector<int>::iterator it = std::find(atoms.begin(), atoms.end(), a);
+  if (it != atoms.end())
+    {
+      *it = atoms.back();
+      atoms.pop_back();
+    }
+  grid.atom_cell[a] = -1;
+}
+
 
 void debug_image(Image image, const std::vector<atom_t> &atom, int n_atom,
                  const std::vector<bond_t> &bond, int n_bond, const std::string &fname)
@@ -278,18 +483,155 @@ void draw_box(Image &image, std::vector<box_t> &boxes, int n_boxes, const std::s
 }
 
 
-int count_pages(const std::string &input)
+std::string ping_image(const char *image_data, int image_length, const std::string &input_file, int &frames)
 {
-  std::list<Image> imageList;
-  readImages(&imageList, input);
-  return (imageList.size());
+  std::string type;
+  MagickLib::ExceptionInfo exception;
+  MagickLib::GetExceptionInfo(&exception);
+  MagickLib::ImageInfo *image_info = MagickLib::CloneImageInfo(NULL);
+
+  MagickLib::Image *images = NULL;
+  if (image_data != NULL)
+    images = MagickLib::PingBlob(image_info, image_data, image_length, &exception);
+  else
+    {
+      strncpy(image_info->filename, input_file.c_str(), MaxTextExtent - 1);
+      images = MagickLib::PingImage(image_info, &exception);
+    }
+  frames = 0;
+  if (images != NULL)
+    {
+      type = images->magick;
+      frames = MagickLib::GetImageListLength(images);
+      MagickLib::DestroyImageList(images);
+    }
+
+  MagickLib::DestroyImageInfo(image_info);
+  MagickLib::DestroyExceptionInfo(&exception);
+  return type;
 }
 
-int count_pages(const Blob &blob)
+// Function: decode_image_list()
+//
+// Decodes "count" frames starting from "first" (all frames, if "count" is 0) and detaches them from the image list.
+void decode_image_list(const frame_reader_t &reader, int first, int count, std::vector<MagickLib::Image *> &list)
 {
-  std::list<Image> imageList;
-  readImages(&imageList, blob);
-  return (imageList.size());
+  MagickLib::ExceptionInfo exception;
+  MagickLib::GetExceptionInfo(&exception);
+  MagickLib::ImageInfo *image_info = MagickLib::CloneImageInfo(NULL);
+  image_info->subimage = first;
+  image_info->subrange = count;
+
+  MagickLib::Image *images = NULL;
+  if (reader.image_data != NULL)
+    images = MagickLib::BlobToImage(image_info, reader.image_data, reader.image_length, &exception);
+  else
+    {
+      strncpy(image_info->filename, reader.input_file.c_str(), MaxTextExtent - 1);
+      images = MagickLib::ReadImage(image_info, &exception);
+    }
+
+  while (images != NULL)
+    list.push_back(MagickLib::RemoveFirstImageFromList(&images));
+
+  MagickLib::DestroyImageInfo(image_info);
+  MagickLib::DestroyExceptionInfo(&exception);
+}
+
+// Function: frames_in_range()
+//
+// Tells if the scene numbers of the decoded frames increase and stay within "count" frames from "first",
+// i.e. if the coder has decoded the requested range
+static bool frames_in_range(const std::vector<MagickLib::Image *> &list, int first, int count)
+{
+  for (unsigned int i = 0; i < list.size(); i++)
+    if (list[i]->scene < (unsigned long) first || list[i]->scene >= (unsigned long) first + count
+        || (i > 0 && list[i]->scene <= list[i - 1]->scene))
+      return false;
+
+  return true;
+}
+
+// Function: take_frames()
+//
+// Puts the decoded frames from "from" on into "frames", numbered by their scenes or by their position in the list;
+// the rest of the frames are destroyed.
+static void take_frames(std::vector<MagickLib::Image *> &list, int from, bool by_scene, std::map<int, Image> &frames)
+{
+  for (unsigned int i = 0; i < list.size(); i++)
+    {
+      int frame = by_scene ? (int) list[i]->scene : (int) i;
+      // Every frame is owned by its own Magick::Image:
+      if (frame >= from)
+        frames[frame] = Image(list[i]);
+      else
+        MagickLib::DestroyImage(list[i]);
+    }
+  list.clear();
+}
+
+bool read_frame(frame_reader_t &reader, int frame, Image &image)
+{
+  bool found = false;
+  bool whole_image;
+
+  #pragma omp critical (frame_reader)
+  {
+    if (frame >= reader.next_frame && !reader.whole_image)
+      {
+        // The frames are decoded in one pass, the preceding frames are skipped by the decoder without being decoded:
+        int count = std::max(frame - reader.next_frame + 1, reader.chunk);
+        std::vector<MagickLib::Image *> list;
+        decode_image_list(reader, reader.next_frame, count, list);
+        if (frames_in_range(list, reader.next_frame, count))
+          {
+            take_frames(list, reader.next_frame, true, reader.frames);
+            reader.next_frame += count;
+          }
+        else
+          {
+            // The coder decodes the whole image whatever range is asked for, so it is decoded just once
+            // and all the frames that are not taken yet are kept:
+            if (reader.next_frame > 0)
+              {
+                for (unsigned int i = 0; i < list.size(); i++)
+                  MagickLib::DestroyImage(list[i]);
+                list.clear();
+                decode_image_list(reader, 0, 0, list);
+              }
+            take_frames(list, reader.next_frame, frames_in_range(list, 0, INT_MAX), reader.frames);
+            reader.whole_image = true;
+          }
+      }
+    whole_image = reader.whole_image;
+
+    std::map<int, Image>::iterator it = reader.frames.find(frame);
+    if (it != reader.frames.end())
+      {
+        image = it->second;
+        reader.frames.erase(it);
+        found = true;
+      }
+  }
+
+  if (!found && !whole_image)
+    {
+      // The frame has been taken already or its chunk has failed:
+      std::vector<MagickLib::Image *> list;
+      std::map<int, Image> frames;
+      decode_image_list(reader, frame, 1, list);
+      take_frames(list, frame, true, frames);
+      if (frames.count(frame) > 0)
+        {
+          image = frames[frame];
+          found = true;
+        }
+    }
+
+  if (!found)
+    image = Image(Geometry(1, 1), "white");
+
+  return found;
 }
 
 
@@ -397,6 +739,16 @@ bool load_config_map(const std::string &file, std::map<std::string, std::string>
 }
 
 
+int find_root(std::vector<int> &parent, int r)
+{
+  while (parent[r] != r)
+    {
+      parent[r] = parent[parent[r]];
+      r = parent[r];
+    }
+  return r;
+}
+
 bool comp_boxes(const box_t &aa, const box_t &bb)
 {
   if (aa.y2 < bb.y1)
@@ -30,6 +30,8 @@ extern "C" {
 #include "osra_segment.h"
 
 #include <vector> // std::vector
+#include <map> // std::map
+#include <algorithm> // std::max
 
 // Defines necessary for potrace vectorization functions
 #define BM_WORDSIZE ((int)sizeof(potrace_word))
@@ -63,6 +65,35 @@ extern "C" {
 //      1 for set pixel, 0 for background
 int get_pixel(const Magick::Image &image, const Magick::ColorGray &bg, unsigned int x, unsigned int y, double THRESHOLD);
 
+// Function: binarize_image()
+//
+// Binarizes a gray-level image once, so that the pixels can be tested with <get_pixel(const bitmap_t &, int, int)>
+// instead of going through Magick::Image::pixelColor() every time
+//
+// Parameters:
+//      image - image object
+//      bg - gray-level background color
+//      THRESHOLD - gray-level threshold for binarization
+//      bitmap - the result, 1 for set pixel and 0 for background, same as <get_pixel()> would return
+void binarize_image(const Magick::Image &image, const Magick::ColorGray &bg, double THRESHOLD, bitmap_t &bitmap);
+
+// Function: get_pixel()
+//
+// Returns a pixel value from a binarized image
+//
+// Parameters:
+//      bitmap - binarized image
+//      x, y - coordinates of the pixel
+//
+// Returns:
+//      1 for set pixel, 0 for background or if the pixel is outside of the bitmap
+inline int get_pixel(const bitmap_t &bitmap, int x, int y)
+{
+  if ((unsigned int) x < (unsigned int) bitmap.width && (unsigned int) y < (unsigned int) bitmap.height)
+    return bitmap.pixels[y * bitmap.width + x];
+  return (0);
+}
+
 // Function: trim()
 //
 // Remove leading and trailing whitespace
@@ -155,6 +186,114 @@ bool detect_curve(std::vector<bond_t> &bond, int n_bond, const potrace_path_t *
 // False if a bond ending on atom a is found, True otherwise
 bool terminal_bond(int a, int b, const std::vector<bond_t> &bond, int n_bond);
 
+// struct: atom_bonds_s
+//      Index of the bonds ending on every atom, existing or not, so that the bonds of an atom are found without scanning
+//      all bonds. The passes that move bond ends keep it up to date with <set_bond_ends()>.
+struct atom_bonds_s
+{
+  // the bonds of every atom, in no particular order; a bond with both ends on the atom is listed once
+  std::vector<std::vector<int> > bonds;
+};
+// Typedef: atom_bonds_t
+//      defines atom_bonds_t type based on atom_bonds_s struct
+typedef struct atom_bonds_s atom_bonds_t;
+
+// Function: index_atom_bonds()
+//
+// Builds the index of the bonds ending on every atom
+//
+// Parameters:
+// bond - vector of bonds in a molecule
+// n_bond - number of bonds to index
+// n_atom - number of atoms
+// index - the index (returned to the caller)
+void index_atom_bonds(const std::vector<bond_t> &bond, int n_bond, int n_atom, atom_bonds_t &index);
+
+// Function: set_bond_ends()
+//
+// Moves the ends of the bond to the given atoms and updates the index
+//
+// Parameters:
+// bond - vector of bonds in a molecule
+// b - bond number
+// atom_a, atom_b - the new starting and ending atoms
+// index - the index built with <index_atom_bonds()>
+void set_bond_ends(std::vector<bond_t> &bond, int b, int atom_a, int atom_b, atom_bonds_t &index);
+
+// Function: terminal_bond()
+//
+// Same as <terminal_bond()> above, looking only at the bonds of the atom in the index
+//
+// Parameters:
+// a - atom number to check if it belongs to a bond
+// b - bond number to avoid
+// bond - vector of bonds in a molecule
+// index - the index built with <index_atom_bonds()>
+//
+// Returns:
+// False if a bond ending on atom a is found, True otherwise
+bool terminal_bond(int a, int b, const std::vector<bond_t> &bond, const atom_bonds_t &index);
+
+// struct: atom_grid_s
+//      Uniform grid over the atom centres for the proximity queries. Atoms with non-finite coordinates are left out,
+//      as they are never close to anything.
+struct atom_grid_s
+{
+  // the corner of the grid and the size of a cell
+  double x0, y0, cell;
+  int columns, rows;
+  // the atoms in every cell, row by row
+  std::vector<std::vector<int> > cells;
+  // the cell of every atom or -1
+  std::vector<int> atom_cell;
+};
+// Typedef: atom_grid_t
+//      defines atom_grid_t type based on atom_grid_s struct
+typedef struct atom_grid_s atom_grid_t;
+
+// Function: build_atom_grid()
+//
+// Puts the atoms into the grid. The cells are made larger than asked if the grid would have too many of them.
+//
+// Parameters:
+// atom - vector of atoms in a molecule
+// n_atom - number of atoms
+// cell - the size of a cell, about the distance of the queries
+// existing_only - leave out the atoms which do not exist
+// grid - the grid (returned to the caller)
+void build_atom_grid(const std::vector<atom_t> &atom, int n_atom, double cell, bool existing_only, atom_grid_t &grid);
+
+// Function: find_atoms_near()
+//
+// Finds the atoms of the grid that may be within the distance from the point: all of them are found, with some
+// farther ones
+//
+// Parameters:
+// grid - the grid
+// x, y - the point
+// dist - the distance
+// found - the atoms found, in no particular order (returned to the caller)
+void find_atoms_near(const atom_grid_t &grid, double x, double y, double dist, std::vector<int> &found);
+
+// Function: move_grid_atom()
+//
+// Moves the atom of the grid to its new coordinates
+//
+// Parameters:
+// grid - the grid
+// a - atom number
+// x, y - the new coordinates of the atom
+void move_grid_atom(atom_grid_t &grid, int a, double x, double y);
+
+// Function: remove_grid_atom()
+//
+// Removes the atom from the grid
+//
+// Parameters:
+// grid - the grid
+// a - atom number
+void remove_grid_atom(atom_grid_t &grid, int a);
+
 // Function: bm_new()
 //
 // Reserves space for Potrace object for image vectorization
@@ -257,18 +396,61 @@ double distance_from_bond_x_b(double x0, double y0, double x1, double y1, double
 // Third quintile value for bond length.
 double percentile75(const std::vector<bond_t> &bond, int n_bond, const std::vector<atom_t> &atom);
 
-// Function: count_pages()
+// Function: ping_image()
 //
-// Counts the number of pages in a specified image file
+// Detects the format and the number of frames (pages) of the image in memory or in the file. The pixels are not decoded
+// and the data in memory is read in place, without making a copy of it.
 //
 // Parameters:
-// input - File name
+// image_data, image_length - the image in memory or NULL to read the file
+// input_file - the image file
+// frames - the number of frames (returned to the caller)
 //
 // Returns:
-// number of pages in an image file
-int count_pages(const std::string &input);
-
-int count_pages(const Blob &blob);
+// image format (e.g. "TIFF") or empty string if the format is not recognized
+std::string ping_image(const char *image_data, int image_length, const std::string &input_file, int &frames);
+
+// struct: frame_reader_s
+//      Source of the frames (pages) of a multi-frame image, in memory or in the file. The frames are decoded in sequence,
+//      a chunk at a time, so every frame is decoded once and only the frames waiting for their page are kept in memory.
+struct frame_reader_s
+{
+  const char *image_data;
+  int image_length;
+  std::string input_file;
+  // number of frames decoded in one go
+  int chunk;
+  // the first frame that is not decoded yet
+  int next_frame;
+  // decoded frames waiting to be taken
+  std::map<int, Image> frames;
+  // set if the coder ignores the range of frames to decode; then the whole image is decoded once into "frames"
+  bool whole_image;
+
+  frame_reader_s(const char *data, int length, const std::string &file, int frames_per_chunk) : image_data(data),
+    image_length(length), input_file(file), chunk(std::max(frames_per_chunk, 1)), next_frame(0), whole_image(false)
+  {
+  }
+};
+// Typedef: frame_reader_t
+//      defines frame_reader_t type based on frame_reader_s struct
+typedef struct frame_reader_s frame_reader_t;
+
+// Function: read_frame()
+//
+// Takes the frame from the reader, decoding the next chunk of frames if needed (or the whole image once, if the coder
+// cannot decode a range of frames). Can be called by several threads at once; the frames are best taken in about
+// the increasing order, a frame taken out of order is decoded on its own. The frame that cannot be decoded is not reported
+// here, it is up to the caller.
+//
+// Parameters:
+// reader - the source of frames
+// frame - the frame number, starting from 0
+// image - the frame or a blank page if the frame cannot be decoded (returned to the caller)
+//
+// Returns:
+// false, if the frame cannot be decoded
+bool read_frame(frame_reader_t &reader, int frame, Image &image);
 
 // Function: count_atoms()
 //
@@ -306,6 +488,18 @@ int count_bonds(const std::vector<bond_t> &bond, int n_bond, int &bond_max_type)
 // True if file load is successful, False otherwise
 bool load_config_map(const std::string &file, std::map<std::string, std::string> &out);
 
+// Function: find_root()
+//
+// Finds the representative element of a set in a union-find forest, halving the path on the way
+//
+// Parameters:
+// parent - parent element of each element
+// r - element index
+//
+// Returns:
+// index of the representative element
+int find_root(std::vector<int> &parent, int r);
+
 // Function: comp_boxes()
 //
 // Box coordinate comparison function used for sorting molecule-containing boxes
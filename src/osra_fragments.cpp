@@ -25,6 +25,8 @@
 #include <float.h> // FLT_MAX
 #include <limits.h> // INT_MAX
 #include <iostream> // std::ostream, std::cout
+#include <queue> // std::priority_queue
+#include <functional> // std::greater
 
 #include "osra.h"
 #include "osra_common.h"
@@ -44,61 +46,65 @@ std::vector<std::vector<int> > find_fragments(
 {
   std::vector<std::vector<int> > frags;
   std::vector<int> pool;
-  int n = 0;
+  std::vector<int> parent(atom.size());
+
+  for (unsigned int i = 0; i < parent.size(); i++)
+    parent[i] = i;
 
   for (int i = 0; i < n_bond; i++)
     if (bond[i].exists && atom[bond[i].a].exists && atom[bond[i].b].exists)
-      pool.push_back(i);
+      {
+        pool.push_back(i);
+        parent[find_root(parent, bond[i].a)] = find_root(parent, bond[i].b);
+      }
 
-  while (!pool.empty())
+  std::vector<std::vector<int> > atom_bonds(atom.size());
+  for (unsigned int j = 0; j < pool.size(); j++)
     {
-      frags.resize(n + 1);
-      frags[n].push_back(bond[pool.back()].a);
-      frags[n].push_back(bond[pool.back()].b);
-      pool.pop_back();
-      bool found = true;
+      atom_bonds[bond[pool[j]].a].push_back(j);
+      atom_bonds[bond[pool[j]].b].push_back(j);
+    }
 
-      while (found)
+  // The fragments are numbered starting from the last bond, and each one starts with the atoms of its last bond.
+  // The rest of the atoms keep the order of the former search, which swept the bonds in their order until nothing
+  // was added, each bond adding its second atom once the first one was in the fragment. An atom is thus added
+  // at the earliest (sweep, bond) pair that reaches it, and the atoms are taken in the order of these pairs:
+  std::vector<int> fragment(atom.size(), -1);
+  std::vector<bool> placed(atom.size(), false);
+  std::priority_queue<std::pair<std::pair<int, int>, int>, std::vector<std::pair<std::pair<int, int>, int> >,
+      std::greater<std::pair<std::pair<int, int>, int> > > queue;
+  for (int j = pool.size() - 1; j >= 0; j--)
+    {
+      int r = find_root(parent, bond[pool[j]].a);
+      if (fragment[r] >= 0)
+        continue;
+
+      fragment[r] = frags.size();
+      frags.push_back(std::vector<int>());
+      queue.push(std::make_pair(std::make_pair(0, -2), bond[pool[j]].a));
+      queue.push(std::make_pair(std::make_pair(0, -1), bond[pool[j]].b));
+      while (!queue.empty())
         {
-          found = false;
-          unsigned int i = 0;
-          while (i < pool.size())
+          int sweep = queue.top().first.first;
+          int position = queue.top().first.second;
+          int a = queue.top().second;
+          queue.pop();
+          if (placed[a])
+            continue;
+
+          frags.back().push_back(a);
+          placed[a] = true;
+          for (unsigned int k = 0; k < atom_bonds[a].size(); k++)
             {
-              bool found_a = false;
-              bool found_b = false;
-              bool newfound = false;
-              for (unsigned int k = 0; k < frags[n].size(); k++)
-                {
-                  if (frags[n][k] == bond[pool[i]].a)
-                    found_a = true;
-                  else if (frags[n][k] == bond[pool[i]].b)
-                    found_b = true;
-                }
-              if (found_a && !found_b)
-                {
-                  frags[n].push_back(bond[pool[i]].b);
-                  pool.erase(pool.begin() + i);
-                  found = true;
-                  newfound = true;
-                }
-              if (!found_a && found_b)
-                {
-                  frags[n].push_back(bond[pool[i]].a);
-                  pool.erase(pool.begin() + i);
-                  found = true;
-                  newfound = true;
-                }
-              if (found_a && found_b)
-                {
-                  pool.erase(pool.begin() + i);
-                  newfound = true;
-                }
-              if (!newfound)
-                i++;
+              int l = atom_bonds[a][k];
+              int b = bond[pool[l]].a == a ? bond[pool[l]].b : bond[pool[l]].a;
+              // A bond before the one that has added the atom is only reached in the next sweep:
+              if (!placed[b])
+                queue.push(std::make_pair(std::make_pair(l > position ? sweep : sweep + 1, l), b));
             }
         }
-      n++;
     }
+
   return (frags);
 }
 
@@ -23,20 +23,37 @@
 //
 
 #include <vector>
+#include <algorithm> // std::min(int, int), std::max(int, int)
 #include <iostream> // std::ostream, std::cout
 #include <math.h> // fabs(double)
 
 #include "osra.h"
 #include "osra_grayscale.h"
 
-const Color getBgColor(const Image &image)
+// Function: random_fraction()
+//
+// Reentrant pseudo-random generator (the one from POSIX rand_r() example), so that pages processed in
+// parallel sample the same points regardless of the thread scheduling
+//
+// Parameters:
+// seed - generator state, updated on each call
+//
+// Returns:
+// a number in [0,1] range
+double random_fraction(unsigned int &seed)
+{
+  seed = seed * 1103515245 + 12345;
+  return (double)((seed / 65536) % 32768) / 32767;
+}
+
+const Color getBgColor(const Image &image, unsigned int &seed)
 {
   ColorGray c, r;
   r = image.pixelColor(1, 1);
   for (int i = 0; i < BG_PICK_POINTS; i++)
     {
-      double a = (double)rand()/RAND_MAX;
-      double b = (double)rand()/RAND_MAX;
+      double a = random_fraction(seed);
+      double b = random_fraction(seed);
       int x = int(image.columns() *a);
       int y = int(image.rows() * b);
       c = image.pixelColor(x, y);
@@ -95,130 +112,262 @@ void otsu_find_peaks(const std::vector<int> &h, int num_bins, int &peak1, int &p
       }
 }
 
-Image adaptive_otsu(const Image &image, int window)
+// Function: get_gray_levels()
+//
+// Reads the gray level (red channel) of every pixel through the pixel cache into a contiguous row-major buffer
+//
+// Parameters:
+// image - image to read
+// gray - buffer of width*height levels, filled on return
+void get_gray_levels(const Image &image, std::vector<Quantum> &gray)
 {
-  int num_bins=20;
-  Image result(Geometry(image.columns(),image.rows()),"white");
-  std::vector<int> h(num_bins,0);
-  std::vector<int> h0(num_bins,0);
-  ColorGray g;
-  int peak1, peak2, max1, max2;
+  const int width = image.columns();
+  const int height = image.rows();
+  gray.assign(width * height, 0);
+  for (int j = 0; j < height; j++)
+    {
+      const PixelPacket *row = image.getConstPixels(0, j, width, 1);
+      if (row == NULL)
+        continue;
+      for (int i = 0; i < width; i++)
+        gray[j * width + i] = row[i].red;
+    }
+}
 
-  for (int i1 = 0; i1 < std::min((int)image.columns(), window/2); i1++)
-    for (int j1 = 0; j1 < std::min((int)image.rows(), window/2); j1++)
-      {
-        g = image.pixelColor(i1, j1);
-        h0[int((num_bins-1)*g.shade())]++;
-      }
+// Function: set_binary_levels()
+//
+// Writes a two-level result back to the image row by row through the pixel cache
+//
+// Parameters:
+// image - image to write, of the same size as the buffer
+// black - row-major buffer of width*height flags, non-zero for black pixels
+void set_binary_levels(Image &image, const std::vector<unsigned char> &black)
+{
+  const int width = image.columns();
+  const int height = image.rows();
+  image.modifyImage();
+  image.classType(DirectClass);
+  for (int j = 0; j < height; j++)
+    {
+      PixelPacket *row = image.getPixels(0, j, width, 1);
+      if (row == NULL)
+        continue;
+      for (int i = 0; i < width; i++)
+        row[i].red = row[i].green = row[i].blue = black[j * width + i] ? 0 : MaxRGB;
+      image.syncPixels();
+    }
+}
 
-  for (int j = 0; j < image.rows(); j++)
+// Function: adaptive_threshold()
+//
+// Same thresholding as Magick::Image::adaptiveThreshold(): a pixel turns white if it is brighter than the mean of the
+// window around it (edge pixels repeated past the border) plus the offset, and black otherwise. The window sums slide
+// along the columns and the rows, so that the cost per pixel does not depend on the window size; bands of rows
+// are processed in parallel.
+//
+// Parameters:
+// image - gray-level image, thresholded in place
+// window - window width and height
+// offset - offset added to the mean, in quantum units
+void adaptive_threshold(Image &image, int window, double offset)
+{
+  const int width = image.columns();
+  const int height = image.rows();
+  const int w2 = window / 2;
+  const double number_pixels = (double) window * window;
+  const int band = std::max(64, window);
+  std::vector<Quantum> gray;
+  std::vector<unsigned char> black(width * height, 0);
+
+  get_gray_levels(image, gray);
+
+  #pragma omp parallel for schedule(dynamic) default(shared)
+  for (int j0 = 0; j0 < height; j0 += band)
     {
-      for (int k = 0; k<num_bins; k++) h[k]=h0[k];
-      for (int i = 0; i < image.columns(); i++)
+      // Sums of the window column above/below each pixel of the current row:
+      std::vector<double> column_sum(width, 0);
+      for (int v = j0 - w2; v < j0 - w2 + window; v++)
         {
-          otsu_find_peaks(h,num_bins,peak1,peak2, max1, max2);
-          g = image.pixelColor(i, j);
-          double median = 0.5*(peak1+peak2)/num_bins;
-          if (g.shade() > median)
-            result.pixelColor(i,j,"white");
-          else
-            result.pixelColor(i,j,"black");
-          if ((i-window/2) >=0)
-            for (int j1 = std::max(0, j-window/2); j1 < std::min((int)image.rows(), j + window/2); j1++)
-              {
-                g = image.pixelColor(i-window/2, j1);
-                h[int((num_bins-1)*g.shade())]--;
-              }
-          if ((i+window/2) < image.columns())
-            for (int j1 = std::max(0, j-window/2); j1 < std::min((int)image.rows(), j + window/2); j1++)
-              {
-                g = image.pixelColor(i+window/2, j1);
-                h[int((num_bins-1)*g.shade())]++;
-              }
+          const Quantum *row = &gray[std::min(std::max(v, 0), height - 1) * width];
+          for (int i = 0; i < width; i++)
+            column_sum[i] += row[i];
+        }
+
+      for (int j = j0; j < std::min(j0 + band, height); j++)
+        {
+          if (j > j0)
+            {
+              const Quantum *out_row = &gray[std::min(std::max(j - 1 - w2, 0), height - 1) * width];
+              const Quantum *in_row = &gray[std::min(std::max(j - 1 - w2 + window, 0), height - 1) * width];
+              for (int i = 0; i < width; i++)
+                column_sum[i] += (double) in_row[i] - out_row[i];
+            }
+
+          double sum = 0;
+          for (int u = -w2; u < window - w2; u++)
+            sum += column_sum[std::min(std::max(u, 0), width - 1)];
+          for (int i = 0; i < width; i++)
+            {
+              double mean = sum / number_pixels + offset;
+              if ((double) gray[j * width + i] <= mean)
+                black[j * width + i] = 1;
+              sum += column_sum[std::min(i - w2 + window, width - 1)] - column_sum[std::max(i - w2, 0)];
+            }
+        }
+    }
+
+  set_binary_levels(image, black);
+}
+
+// Function: adaptive_otsu()
+//
+// Thresholds each pixel halfway between the two Otsu peaks of the histogram of the window around it. The window
+// histogram is kept as a sum of per-column histograms which slide down the rows, so each step along a row adds and
+// removes one column histogram; the peaks are only recomputed when the window histogram changes. Bands of rows
+// are processed in parallel.
+//
+// Parameters:
+// image - gray-level image
+// window - window width and height
+//
+// Returns:
+// thresholded image
+Image adaptive_otsu(const Image &image, int window)
+{
+  const int num_bins = 20;
+  const int width = image.columns();
+  const int height = image.rows();
+  const int w2 = window / 2;
+  const int band = std::max(64, window);
+  Image result(Geometry(width, height), "white");
+  std::vector<Quantum> gray;
+  std::vector<unsigned char> bin(width * height, 0);
+  std::vector<unsigned char> black(width * height, 0);
+
+  get_gray_levels(image, gray);
+  for (int k = 0; k < width * height; k++)
+    bin[k] = int((num_bins - 1) * ((double) gray[k] / MaxRGB));
+
+  #pragma omp parallel for schedule(dynamic) default(shared)
+  for (int j0 = 0; j0 < height; j0 += band)
+    {
+      std::vector<int> column_h(width * num_bins, 0);
+      std::vector<int> h(num_bins, 0);
+      int peak1, peak2, max1, max2;
+
+      for (int j1 = std::max(0, j0 - w2); j1 < std::min(height, j0 + w2); j1++)
+        for (int i = 0; i < width; i++)
+          column_h[i * num_bins + bin[j1 * width + i]]++;
+
+      for (int j = j0; j < std::min(j0 + band, height); j++)
+        {
+          if (j > j0)
+            {
+              if ((j - 1 - w2) >= 0)
+                for (int i = 0; i < width; i++)
+                  column_h[i * num_bins + bin[(j - 1 - w2) * width + i]]--;
+              if ((j - 1 + w2) < height)
+                for (int i = 0; i < width; i++)
+                  column_h[i * num_bins + bin[(j - 1 + w2) * width + i]]++;
+            }
+
+          for (int k = 0; k < num_bins; k++)
+            h[k] = 0;
+          for (int i1 = 0; i1 < std::min(width, w2); i1++)
+            for (int k = 0; k < num_bins; k++)
+              h[k] += column_h[i1 * num_bins + k];
+
+          bool changed = true;
+          for (int i = 0; i < width; i++)
+            {
+              if (changed)
+                otsu_find_peaks(h, num_bins, peak1, peak2, max1, max2);
+              double median = 0.5 * (peak1 + peak2) / num_bins;
+              if ((double) gray[j * width + i] / MaxRGB <= median)
+                black[j * width + i] = 1;
+
+              changed = false;
+              const int *out_h = (i - w2) >= 0 ? &column_h[(i - w2) * num_bins] : NULL;
+              const int *in_h = (i + w2) < width ? &column_h[(i + w2) * num_bins] : NULL;
+              for (int k = 0; k < num_bins; k++)
+                {
+                  int delta = (in_h ? in_h[k] : 0) - (out_h ? out_h[k] : 0);
+                  if (delta != 0)
+                    {
+                      h[k] += delta;
+                      changed = true;
+                    }
+                }
+            }
         }
-      if ((j-window/2) >=0)
-        for (int i1 = 0; i1 < std::min((int)image.columns(), window/2); i1++)
-          {
-            g = image.pixelColor(i1,j-window/2);
-            h0[int((num_bins-1)*g.shade())]--;
-          }
-      if ((j+window/2) < image.rows())
-        for (int i1 = 0; i1 < std::min((int)image.columns(), window/2); i1++)
-          {
-            g = image.pixelColor(i1,j+window/2);
-            h0[int((num_bins-1)*g.shade())]++;
-          }
     }
+
+  set_binary_levels(result, black);
   return(result);
 }
 
+// Function: Bradley_threshold()
+//
+// Bradley-Roth thresholding: a pixel turns black if it is more than 15% darker than the mean of the window around it.
+// The window sums are taken from a row-major integral image of the gray levels; rows are thresholded in parallel.
+//
+// Parameters:
+// src - gray-level image
+//
+// Returns:
+// thresholded image
+//
 // https://habrahabr.ru/post/278435/
 Image Bradley_threshold(const Image &src)
 {
-  int width = src.columns();
-  int height = src.rows();
+  const int width = src.columns();
+  const int height = src.rows();
   Image res(Geometry(width, height),"white");
 
   const int S = width/8;
-  int s2 = S/2;
+  const int s2 = S/2;
   const float t = 0.15;
-  unsigned long* integral_image = 0;
-  long sum=0;
-  int count=0;
-  int index;
-  int x1, y1, x2, y2;
-  ColorGray g;
+  std::vector<Quantum> gray;
+  std::vector<unsigned long long> integral_image(width * height, 0);
+  std::vector<unsigned char> black(width * height, 0);
 
-  integral_image = new unsigned long [width*height*sizeof(unsigned long*)];
+  get_gray_levels(src, gray);
 
-  for (int i = 0; i < width; i++) {
-    sum = 0;
-    for (int j = 0; j < height; j++) {
-      index = j * width + i;
-      g = src.pixelColor(i, j);
-      sum += g.shade() * 255;
-      if (i==0)
-	integral_image[index] = sum;
-      else
-	integral_image[index] = integral_image[index-1] + sum;
+  // integral_image[y*width+x] is the sum of the levels over [0,x]x[0,y]:
+  for (int j = 0; j < height; j++)
+    {
+      unsigned long long row_sum = 0;
+      for (int i = 0; i < width; i++)
+        {
+          int index = j * width + i;
+          row_sum += (unsigned long long) ((double) gray[index] / MaxRGB * 255);
+          integral_image[index] = row_sum + (j > 0 ? integral_image[index - width] : 0);
+        }
     }
-  }
-
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      index = j * width + i;
-
-      x1=i-s2;
-      x2=i+s2;
-      y1=j-s2;
-      y2=j+s2;
-
-      if (x1 < 0)
-	x1 = 0;
-      if (x2 >= width)
-	x2 = width-1;
-      if (y1 < 0)
-	y1 = 0;
-      if (y2 >= height)
-	y2 = height-1;
-
-      count = (x2-x1)*(y2-y1);
-
-      sum = integral_image[y2*width+x2] - integral_image[y1*width+x2] -
-	integral_image[y2*width+x1] + integral_image[y1*width+x1];
-      g = src.pixelColor(i, j);
-      if ((long)(g.shade() * 255 * count) < (long)(sum*(1.0-t)))
-	res.pixelColor(i,j,"black");
-      else
-	res.pixelColor(i,j,"white");
+
+  #pragma omp parallel for schedule(dynamic) default(shared)
+  for (int j = 0; j < height; j++)
+    {
+      int y1 = std::max(j - s2, 0);
+      int y2 = std::min(j + s2, height - 1);
+      for (int i = 0; i < width; i++)
+        {
+          int index = j * width + i;
+          int x1 = std::max(i - s2, 0);
+          int x2 = std::min(i + s2, width - 1);
+          int count = (x2 - x1) * (y2 - y1);
+          long long sum = integral_image[y2 * width + x2] - integral_image[y1 * width + x2] -
+                          integral_image[y2 * width + x1] + integral_image[y1 * width + x1];
+          if ((long long) ((double) gray[index] / MaxRGB * 255 * count) < (long long) (sum * (1.0 - t)))
+            black[index] = 1;
+        }
     }
-  }
 
-  delete[] integral_image;
+  set_binary_levels(res, black);
   return res;
 }
 
-bool convert_to_gray(Image &image, bool invert, bool adaptive, bool verbose)
+bool convert_to_gray(Image &image, bool invert, bool adaptive, bool verbose, unsigned int &seed)
 {
   int num_bins=50;
   int num_bins_rgb = 20;
@@ -232,8 +381,8 @@ bool convert_to_gray(Image &image, bool invert, bool adaptive, bool verbose)
   image.type(TrueColorMatteType);
   for (int i = 0; i < BG_PICK_POINTS; i++)
     {
-      double a = (double) rand() / RAND_MAX;
-      double b = (double) rand() / RAND_MAX;
+      double a = random_fraction(seed);
+      double b = random_fraction(seed);
       int x = int(image.columns() * a);
       int y = int(image.rows() * b);
       c = image.pixelColor(x, y);
@@ -332,12 +481,12 @@ bool convert_to_gray(Image &image, bool invert, bool adaptive, bool verbose)
       image.despeckle();
       if (invert)
         {
-          image.adaptiveThreshold(window,window,7.0);
+          adaptive_threshold(image, window, 7.0);
         }
       else
         {
           image.negate();
-          image.adaptiveThreshold(window,window,7.0);
+          adaptive_threshold(image, window, 7.0);
           image.negate();
         }
     }
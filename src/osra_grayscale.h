@@ -36,10 +36,11 @@ using namespace Magick;
 //
 // Parameters:
 // image -  a reference to the image object
+// seed - state of the random generator used to pick the sample points
 //
 // Returns:
 // a Color object corresponding to the background color
-const Color getBgColor(const Image &image);
+const Color getBgColor(const Image &image, unsigned int &seed);
 
 // Function: convert_to_gray()
 //
@@ -50,7 +51,8 @@ const Color getBgColor(const Image &image);
 // invert - flag set if the image is white-on-black
 // adaptive - flag set if adaptive thresholding is enforced
 // verbose - flag set if verbose reporting is on
+// seed - state of the random generator used to pick the background sample points
 //
 // Returns:
 // a boolean flag indicating whether adaptive thresholding is indicated
-bool convert_to_gray(Image &image, bool invert, bool adaptive, bool verbose);
+bool convert_to_gray(Image &image, bool invert, bool adaptive, bool verbose, unsigned int &seed);
@@ -45,12 +45,201 @@ extern "C" {
    */
   JNIEXPORT jint JNICALL Java_net_sf_osra_OsraLib_processImage(JNIEnv *, jclass, jbyteArray, jobject, jint, jboolean,jint,jdouble,jint, jboolean, jboolean,jstring, jstring,  jboolean, jboolean,jboolean, jboolean, jboolean);
 
+  /*
+   * Class:     net_sf_osra_OsraLib
+   * Method:    processImageBuffer
+   * Signature: (Ljava/nio/ByteBuffer;IILjava/io/Writer;IZIDIZZLjava/lang/String;Ljava/lang/String;ZZZZZ)I
+   */
+  JNIEXPORT jint JNICALL Java_net_sf_osra_OsraLib_processImageBuffer(JNIEnv *, jclass, jobject, jint, jint, jobject, jint, jboolean,jint,jdouble,jint, jboolean, jboolean,jstring, jstring,  jboolean, jboolean,jboolean, jboolean, jboolean);
+
+  /*
+   * Class:     net_sf_osra_OsraLib
+   * Method:    processImageToListener
+   * Signature: ([BLjava/nio/ByteBuffer;IILnet/sf/osra/OsraStructureListener;IZIDIZZLjava/lang/String;Ljava/lang/String;ZZZZZ)I
+   */
+  JNIEXPORT jint JNICALL Java_net_sf_osra_OsraLib_processImageToListener(JNIEnv *, jclass, jbyteArray, jobject, jint, jint, jobject, jint, jboolean,jint,jdouble,jint, jboolean, jboolean,jstring, jstring,  jboolean, jboolean,jboolean, jboolean, jboolean);
+
   /*
    * Class:     net_sf_osra_OsraLib
    * Method:    getVersion
    * Signature: ()Ljava/lang/String;
    */
   JNIEXPORT jstring JNICALL Java_net_sf_osra_OsraLib_getVersion(JNIEnv *, jclass);
+
+  JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *, void *);
+  JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *, void *);
+}
+
+// The dictionaries are loaded once, when JVM loads the library, and are shared by all calls:
+static osra_context_t *java_context = NULL;
+static int java_context_error = 0;
+
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *j_vm, void *reserved)
+{
+  java_context = osra_create_context(".", "", "", false, &java_context_error);
+  return JNI_VERSION_1_2;
+}
+
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *j_vm, void *reserved)
+{
+  osra_destroy_context(java_context);
+  java_context = NULL;
+}
+
+// struct: java_receiver_s
+//      Java object receiving the structures: either java.io.Writer or net.sf.osra.OsraStructureListener
+struct java_receiver_s
+{
+  JavaVM *j_vm;
+  // global reference, as the structures may be delivered by other threads
+  jobject j_receiver;
+  jmethodID method_id;
+  bool is_listener;
+  // the exception thrown by the receiver, if any; no structures are delivered after it
+  jthrowable j_exception;
+};
+// Typedef: java_receiver_t
+//      defines java_receiver_t type based on java_receiver_s struct
+typedef struct java_receiver_s java_receiver_t;
+
+// Function: java_structure_callback()
+//
+// Passes the structure to Java as soon as the library writes it out, so the output is accumulated neither
+// in native nor in Java heap. With streamed pages the call comes from the thread that has completed the page,
+// so that thread is attached to JVM for the time of the call.
+void java_structure_callback(const osra_structure_t &structure, void *user_data)
+{
+  java_receiver_t *receiver = (java_receiver_t *) user_data;
+
+  if (receiver->j_exception != NULL)
+    return;
+
+  JNIEnv *j_env = NULL;
+  bool attached = false;
+  if (receiver->j_vm->GetEnv((void **) &j_env, JNI_VERSION_1_2) == JNI_EDETACHED)
+    {
+      if (receiver->j_vm->AttachCurrentThread((void **) &j_env, NULL) != JNI_OK)
+        return;
+      attached = true;
+    }
+
+  jstring j_record = j_env->NewStringUTF(structure.record.c_str());
+
+  if (j_record != NULL)
+    {
+      if (receiver->is_listener)
+        j_env->CallVoidMethod(receiver->j_receiver, receiver->method_id, j_record, (jint) structure.page,
+                              (jint) structure.x1, (jint) structure.y1, (jint) structure.x2, (jint) structure.y2,
+                              (jdouble) structure.confidence, (jdouble) structure.avg_bond_length);
+      else
+        j_env->CallVoidMethod(receiver->j_receiver, receiver->method_id, j_record);
+
+      j_env->DeleteLocalRef(j_record);
+    }
+
+  // The exception is rethrown by the calling thread, once the recognition is over:
+  if (j_env->ExceptionCheck())
+    {
+      jthrowable j_exception = j_env->ExceptionOccurred();
+      j_env->ExceptionClear();
+      receiver->j_exception = (jthrowable) j_env->NewGlobalRef(j_exception);
+      j_env->DeleteLocalRef(j_exception);
+    }
+
+  if (attached)
+    receiver->j_vm->DetachCurrentThread();
+}
+
+// Function: process_image_data()
+//
+// Recognizes the structures in the image and passes them one by one to java.io.Writer or
+// net.sf.osra.OsraStructureListener. The image is read in place.
+//
+// Parameters:
+//      j_receiver - the writer or the listener
+//      is_listener - true if j_receiver is the listener; the pages are streamed then
+jint process_image_data(JNIEnv *j_env,
+                        const char *image_data,
+                        int image_length,
+                        jobject j_receiver,
+                        bool is_listener,
+                        jint j_rotate,
+                        jboolean j_invert,
+                        jint j_input_resolution,
+                        jdouble j_threshold,
+                        jint j_do_unpaper,
+                        jboolean j_jaggy,
+                        jboolean j_adaptive_option,
+                        jstring j_output_format,
+                        jstring j_embedded_format,
+                        jboolean j_output_confidence,
+                        jboolean j_show_resolution_guess,
+                        jboolean j_show_page,
+                        jboolean j_output_coordinates,
+                        jboolean j_output_avg_bond_length)
+{
+  if (java_context == NULL)
+    return java_context_error;
+
+  java_receiver_t receiver;
+  receiver.j_vm = NULL;
+  receiver.j_receiver = NULL;
+  receiver.j_exception = NULL;
+  receiver.is_listener = is_listener;
+
+  // Locate java.io.Writer#write(String) or net.sf.osra.OsraStructureListener#structureFound() method:
+  jclass j_receiver_class = j_env->GetObjectClass(j_receiver);
+  if (is_listener)
+    receiver.method_id = j_env->GetMethodID(j_receiver_class, "structureFound", "(Ljava/lang/String;IIIIIDD)V");
+  else
+    receiver.method_id = j_env->GetMethodID(j_receiver_class, "write", "(Ljava/lang/String;)V");
+  j_env->DeleteLocalRef(j_receiver_class);
+
+  if (receiver.method_id == NULL || j_env->GetJavaVM(&receiver.j_vm) != JNI_OK)
+    return -1;
+
+  receiver.j_receiver = j_env->NewGlobalRef(j_receiver);
+
+  const char *output_format = j_env->GetStringUTFChars(j_output_format, NULL);
+  const char *embedded_format = j_env->GetStringUTFChars(j_embedded_format, NULL);
+
+  osra_options_t options;
+  options.rotate = j_rotate;
+  options.invert = j_invert;
+  options.input_resolution = j_input_resolution;
+  options.threshold = j_threshold;
+  options.do_unpaper = j_do_unpaper;
+  options.jaggy = j_jaggy;
+  options.adaptive = j_adaptive_option;
+  options.output_format = output_format;
+  options.embedded_format = embedded_format;
+  options.show_confidence = j_output_confidence;
+  options.show_resolution_guess = j_show_resolution_guess;
+  options.show_page = j_show_page;
+  options.show_coordinates = j_output_coordinates;
+  options.show_avg_bond_length = j_output_avg_bond_length;
+  // The listener gets the structures of every page as soon as the page is done:
+  options.stream_pages = is_listener;
+  options.structure_callback = java_structure_callback;
+  options.structure_callback_data = &receiver;
+
+  j_env->ReleaseStringUTFChars(j_output_format, output_format);
+  j_env->ReleaseStringUTFChars(j_embedded_format, embedded_format);
+
+  // All structures go to the callback, the stream stays empty:
+  std::ostringstream structure_output_stream;
+
+  int result = osra_process_image(java_context, image_data, image_length, structure_output_stream, options);
+
+  j_env->DeleteGlobalRef(receiver.j_receiver);
+
+  if (receiver.j_exception != NULL)
+    {
+      j_env->Throw(receiver.j_exception);
+      j_env->DeleteGlobalRef(receiver.j_exception);
+    }
+
+  return result;
 }
 
 JNIEXPORT jint JNICALL Java_net_sf_osra_OsraLib_processImage(JNIEnv *j_env, jclass j_class,
@@ -71,57 +260,104 @@ JNIEXPORT jint JNICALL Java_net_sf_osra_OsraLib_processImage(JNIEnv *j_env, jcla
     jboolean j_output_coordinates,
     jboolean j_output_avg_bond_length)
 {
-  const char *output_format = j_env->GetStringUTFChars(j_output_format, NULL);
-  const char *embedded_format = j_env->GetStringUTFChars(j_embedded_format, NULL);
+  // JVM may give a copy of the array here, use processImageBuffer() with a direct buffer to avoid that:
   const char *image_data = (char *) j_env->GetByteArrayElements(j_image_data, NULL);
 
   int result = -1;
 
   if (image_data != NULL)
     {
-      // Perhaps there is a more optimal way to bridge from std:ostream to java.io.Writer.
-      // See http://stackoverflow.com/questions/524524/creating-an-ostream/524590#524590
-      std::ostringstream structure_output_stream;
-
-      result = osra_process_image(
-                 image_data,
-                 j_env->GetArrayLength(j_image_data),
-                 structure_output_stream,
-                 j_rotate,
-                 j_invert,
-                 j_input_resolution,
-                 j_threshold,
-                 j_do_unpaper,
-                 j_jaggy,
-                 j_adaptive_option,
-                 output_format,
-                 embedded_format,
-                 j_output_confidence,
-                 j_show_resolution_guess,
-                 j_show_page,
-                 j_output_coordinates,
-                 j_output_avg_bond_length,
-                 "."
-               );
+      result = process_image_data(j_env, image_data, j_env->GetArrayLength(j_image_data), j_writer, false, j_rotate, j_invert,
+                                  j_input_resolution, j_threshold, j_do_unpaper, j_jaggy, j_adaptive_option,
+                                  j_output_format, j_embedded_format, j_output_confidence, j_show_resolution_guess,
+                                  j_show_page, j_output_coordinates, j_output_avg_bond_length);
 
       j_env->ReleaseByteArrayElements(j_image_data, (jbyte *) image_data, JNI_ABORT);
+    }
+
+  return result;
+}
+
+JNIEXPORT jint JNICALL Java_net_sf_osra_OsraLib_processImageBuffer(JNIEnv *j_env, jclass j_class,
+    jobject j_image_buffer,
+    jint j_offset,
+    jint j_length,
+    jobject j_writer,
+    jint j_rotate,
+    jboolean j_invert,
+    jint j_input_resolution,
+    jdouble j_threshold,
+    jint j_do_unpaper,
+    jboolean j_jaggy,
+    jboolean j_adaptive_option,
+    jstring j_output_format,
+    jstring j_embedded_format,
+    jboolean j_output_confidence,
+    jboolean j_show_resolution_guess,
+    jboolean j_show_page,
+    jboolean j_output_coordinates,
+    jboolean j_output_avg_bond_length)
+{
+  // The memory of a direct buffer is used as is:
+  const char *image_data = (const char *) j_env->GetDirectBufferAddress(j_image_buffer);
 
-      // Locate java.io.Writer#write(String) method:
-      jclass j_writer_class = j_env->FindClass("java/io/Writer");
-      jmethodID write_method_id = j_env->GetMethodID(j_writer_class, "write", "(Ljava/lang/String;)V");
+  if (image_data == NULL || j_offset < 0 || j_length <= 0 || j_offset + (jlong) j_length > j_env->GetDirectBufferCapacity(j_image_buffer))
+    return -1;
 
-      jstring j_string = j_env->NewStringUTF(structure_output_stream.str().c_str());
+  return process_image_data(j_env, image_data + j_offset, j_length, j_writer, false, j_rotate, j_invert,
+                            j_input_resolution, j_threshold, j_do_unpaper, j_jaggy, j_adaptive_option,
+                            j_output_format, j_embedded_format, j_output_confidence, j_show_resolution_guess,
+                            j_show_page, j_output_coordinates, j_output_avg_bond_length);
+}
+
+JNIEXPORT jint JNICALL Java_net_sf_osra_OsraLib_processImageToListener(JNIEnv *j_env, jclass j_class,
+    jbyteArray j_image_data,
+    jobject j_image_buffer,
+    jint j_offset,
+    jint j_length,
+    jobject j_listener,
+    jint j_rotate,
+    jboolean j_invert,
+    jint j_input_resolution,
+    jdouble j_threshold,
+    jint j_do_unpaper,
+    jboolean j_jaggy,
+    jboolean j_adaptive_option,
+    jstring j_output_format,
+    jstring j_embedded_format,
+    jboolean j_output_confidence,
+    jboolean j_show_resolution_guess,
+    jboolean j_show_page,
+    jboolean j_output_coordinates,
+    jboolean j_output_avg_bond_length)
+{
+  // The image comes either in the array or in the direct buffer:
+  if (j_image_data != NULL)
+    {
+      const char *image_data = (char *) j_env->GetByteArrayElements(j_image_data, NULL);
+
+      if (image_data == NULL)
+        return -1;
 
-      j_env->CallVoidMethod(j_writer, write_method_id, j_string);
+      int result = process_image_data(j_env, image_data, j_env->GetArrayLength(j_image_data), j_listener, true, j_rotate,
+                                      j_invert, j_input_resolution, j_threshold, j_do_unpaper, j_jaggy, j_adaptive_option,
+                                      j_output_format, j_embedded_format, j_output_confidence, j_show_resolution_guess,
+                                      j_show_page, j_output_coordinates, j_output_avg_bond_length);
 
-      j_env->DeleteLocalRef(j_writer_class);
-      j_env->DeleteLocalRef(j_string);
+      j_env->ReleaseByteArrayElements(j_image_data, (jbyte *) image_data, JNI_ABORT);
+
+      return result;
     }
 
-  j_env->ReleaseStringUTFChars(j_output_format, output_format);
-  j_env->ReleaseStringUTFChars(j_embedded_format, embedded_format);
+  const char *image_data = (const char *) j_env->GetDirectBufferAddress(j_image_buffer);
 
-  return result;
+  if (image_data == NULL || j_offset < 0 || j_length <= 0 || j_offset + (jlong) j_length > j_env->GetDirectBufferCapacity(j_image_buffer))
+    return -1;
+
+  return process_image_data(j_env, image_data + j_offset, j_length, j_listener, true, j_rotate, j_invert,
+                            j_input_resolution, j_threshold, j_do_unpaper, j_jaggy, j_adaptive_option,
+                            j_output_format, j_embedded_format, j_output_confidence, j_show_resolution_guess,
+                            j_show_page, j_output_coordinates, j_output_avg_bond_length);
 }
 
 JNIEXPORT jstring JNICALL Java_net_sf_osra_OsraLib_getVersion(JNIEnv *j_env, jclass j_class)
@@ -420,10 +420,9 @@ int assemble_labels(std::vector<letters_t> &letters, int n_letters, std::vector<
 }
 
 
-int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letters_t> &letters,
+int find_numbers(const potrace_path_t * p, const bitmap_t &orig, std::vector<letters_t> &letters,
                  std::vector<atom_t> &atom, std::vector<bond_t> &bond,
-		 int n_atom, int n_bond, int height, int width,
-                 ColorGray &bgColor, double THRESHOLD, int n_letters)
+		 int n_atom, int n_bond, int height, int width, int n_letters)
 {
   int max_font_width, max_font_height;
   std::vector<int> widths, heights;
@@ -580,7 +579,7 @@ int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letter
               while ((top > 0) && (s > 0))
                 {
                   s = 0;
-                  s = get_pixel(orig, bgColor, x1, top, THRESHOLD);
+                  s = get_pixel(orig, x1, top);
                   if (s > 0)
                     top--;
                 }
@@ -588,7 +587,7 @@ int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letter
               while ((bottom < height) && (s > 0))
                 {
                   s = 0;
-                  s = get_pixel(orig, bgColor, x2, bottom, THRESHOLD);
+                  s = get_pixel(orig, x2, bottom);
                   if (s > 0)
                     bottom++;
                 }
@@ -596,7 +595,7 @@ int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letter
               while ((left > 0) && (s > 0))
                 {
                   s = 0;
-                  s = get_pixel(orig, bgColor, left, y1, THRESHOLD);
+                  s = get_pixel(orig, left, y1);
                   if (s > 0)
                     left--;
                 }
@@ -604,7 +603,7 @@ int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letter
               while ((right < width) && (s > 0))
                 {
                   s = 0;
-                  s = get_pixel(orig, bgColor, right, y2, THRESHOLD);
+                  s = get_pixel(orig, right, y2);
                   if (s > 0)
                     right++;
                 }
@@ -627,7 +626,7 @@ int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letter
 	      if (!found)
 		{
 		  char label = 0;
-		  label = get_atom_label(orig, bgColor, left, top, right, bottom, THRESHOLD, (right + left) / 2, top, false, false ,true);
+		  label = get_atom_label(orig, left, top, right, bottom, (right + left) / 2, top, false, false ,true);
 
 		  if (label == '1')
 		    {
@@ -657,9 +656,9 @@ int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letter
   return (n_letters);
 }
 
-int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_t> &letters,
+int find_chars(const potrace_path_t * p, const bitmap_t &orig, std::vector<letters_t> &letters,
                std::vector<atom_t> &atom, std::vector<bond_t> &bond,
-               int n_atom, int n_bond, int height, int width, ColorGray &bgColor, double THRESHOLD,
+               int n_atom, int n_bond, int height, int width,
                int max_font_width, int max_font_height, int &real_font_width, int &real_font_height,
                bool verbose)
 {
@@ -807,7 +806,7 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
               while ((top > 0) && (s > 0))
                 {
                   s = 0;
-                  s = get_pixel(orig, bgColor, x1, top, THRESHOLD);
+                  s = get_pixel(orig, x1, top);
                   if (s > 0)
                     top--;
                 }
@@ -815,7 +814,7 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
               while ((bottom < height) && (s > 0))
                 {
                   s = 0;
-                  s = get_pixel(orig, bgColor, x2, bottom, THRESHOLD);
+                  s = get_pixel(orig, x2, bottom);
                   if (s > 0)
                     bottom++;
                 }
@@ -823,7 +822,7 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
               while ((left > 0) && (s > 0))
                 {
                   s = 0;
-                  s = get_pixel(orig, bgColor, left, y1, THRESHOLD);
+                  s = get_pixel(orig, left, y1);
                   if (s > 0)
                     left--;
                 }
@@ -831,7 +830,7 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
               while ((right < width) && (s > 0))
                 {
                   s = 0;
-                  s = get_pixel(orig, bgColor, right, y2, THRESHOLD);
+                  s = get_pixel(orig, right, y2);
                   if (s > 0)
                     right++;
                 }
@@ -843,7 +842,7 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
             {
 
               char label = 0;
-              label = get_atom_label(orig, bgColor, left, top, right, bottom, THRESHOLD, (right + left) / 2, top, false, verbose);
+              label = get_atom_label(orig, left, top, right, bottom, (right + left) / 2, top, false, verbose);
 
               if (label != 0)
                 {
@@ -877,11 +876,11 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
 
               char label1 = 0;
               int newtop = (top + bottom) / 2;
-              label1 = get_atom_label(orig, bgColor, left, newtop, right, bottom, THRESHOLD, (right + left) / 2,
+              label1 = get_atom_label(orig, left, newtop, right, bottom, (right + left) / 2,
                                       newtop, false, verbose);
               char label2 = 0;
               int newbottom = (top + bottom) / 2;
-              label2 = get_atom_label(orig, bgColor, left, top, right, newbottom, THRESHOLD, (right + left) / 2, top, false, verbose);
+              label2 = get_atom_label(orig, left, top, right, newbottom, (right + left) / 2, top, false, verbose);
               if (label1 != 0 && label2 != 0 && !(tolower(label1) == 's' && tolower(label2) =='s'))
                 {
                   //cout << label1 << label2 << endl;
@@ -932,11 +931,11 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
 
               char label1 = 0;
               int newright = (left + right) / 2;
-              label1 = get_atom_label(orig, bgColor, left, top, newright, bottom, THRESHOLD, (left + newright) / 2,
+              label1 = get_atom_label(orig, left, top, newright, bottom, (left + newright) / 2,
                                       top, false, verbose);
               char label2 = 0;
               int newleft = (left + right) / 2;
-              label2 = get_atom_label(orig, bgColor, newleft, top, right, bottom, THRESHOLD, (newleft + right) / 2,
+              label2 = get_atom_label(orig, newleft, top, right, bottom, (newleft + right) / 2,
                                       top, false, verbose);
               if ((label1 != 0) && (label2 != 0))
                 {
@@ -1002,8 +1001,7 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
 int find_fused_chars(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &atom,
                      std::vector<letters_t> &letters, int n_letters,
                      int max_font_height, int max_font_width, char dummy,
-                     const Image &orig, const ColorGray &bgColor,
-                     double THRESHOLD, unsigned int size, bool verbose)
+                     const bitmap_t &orig, unsigned int size, bool verbose)
 {
   double dist = std::max(max_font_width, max_font_height);
 
@@ -1094,7 +1092,7 @@ int find_fused_chars(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t>
                   }
                 else
                   {
-                    label = get_atom_label(orig, bgColor, left, top, right, bottom, THRESHOLD, (left + right) / 2,
+                    label = get_atom_label(orig, left, top, right, bottom, (left + right) / 2,
                                            top, false, verbose);
                   }
                 if ((label != 0 && label != 'P' && label != 'p' && label != 'F' && label != 'X' && label != 'Y'
@@ -1135,12 +1133,12 @@ int find_fused_chars(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t>
   return (n_letters);
 }
 
-void detect_plus_minus(const Image &image, ColorGray &bg, double THRESHOLD, int x1, int x2, int y1, int y2, int top, int left, int right, int bottom, bool &is_plus, bool &is_minus)
+void detect_plus_minus(const bitmap_t &image, int x1, int x2, int y1, int y2, int top, int left, int right, int bottom, bool &is_plus, bool &is_minus)
 {
   std::vector<std::vector<short> > pic(right-left+1, std::vector<short> (bottom-top+1,0));
   for (int i=left; i<=right; i++)
     for (int j=top; j<=bottom; j++)
-      pic[i-left][j-top] = get_pixel(image, bg, i, j, THRESHOLD) ;
+      pic[i-left][j-top] = get_pixel(image, i, j) ;
 
   int y = 0;
   int x = x1 - left;
@@ -1250,7 +1248,7 @@ void detect_plus_minus(const Image &image, ColorGray &bg, double THRESHOLD, int
 
 }
 
-int find_plus_minus(const potrace_path_t *p, const Image &image, ColorGray &bgColor, double THRESHOLD,
+int find_plus_minus(const potrace_path_t *p, const bitmap_t &image,
                     std::vector<letters_t> &letters, std::vector<atom_t> &atom,
                     std::vector<bond_t> &bond,
                     int n_atom, int n_bond, int height, int width,
@@ -1405,7 +1403,7 @@ int find_plus_minus(const potrace_path_t *p, const Image &image, ColorGray &bgCo
                 }
               bool is_minus = false;
 	      bool is_plus = false;
-	      detect_plus_minus(image,bgColor, THRESHOLD,x1,x2,y1,y2,top,left,right,bottom,is_plus,is_minus);
+	      detect_plus_minus(image,x1,x2,y1,y2,top,left,right,bottom,is_plus,is_minus);
 
               if (is_minus && !char_to_right && !inside_char && (right - left) < avg_bond_length/2)
 		{
@@ -1526,6 +1524,9 @@ int clean_unrecognized_characters(std::vector<bond_t> &bond, int n_bond, const s
 void remove_small_terminal_bonds(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &atom,
                                  double avg)
 {
+  // The bond ends do not move here, so the index stays valid:
+  atom_bonds_t index;
+  index_atom_bonds(bond, n_bond, atom.size(), index);
   bool found = true;
 
   while (found)
@@ -1534,8 +1535,8 @@ void remove_small_terminal_bonds(std::vector<bond_t> &bond, int n_bond, std::vec
       for (int j = 0; j < n_bond; j++)
         if (bond[j].exists && bond[j].type == 1 && !bond[j].wedge && !bond[j].hash && !bond[j].arom && bond_length(bond, j, atom) < avg / 2)
           {
-            bool not_corner_a = terminal_bond(bond[j].a, j, bond, n_bond);
-            bool not_corner_b = terminal_bond(bond[j].b, j, bond, n_bond);
+            bool not_corner_a = terminal_bond(bond[j].a, j, bond, index);
+            bool not_corner_b = terminal_bond(bond[j].b, j, bond, index);
             if (not_corner_a)
               {
                 bond[j].exists = false;
@@ -1555,13 +1556,17 @@ void remove_small_terminal_bonds(std::vector<bond_t> &bond, int n_bond, std::vec
                       {
                         bool dashed = false;
                         int n = 0;
-                        for (int i = 0; i < n_bond; i++)
-                          if (bond[i].exists && i != j && (bond[i].a == bond[j].b || bond[i].b == bond[j].b))
-                            {
-                              n++;
-                              if (bond[i].hash)
-                                dashed = true;
-                            }
+                        const std::vector<int> &bonds_b = index.bonds[bond[j].b];
+                        for (unsigned int k = 0; k < bonds_b.size(); k++)
+                          {
+                            int i = bonds_b[k];
+                            if (bond[i].exists && i != j)
+                              {
+                                n++;
+                                if (bond[i].hash)
+                                  dashed = true;
+                              }
+                          }
                         if (!dashed)
 			  {
 			    atom[bond[j].b].label = "Xx";
@@ -1592,13 +1597,17 @@ void remove_small_terminal_bonds(std::vector<bond_t> &bond, int n_bond, std::vec
                       {
                         bool dashed = false;
                         int n = 0;
-                        for (int i = 0; i < n_bond; i++)
-                          if (bond[i].exists && i != j && (bond[i].a == bond[j].a || bond[i].b == bond[j].a))
-                            {
-                              n++;
-                              if (bond[i].hash)
-                                dashed = true;
-                            }
+                        const std::vector<int> &bonds_a = index.bonds[bond[j].a];
+                        for (unsigned int k = 0; k < bonds_a.size(); k++)
+                          {
+                            int i = bonds_a[k];
+                            if (bond[i].exists && i != j)
+                              {
+                                n++;
+                                if (bond[i].hash)
+                                  dashed = true;
+                              }
+                          }
                         if (!dashed)
 			  {
 			    atom[bond[j].a].label = "Xx";
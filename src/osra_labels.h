@@ -121,7 +121,7 @@ int assemble_labels(std::vector<letters_t> &letters, int n_letters, std::vector<
 //
 // Parameters:
 // p - vectorized output of Potrace routines
-// orig - original image
+// orig - binarized original image
 // letters - vector which will contain recognized characters
 // atom - vector of atoms
 // bond - vector of bonds
@@ -129,8 +129,6 @@ int assemble_labels(std::vector<letters_t> &letters, int n_letters, std::vector<
 // n_bond - number of bonds
 // height - image height
 // width - image width
-// bgColor - background color
-// THRESHOLD - black-white binarization threshold
 // max_font_width - maximum font width for the specific resolution in pixels
 // max_font_height - maximum font height for the specific resolution in pixels
 // real_font_width - detected font width
@@ -139,9 +137,9 @@ int assemble_labels(std::vector<letters_t> &letters, int n_letters, std::vector<
 //
 // Returns:
 // number of recognized characters
-int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_t> &letters, std::vector<atom_t> &atom,
+int find_chars(const potrace_path_t * p, const bitmap_t &orig, std::vector<letters_t> &letters, std::vector<atom_t> &atom,
                std::vector<bond_t> &bond, int n_atom, int n_bond, int height,
-               int width, ColorGray &bgColor, double THRESHOLD, int max_font_width,
+               int width, int max_font_width,
                int max_font_height, int &real_font_width, int &real_font_height, bool verbose);
 
 // Function: find_numbers()
@@ -150,7 +148,7 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
 //
 // Parameters:
 // p - vectorized output of Potrace routines
-// orig - original image
+// orig - binarized original image
 // letters - vector which will contain recognized characters
 // atom - vector of atoms
 // bond - vector of bonds
@@ -158,14 +156,12 @@ int find_chars(const potrace_path_t * p, const Image &orig, std::vector<letters_
 // n_bond - number of bonds
 // height - image height
 // width - image width
-// bgColor - background color
-// THRESHOLD - black-white binarization threshold
 // n_letters - number of previously recognized characters
 //
 // Returns:
 // number of recognized characters
-int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letters_t> &letters, std::vector<atom_t> &atom, std::vector<bond_t> &bond,
-		 int n_atom, int n_bond, int height, int width, ColorGray &bgColor, double THRESHOLD, int n_letters);
+int find_numbers(const potrace_path_t * p, const bitmap_t &orig, std::vector<letters_t> &letters, std::vector<atom_t> &atom, std::vector<bond_t> &bond,
+		 int n_atom, int n_bond, int height, int width, int n_letters);
 
 // Function: find_plus_minus()
 //
@@ -173,9 +169,7 @@ int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letter
 //
 // Parameters:
 // p - Potrace vectorization output
-// image - original image
-// bgColor - background color
-// THRESHOLD - black-white binarization threshold
+// image - binarized original image
 // letters - a vector of atomic label characters
 // atom -  a vector of atoms
 // bond - a vector of bonds
@@ -189,7 +183,7 @@ int find_numbers(const potrace_path_t * p, const Image &orig, std::vector<letter
 //
 // Returns:
 // new number of characters
-int find_plus_minus(const potrace_path_t *p, const Image &image, ColorGray &bgColor, double THRESHOLD,
+int find_plus_minus(const potrace_path_t *p, const bitmap_t &image,
                     std::vector<letters_t> &letters, std::vector<atom_t> &atom, std::vector<bond_t> &bond,
                     int n_atom, int n_bond, int height, int width, int max_font_height, int max_font_width,
                     int n_letters, double avg_bond_length);
@@ -261,9 +255,7 @@ int remove_small_bonds(std::vector<bond_t> &bond, int n_bond, const std::vector<
 // max_font_height - maximum font height
 // max_font_width - maximum font width
 // dummy - if set, character to substitute for OCR results
-// orig  - original image
-// bgColor - background color
-// THRESHOLD - black-white threshold for image binarization
+// orig  - binarized original image
 // size - minimum number of bonds which can constitute a character
 // verbose - flag for verbose output
 //
@@ -271,6 +263,5 @@ int remove_small_bonds(std::vector<bond_t> &bond, int n_bond, const std::vector<
 // new value for n_letters
 int find_fused_chars(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &atom,
                      std::vector<letters_t> &letters, int n_letters, int max_font_height,
-                     int max_font_width, char dummy, const Image &orig, const ColorGray &bgColor,
-                     double THRESHOLD, unsigned int size, bool verbose);
+                     int max_font_width, char dummy, const bitmap_t &orig, unsigned int size, bool verbose);
 #endif
@@ -17,11 +17,12 @@
  St, Fifth Floor, Boston, MA 02110-1301, USA
  *****************************************************************************/
 
-#include <stdio.h> // fclose
+#include <stdio.h> // fclose(), fdopen(), fprintf()
 #include <stdlib.h> // malloc(), free()
 #include <math.h> // fabs(double)
 #include <float.h> // FLT_MAX
 #include <limits.h> // INT_MAX
+#include <unistd.h> // dup()
 
 #include <list> // sdt::list
 #include <vector> // std::vector
@@ -31,6 +32,10 @@
 #include <fstream> // std::ofstream, std::ifstream
 #include <sstream> // std:ostringstream
 
+#ifdef _OPENMP
+#include <omp.h> // omp_get_max_threads(), omp_get_thread_num()
+#endif
+
 #include <Magick++.h>
 
 extern "C" {
@@ -55,6 +60,7 @@ extern "C" {
 #include "osra_openbabel.h"
 #include "osra_reaction.h"
 #include "osra_anisotropic.h"
+#include "osra_pdf.h"
 #include "osra_stl.h"
 #include "unpaper.h"
 #include "config.h" // DATA_DIR
@@ -119,15 +125,31 @@ int load_superatom_spelling_maps(
   return 0;
 }
 
-void create_thick_box(Image &orig_box,Image &thick_box,int &width,int &height,int &resolution,int &working_resolution,double &box_scale,
+// Function: create_thick_box()
+//
+// Rescales and smooths the box to the working resolution, and binarizes both the original and the resulting box once
+// for all the recognition routines (each image is binarized at most once, and not at all if it is the same as the other)
+//
+// Parameters:
+//      orig_box - the box as cut from the page, rescaled in place if needed
+//      thick_box - the box to vectorize
+//      orig_bitmap, thick_bitmap - binarized orig_box and thick_box
+void create_thick_box(Image &orig_box,Image &thick_box,bitmap_t &orig_bitmap,bitmap_t &thick_bitmap,int &width,int &height,
+                      int &resolution,int &working_resolution,double &box_scale,
                       ColorGray bgColor, double THRESHOLD_BOND, int res_iter, bool &thick, bool jaggy)
 {
+  // Whether orig_bitmap is up to date with orig_box, and whether thick_box is a copy of orig_box:
+  bool orig_binarized = false;
+  bool thick_is_orig = true;
+
   if (resolution >= 300)
     {
       int max_hist;
       double nf45;
+      binarize_image(orig_box, bgColor, THRESHOLD_BOND, orig_bitmap);
+      orig_binarized = true;
       double nf =
-        noise_factor(orig_box, width, height, bgColor, THRESHOLD_BOND, resolution, max_hist, nf45);
+        noise_factor(orig_bitmap, width, height, resolution, max_hist, nf45);
 
       //if (max_hist < 5) thick = false;
       if (res_iter == NUM_RESOLUTIONS-2)  // no thinning
@@ -154,7 +176,9 @@ void create_thick_box(Image &orig_box,Image &thick_box,int &width,int &height,in
               thick_box = orig_box;
               width = thick_box.columns();
               height = thick_box.rows();
-	      nf = noise_factor(orig_box, width, height, bgColor, THRESHOLD_BOND, resolution, max_hist, nf45);
+              binarize_image(orig_box, bgColor, THRESHOLD_BOND, orig_bitmap);
+              orig_binarized = true;
+	      nf = noise_factor(orig_bitmap, width, height, resolution, max_hist, nf45);
             }
           else
             {
@@ -169,12 +193,15 @@ void create_thick_box(Image &orig_box,Image &thick_box,int &width,int &height,in
               width = thick_box.columns();
               height = thick_box.rows();
               thick = false;
-              nf = noise_factor(orig_box, width, height, bgColor, THRESHOLD_BOND, resolution,  max_hist, nf45);
+              binarize_image(orig_box, bgColor, THRESHOLD_BOND, orig_bitmap);
+              orig_binarized = true;
+              nf = noise_factor(orig_bitmap, width, height, resolution,  max_hist, nf45);
             }
         }
       if (jaggy)
         {
           orig_box.scale("50%");
+          orig_binarized = false;
           box_scale *= 2;
           working_resolution = 150;
           //orig_box.scale("33%");
@@ -188,6 +215,7 @@ void create_thick_box(Image &orig_box,Image &thick_box,int &width,int &height,in
         try
           {
             thick_box = anisotropic_smoothing(orig_box, width, height, 20, 0.3, 1.0, 0.6, 2);
+            thick_is_orig = false;
           }
         catch (...)
           {
@@ -211,6 +239,7 @@ void create_thick_box(Image &orig_box,Image &thick_box,int &width,int &height,in
       int nw = width * 300 / resolution;
       int nh = height * 300 / resolution;
       thick_box = anisotropic_scaling(orig_box, width, height, nw, nh);
+      thick_is_orig = false;
       width = thick_box.columns();
       height = thick_box.rows();
       int percent = (100 * 300) / resolution;
@@ -222,9 +251,16 @@ void create_thick_box(Image &orig_box,Image &thick_box,int &width,int &height,in
     }
   else
     thick_box = orig_box;
+
+  if (!orig_binarized)
+    binarize_image(orig_box, bgColor, THRESHOLD_BOND, orig_bitmap);
+  if (thick_is_orig)
+    thick_bitmap = orig_bitmap;
+  else
+    binarize_image(thick_box, bgColor, THRESHOLD_BOND, thick_bitmap);
 }
 
-potrace_state_t * const  raster_to_vector(Image &box,ColorGray bgColor, double THRESHOLD_BOND,int width,int height,int working_resolution)
+potrace_state_t * const  raster_to_vector(const bitmap_t &box,int width,int height,int working_resolution)
 {
   potrace_param_t * const param = potrace_param_default();
   param->alphamax = 5e-324; // this has been changed in potrace-1.11 
@@ -240,7 +276,7 @@ potrace_state_t * const  raster_to_vector(Image &box,ColorGray bgColor, double T
   potrace_bitmap_t * const bm = bm_new(width, height);
   for (int i = 0; i < width; i++)
     for (int j = 0; j < height; j++)
-      BM_PUT(bm, i, j, get_pixel(box, bgColor, i, j, THRESHOLD_BOND));
+      BM_PUT(bm, i, j, get_pixel(box, i, j));
 
   potrace_state_t * const st = potrace_trace(param, bm);
   if (bm != NULL)
@@ -319,11 +355,13 @@ void split_fragments_and_assemble_structure_record(
     bool show_page,
     bool show_coordinates,
     bool show_avg_bond_length,
+    const std::string &source,
     std::vector<std::vector<std::string> > &array_of_structures,
     std::vector<std::vector<double> > &array_of_avg_bonds,
     std::vector<std::vector<double> > &array_of_ind_conf,
     std::vector<std::vector<Image> > &array_of_images,
     std::vector<std::vector<box_t> > &array_of_boxes,
+    std::vector<std::vector<molecule_ptr_t> > &array_of_molecules,
     int &total_boxes,
     double &total_confidence,
     int n_letters,
@@ -410,6 +448,8 @@ void split_fragments_and_assemble_structure_record(
               if (verbose)
                 std::cout << "Coordinate box: " << coordinate_box.x1 << "x" << coordinate_box.y1 << "-" << coordinate_box.x2 << "x"
                           << coordinate_box.y2 << "." << std::endl;
+	      // The reactions are assembled from the molecules themselves, so these are kept instead of the text:
+	      molecule_ptr_t molecule;
 	      if (is_reaction)
 		output_format = SUBSTITUTE_REACTION_FORMAT;
 
@@ -420,8 +460,9 @@ void split_fragments_and_assemble_structure_record(
                                         show_avg_bond_length,
                                         show_resolution_guess ? &resolution : NULL,
                                         show_page ? &page_number : NULL,
-                                        show_coordinates ? &coordinate_box : NULL, superatom, n_letters, show_learning, resolution_iteration, verbose,
-					brackets);
+                                        show_coordinates ? &coordinate_box : NULL,
+                                        source.empty() ? NULL : &source, superatom, n_letters, show_learning, resolution_iteration, verbose,
+					brackets, is_reaction ? &molecule : NULL);
 
               if (molecule_statistics.fragments > 0 && molecule_statistics.fragments < MAX_FRAGMENTS
 		  && molecule_statistics.num_atoms>MIN_A_COUNT && molecule_statistics.num_bonds>0
@@ -436,10 +477,16 @@ void split_fragments_and_assemble_structure_record(
 		      array_of_avg_bonds[res_iter].push_back(page_scale * box_scale * avg_bond_length);
 		      array_of_ind_conf[res_iter].push_back(confidence);
 		      array_of_boxes[res_iter].push_back(rel_box);
+		      if (is_reaction)
+			array_of_molecules[res_iter].push_back(molecule);
 
 		      if (!output_image_file_prefix.empty())
 			{
-			  Image tmp = image;
+			  Image tmp;
+			  // The page image is shared by all the boxes processed in parallel
+			  #pragma omp critical (page_image)
+			  {
+			  tmp = image;
 			  if (!is_reaction)
 			    {
 			      Geometry geometry =
@@ -458,6 +505,7 @@ void split_fragments_and_assemble_structure_record(
 				  tmp = orig_box;
 				}
 			    }
+			  }
 			  array_of_images[res_iter].push_back(tmp);
 			}
 		    }
@@ -471,6 +519,240 @@ void split_fragments_and_assemble_structure_record(
     }
 }
 
+// struct: box_result_s
+//      Structures recognized in a single box. Boxes are processed in parallel, every box fills its own
+//      record, and the records are merged in the box order afterwards.
+struct box_result_s
+{
+  // Indexed the same way as the per-resolution arrays of osra_process_image(), but hold a single resolution only
+  std::vector<std::vector<std::string> > structures;
+  std::vector<std::vector<double> > avg_bonds;
+  std::vector<std::vector<double> > ind_conf;
+  std::vector<std::vector<Image> > images;
+  std::vector<std::vector<box_t> > boxes;
+  std::vector<std::vector<molecule_ptr_t> > molecules;
+  int total_boxes;
+  double total_confidence;
+
+  box_result_s() : structures(1), avg_bonds(1), ind_conf(1), images(1), boxes(1), molecules(1), total_boxes(0), total_confidence(0)
+  {
+  }
+};
+// Typedef: box_result_t
+//      defines box_result_t type based on box_result_s struct
+typedef struct box_result_s box_result_t;
+
+// Function: box_fits_resolution()
+//
+// Checks if the box is large enough to hold a structure when processed at the given resolution
+bool box_fits_resolution(const box_t &box, int resolution)
+{
+  int working_resolution = std::min(resolution, 300);
+  int max_font_height = MAX_FONT_HEIGHT * working_resolution / 150;
+  int max_font_width = MAX_FONT_WIDTH * working_resolution / 150;
+  return (box.x2 - box.x1) > max_font_width && (box.y2 - box.y1) > max_font_height
+         && !box.c.empty() && ((box.x2 - box.x1) > 2 * max_font_width || (box.y2 - box.y1) > 2 * max_font_height);
+}
+
+// Function: is_confident_result()
+//
+// Checks if the box has yielded structures and all of them have at least the given confidence
+bool is_confident_result(const box_result_t &result, double min_confidence)
+{
+  if (result.ind_conf[0].empty())
+    return false;
+  for (unsigned int i = 0; i < result.ind_conf[0].size(); i++)
+    if (result.ind_conf[0][i] < min_confidence)
+      return false;
+  return true;
+}
+
+// struct: page_result_s
+//      Structures recognized on a single page at the chosen resolution (or at all resolutions with
+//      the learning output), waiting to be written out.
+struct page_result_s
+{
+  std::vector<std::string> structures;
+  std::vector<Image> images;
+  std::vector<double> avg_bonds;
+  std::vector<double> ind_conf;
+  std::vector<box_t> boxes;
+  // Only kept for the reactions, see <split_fragments_and_assemble_structure_record()>
+  std::vector<molecule_ptr_t> molecules;
+  // Page number and the transformation from the boxes to the coordinates on the input page
+  int page;
+  double page_scale;
+  int unpaper_dx, unpaper_dy;
+
+  page_result_s() : page(0), page_scale(1), unpaper_dx(0), unpaper_dy(0)
+  {
+  }
+};
+// Typedef: page_result_t
+//      defines page_result_t type based on page_result_s struct
+typedef struct page_result_s page_result_t;
+
+// Function: select_best_resolution()
+//
+// Chooses the resolution pass with the highest average confidence per box. On a tie the 300 dpi pass is preferred.
+//
+// Parameters:
+//      confidence - total confidence per resolution pass
+//      boxes - number of boxes per resolution pass
+//      select_resolution - the resolutions of the passes
+//
+// Returns:
+//      index of the chosen resolution pass
+int select_best_resolution(const std::vector<double> &confidence, const std::vector<int> &boxes,
+                           const std::vector<int> &select_resolution)
+{
+  double max_conf = -FLT_MAX;
+  int max_res = 0;
+  for (unsigned int i = 0; i < confidence.size(); i++)
+    if (boxes[i] > 0 && confidence[i] / boxes[i] > max_conf)
+      {
+        max_conf = confidence[i] / boxes[i];
+        max_res = i;
+      }
+  for (unsigned int i = 0; i < confidence.size(); i++)
+    if (boxes[i] > 0 && confidence[i] / boxes[i] == max_conf && select_resolution[i] == 300) // second 300 dpi is without thinning
+      {
+        max_res = i;
+        break;
+      }
+  return max_res;
+}
+
+// Function: select_page_result()
+//
+// Moves the structures of the given resolution pass into the page result.
+void select_page_result(page_result_t &page_result, std::vector<std::vector<std::string> > &array_of_structures,
+                        std::vector<std::vector<Image> > &array_of_images, std::vector<std::vector<double> > &array_of_avg_bonds,
+                        std::vector<std::vector<double> > &array_of_ind_conf, std::vector<std::vector<box_t> > &array_of_boxes,
+                        std::vector<std::vector<molecule_ptr_t> > &array_of_molecules, int res_iter)
+{
+  page_result.structures.swap(array_of_structures[res_iter]);
+  page_result.images.swap(array_of_images[res_iter]);
+  page_result.avg_bonds.swap(array_of_avg_bonds[res_iter]);
+  page_result.ind_conf.swap(array_of_ind_conf[res_iter]);
+  page_result.boxes.swap(array_of_boxes[res_iter]);
+  page_result.molecules.swap(array_of_molecules[res_iter]);
+}
+
+// Function: write_structure_image()
+//
+// Dumps the image of a structure into a file, optionally cropped and resized.
+void write_structure_image(const Image &image, const std::string &fname, const std::string &resize, const box_t *crop = NULL)
+{
+  Image tmp = image;
+  if (crop != NULL)
+    tmp.crop(Geometry(crop->x2 - crop->x1, crop->y2 - crop->y1, crop->x1, crop->y1));
+  if (resize != "")
+    tmp.scale(resize);
+  tmp.write(fname);
+}
+
+// Function: make_structure()
+//
+// Fills in the structure record passed to the structure callback.
+//
+// Parameters:
+//      page_result - the page the structure is found on
+//      record - the structure (or reaction) as it is written out
+//      box - the box of the structure on the processed page
+void make_structure(osra_structure_t &structure, const page_result_t &page_result, const std::string &record,
+                    const box_t &box, double confidence, double avg_bond_length)
+{
+  double page_scale = page_result.page_scale;
+  structure.record = record;
+  structure.page = page_result.page;
+  structure.x1 = (int) (-page_scale * page_result.unpaper_dx + page_scale * box.x1);
+  structure.y1 = (int) (-page_scale * page_result.unpaper_dy + page_scale * box.y1);
+  structure.x2 = (int) (-page_scale * page_result.unpaper_dx + page_scale * box.x2);
+  structure.y2 = (int) (-page_scale * page_result.unpaper_dy + page_scale * box.y2);
+  structure.confidence = confidence;
+  structure.avg_bond_length = avg_bond_length;
+}
+
+// Function: write_structure()
+//
+// Writes out the structure record to the stream or passes it to the structure callback, if one is set.
+void write_structure(std::ostream &out_stream, const osra_structure_t &structure, const osra_options_t &options)
+{
+  if (options.structure_callback != NULL)
+    options.structure_callback(structure, options.structure_callback_data);
+  else
+    out_stream << structure.record;
+}
+
+// Function: output_page_structures()
+//
+// Writes out the structures or reactions recognized on a page and dumps their images, if the prefix is given.
+// The structure with the highest confidence is remembered for MOL output, which gets only one structure per document.
+//
+// Parameters:
+//      out_stream - stream to write the structures to
+//      page_result - structures recognized on the page
+//      arrows, pluses - reaction arrows and pluses found on the page
+//      options - output options, the structure callback among them
+//      image_count - number of the structure images dumped so far
+//      max_confidence, best_structure, best_image - the most confident structure seen so far
+void output_page_structures(std::ostream &out_stream, const page_result_t &page_result, std::vector<arrow_t> &arrows,
+                            const std::vector<plus_t> &pluses, const std::string &output_format, bool is_reaction,
+                            const std::string &output_image_file_prefix, const std::string &resize, double best_bond,
+                            const osra_options_t &options, int &image_count, double &max_confidence,
+                            osra_structure_t &best_structure, Image &best_image)
+{
+  osra_structure_t structure;
+  for (unsigned int i = 0; i < page_result.structures.size(); i++)
+    if (best_bond == 0 || (page_result.avg_bonds[i] > best_bond/2 && page_result.avg_bonds[i] < 2*best_bond))
+      {
+        if (page_result.ind_conf[i] > max_confidence)
+          {
+            max_confidence = page_result.ind_conf[i];
+            make_structure(best_structure, page_result, page_result.structures[i], page_result.boxes[i],
+                           page_result.ind_conf[i], page_result.avg_bonds[i]);
+            if (!output_image_file_prefix.empty())
+              best_image = page_result.images[i];
+          }
+
+        if (output_format != "mol" && !is_reaction)
+          {
+            make_structure(structure, page_result, page_result.structures[i], page_result.boxes[i],
+                           page_result.ind_conf[i], page_result.avg_bonds[i]);
+            write_structure(out_stream, structure, options);
+
+            // Dump this structure into a separate file:
+            if (!output_image_file_prefix.empty())
+              {
+                std::ostringstream fname;
+                fname << output_image_file_prefix << image_count << ".png";
+                image_count++;
+                write_structure_image(page_result.images[i], fname.str(), resize);
+              }
+          }
+      }
+  if (is_reaction && !arrows.empty())
+    {
+      std::vector<std::string> reactions;
+      std::vector<box_t> rbox;
+      arrange_reactions(arrows, page_result.boxes, pluses, reactions, rbox, page_result.molecules, output_format);
+      for (unsigned int k = 0; k < reactions.size(); k++)
+        {
+          make_structure(structure, page_result, reactions[k] + "\n", rbox[k], 0, 0);
+          write_structure(out_stream, structure, options);
+
+          if (!output_image_file_prefix.empty())
+            {
+              std::ostringstream fname;
+              fname << output_image_file_prefix << image_count << ".png";
+              image_count++;
+              write_structure_image(page_result.images[k], fname.str(), resize, &rbox[k]);
+            }
+        }
+    }
+}
+
 int count_recognized_chars(std::vector<atom_t>  &atom, std::vector<bond_t>& bond)
 {
   std::string char_filter = "oOcCNHsSBMeEXYZRPp23456789AF";
@@ -491,10 +773,52 @@ int count_recognized_chars(std::vector<atom_t>  &atom, std::vector<bond_t>& bond
   return r;
 }
 
-Image process_pdf_page(poppler::document* doc,  poppler::page_renderer &r, int l, int resolution)
+// Function: native_pdf_page_resolution()
+//
+// Detects if the page is a scan: there is no text on it and one of the embedded images covers the page exactly,
+// at the same horizontal and vertical resolution (within PDF_NATIVE_RESOLUTION_TOLERANCE, rounded to whole dpi).
+//
+// Parameters:
+//      p - the page
+//      image_sizes - the sizes of the images the page draws, see <find_pdf_page_image_sizes()>
+//
+// Returns:
+//      the resolution of the scan or 0 if the page is not a scan
+int native_pdf_page_resolution(const poppler::page *p, const std::set<std::pair<int, int> > &image_sizes)
+{
+  poppler::rectf rect = p->page_rect();
+  if (rect.width() <= 0 || rect.height() <= 0)
+    return 0;
+
+  int native = 0;
+  for (std::set<std::pair<int, int> >::const_iterator i = image_sizes.begin(); i != image_sizes.end(); i++)
+    for (int rotated = 0; rotated < 2; rotated++)
+      {
+        // The page can be rotated with respect to the image:
+        double res_x = 72. * i->first / (rotated ? rect.height() : rect.width());
+        double res_y = 72. * i->second / (rotated ? rect.width() : rect.height());
+        if (fabs(res_x - res_y) <= PDF_NATIVE_RESOLUTION_TOLERANCE * res_x)
+          {
+            int res = (int) (res_x + 0.5);
+            // Images of different resolutions covering the page make the scan resolution ambiguous:
+            if (native != 0 && native != res)
+              return 0;
+            native = res;
+          }
+      }
+
+  // The text layer is extracted only for the pages that may be scans, as it takes time:
+  if (native != 0 && !p->text().empty())
+    return 0;
+
+  return native;
+}
+
+// Function: poppler_image_to_image()
+//
+// Converts the page rendered by poppler into an image
+Image poppler_image_to_image(const poppler::image &im)
 {
-  poppler::page* p = doc->create_page(l);
-  poppler::image im = r.render_page(p, resolution, resolution);
   Image image(Geometry(im.width(), im.height()), "white");
   image.modifyImage();
   image.type(TrueColorType);
@@ -520,6 +844,152 @@ Image process_pdf_page(poppler::document* doc,  poppler::page_renderer &r, int l
   return image;
 }
 
+// Function: find_pdf_page_region()
+//
+// Locates the part of the PDF page that holds the structures. The page is rendered at a low resolution and segmented
+// the same way the page itself is; the boxes found make up the region (plus a margin).
+//
+// Parameters:
+//      p - the page
+//      r - poppler renderer
+//      resolution - the resolution the page is going to be rendered at
+//      invert - force color inversion
+//      seed - random seed for the background sampling, is not consumed
+//      region - the region in pixels at the given resolution (returned to the caller)
+//
+// Returns:
+//      false if the whole page is to be rendered: nothing is found at the low resolution (small structures may be
+//      missed there) or the region is not worth it
+bool find_pdf_page_region(const poppler::page *p, poppler::page_renderer &r, int resolution, bool invert,
+                          unsigned int seed, box_t &region)
+{
+  if (resolution <= PDF_PREVIEW_RESOLUTION)
+    return false;
+
+  poppler::image im = r.render_page(p, PDF_PREVIEW_RESOLUTION, PDF_PREVIEW_RESOLUTION);
+  if (im.width() <= 0 || im.height() <= 0)
+    return false;
+
+  Image preview = poppler_image_to_image(im);
+  bool adaptive = convert_to_gray(preview, invert, false, false, seed);
+  ColorGray bgColor = getBgColor(preview, seed);
+
+  std::vector<arrow_t> arrows;
+  std::vector<plus_t> pluses;
+  std::list<std::list<std::list<point_t> > > clusters = find_segments(preview, 0.1, bgColor, adaptive, false, arrows, pluses, false);
+  std::vector<box_t> boxes;
+  std::set<std::pair<int, int> > brackets;
+  prune_clusters(clusters, boxes, brackets);
+
+  double scale = (double) resolution / PDF_PREVIEW_RESOLUTION;
+  int width = (int) (scale * im.width());
+  int height = (int) (scale * im.height());
+  int margin = (int) (PDF_REGION_MARGIN * resolution);
+
+  region.x1 = region.y1 = region.x2 = region.y2 = 0;
+  if (boxes.empty())
+    return false;
+
+  region.x1 = INT_MAX;
+  region.y1 = INT_MAX;
+  for (unsigned int i = 0; i < boxes.size(); i++)
+    {
+      region.x1 = std::min(region.x1, (int) (scale * boxes[i].x1) - margin);
+      region.y1 = std::min(region.y1, (int) (scale * boxes[i].y1) - margin);
+      region.x2 = std::max(region.x2, (int) (scale * (boxes[i].x2 + 1)) + margin);
+      region.y2 = std::max(region.y2, (int) (scale * (boxes[i].y2 + 1)) + margin);
+    }
+  region.x1 = std::max(region.x1, 0);
+  region.y1 = std::max(region.y1, 0);
+  region.x2 = std::min(region.x2, width);
+  region.y2 = std::min(region.y2, height);
+
+  return (double) (region.x2 - region.x1) * (region.y2 - region.y1) < PDF_REGION_MAX_COVERAGE * width * height;
+}
+
+// Function: process_pdf_page()
+//
+// Renders the PDF page. If asked, only the region with the structures is rendered at the given resolution, see
+// <find_pdf_page_region()>.
+//
+// Parameters:
+//      doc - the document
+//      r - poppler renderer
+//      l - page number, starting from 0
+//      resolution - the resolution to render at
+//      image_sizes - if not NULL, the sizes of the images the page draws; a scanned page is rendered at about the
+//                    resolution of the scan then, see <native_pdf_page_resolution()>
+//      use_region - render only the region with the structures
+//      invert, seed - see <find_pdf_page_region()>
+//      x_offset, y_offset - position of the rendered part on the page (returned to the caller)
+//      verbose - print debug information
+Image process_pdf_page(poppler::document* doc, poppler::page_renderer &r, int l, int resolution,
+                       const std::set<std::pair<int, int> > *image_sizes, bool use_region, bool invert, unsigned int seed,
+                       int &x_offset, int &y_offset, bool verbose)
+{
+  poppler::page* p = doc->create_page(l);
+  if (image_sizes != NULL && !image_sizes->empty())
+    {
+      int native = native_pdf_page_resolution(p, *image_sizes);
+      if (native >= PDF_MIN_NATIVE_RESOLUTION && native <= PDF_MAX_NATIVE_RESOLUTION)
+        {
+          if (verbose)
+            std::cout << "Page " << (l + 1) << " is a scan at " << native << " dpi." << std::endl;
+          resolution = native;
+        }
+    }
+  box_t region;
+  x_offset = y_offset = 0;
+  if (use_region && find_pdf_page_region(p, r, resolution, invert, seed, region))
+    {
+      if (verbose)
+        std::cout << "Page region: " << region.x1 << "x" << region.y1 << "-" << region.x2 << "x" << region.y2 << "." << std::endl;
+
+      x_offset = region.x1;
+      y_offset = region.y1;
+    }
+  else
+    {
+      region.x1 = region.y1 = 0;
+      region.x2 = region.y2 = -1;
+    }
+  poppler::image im = (region.x2 < 0) ? r.render_page(p, resolution, resolution) :
+    r.render_page(p, resolution, resolution, region.x1, region.y1, region.x2 - region.x1, region.y2 - region.y1);
+  delete p;
+  return poppler_image_to_image(im);
+}
+
+// Function: load_pdf_document()
+//
+// Opens PDF/PS document with poppler. poppler::document is not safe to share between threads,
+// so each thread rendering pages should have its own copy.
+//
+// Parameters:
+//      image_data, image_length - the document in memory
+//      input_file - the document file name
+//
+// Returns:
+//      poppler document or NULL if the input cannot be parsed
+poppler::document *load_pdf_document(const char *image_data, int image_length)
+{
+  return poppler::document::load_from_raw_data(image_data, image_length);
+}
+
+poppler::document *load_pdf_document(const std::string &input_file)
+{
+  return poppler::document::load_from_file(input_file);
+}
+
+// Function: load_pdf_document()
+//
+// Opens PDF/PS document either from memory or from file, whichever is given.
+poppler::document *load_pdf_document(const char *image_data, int image_length, const std::string &input_file)
+{
+  if (image_data != NULL)
+    return load_pdf_document(image_data, image_length);
+  return load_pdf_document(input_file);
+}
+
 extern job_t *OCR_JOB;
 extern job_t *JOB;
 
@@ -560,74 +1030,115 @@ void __attribute__ ((destructor)) osra_destroy()
   MagickLib::DestroyMagick();
 #endif
   osra_ocr_destroy();
+  osra_openbabel_destroy();
 }
 
-int osra_process_image(
-#ifdef OSRA_LIB
-  const char *image_data,
-  int image_length,
-  std::ostream &structure_output_stream,
-#else
-  const std::string &input_file,
-  const std::string &output_file,
-#endif
-  int rotate,
-  bool invert,
-  int input_resolution,
-  double threshold,
-  int do_unpaper,
-  bool jaggy,
-  bool adaptive_option,
-  std::string output_format,
-  std::string embedded_format,
-  bool show_confidence,
-  bool show_resolution_guess,
-  bool show_page,
-  bool show_coordinates,
-  bool show_avg_bond_length,
-  bool show_learning,
-  const std::string &osra_dir,
-  const std::string &spelling_file,
-  const std::string &superatom_file,
-  bool debug,
-  bool verbose,
-  const std::string &output_image_file_prefix,
-  const std::string &resize,
-  const std::string &preview
-)
+// struct: osra_context_s
+//      Resources that are loaded once and shared by all recognitions run with the context. The context
+//      is never modified by the recognition, so it can be used by several threads at once.
+struct osra_context_s
 {
+  // spelling corrections and superatom labels mapped to SMILES, see load_superatom_spelling_maps()
+  std::map<std::string, std::string> spelling;
+  std::map<std::string, std::string> superatom;
+};
+
+osra_context_t *osra_create_context(const std::string &osra_dir, const std::string &spelling_file,
+                                    const std::string &superatom_file, bool verbose, int *error)
+{
+  int err = 0;
 #ifdef OSRA_LIB
-  if (global_init_state != 0) return global_init_state;
+  // OCR engines and OpenBabel formats are loaded by osra_init() once per process:
+  err = global_init_state;
 #endif
 
-  std::transform(output_format.begin(), output_format.end(), output_format.begin(), ::tolower);
-  std::transform(embedded_format.begin(), embedded_format.end(), embedded_format.begin(), ::tolower);
+  osra_context_t *context = NULL;
+  if (err == 0)
+    {
+      context = new osra_context_t;
+      err = load_superatom_spelling_maps(context->spelling, context->superatom, osra_dir, spelling_file, superatom_file, verbose);
+      if (err != 0)
+        {
+          delete context;
+          context = NULL;
+        }
+      else
+        osra_openbabel_compile_superatoms(context->superatom);
+    }
 
-  std::map<std::string, std::string> spelling, superatom;
-  int err = load_superatom_spelling_maps(spelling, superatom, osra_dir, spelling_file, superatom_file, verbose);
-  if (err != 0) return err;
+  if (error != NULL)
+    *error = err;
+  return context;
+}
 
-  std::string type;
+void osra_destroy_context(osra_context_t *context)
+{
+  delete context;
+}
 
-#ifdef OSRA_LIB
-  Blob blob(image_data, image_length);
-#endif
+// Errors of the recognition itself go here, to where stderr used to write before close_stderr():
+static FILE *error_output = NULL;
 
-  try
-    {
-      Image image_typer;
-#ifdef OSRA_LIB
-      image_typer.ping(blob);
-#else
-      image_typer.ping(input_file);
-#endif
-      type = image_typer.magick();
-    }
-  catch (...)
-    {
-      // Unfortunately, GraphicsMagick does not throw exceptions in all cases, so it behaves inconsistent, see
-      // https://sourceforge.net/tracker/?func=detail&aid=3022955&group_id=40728&atid=428740
-    }
+// Function: close_stderr()
+//
+// Closes stderr stream once per process, keeping a copy of it for the errors of the recognition.
+void close_stderr()
+{
+  static bool stderr_closed = false;
+
+  #pragma omp critical (close_stderr)
+  {
+    if (!stderr_closed)
+      {
+        int error_fd = dup(fileno(stderr));
+        if (error_fd >= 0)
+          error_output = fdopen(error_fd, "w");
+        fclose(stderr);
+        stderr_closed = true;
+      }
+  }
+}
+
+// Function: process_image()
+//
+// Recognizes the structures in the image given either in memory (image_data is not NULL) or as a file name.
+// Only the image itself is processed here, the rest comes with the context.
+int process_image(const osra_context_t *context, const char *image_data, int image_length, const std::string &input_file,
+                  std::ostream &out_stream, const osra_options_t &options)
+{
+  int rotate = options.rotate;
+  bool invert = options.invert;
+  int input_resolution = options.input_resolution;
+  double threshold = options.threshold;
+  int do_unpaper = options.do_unpaper;
+  bool jaggy = options.jaggy;
+  bool adaptive_option = options.adaptive;
+  std::string output_format = options.output_format;
+  std::string embedded_format = options.embedded_format;
+  bool show_confidence = options.show_confidence;
+  bool show_resolution_guess = options.show_resolution_guess;
+  bool show_page = options.show_page;
+  bool show_coordinates = options.show_coordinates;
+  bool show_avg_bond_length = options.show_avg_bond_length;
+  bool show_learning = options.show_learning;
+  bool debug = options.debug;
+  bool verbose = options.verbose;
+  const std::string &output_image_file_prefix = options.output_image_file_prefix;
+  const std::string &resize = options.resize;
+  const std::string &preview = options.preview;
+  int num_threads = options.num_threads;
+  double early_exit_confidence = options.early_exit_confidence;
+  bool stream_pages = options.stream_pages;
+
+  std::transform(output_format.begin(), output_format.end(), output_format.begin(), ::tolower);
+  std::transform(embedded_format.begin(), embedded_format.end(), embedded_format.begin(), ::tolower);
+
+  const std::map<std::string, std::string> &spelling = context->spelling;
+  const std::map<std::string, std::string> &superatom = context->superatom;
+
+  // The image in memory is read in place:
+  int frame_count = 0;
+  std::string type = ping_image(image_data, image_length, input_file, frame_count);
 
   //int stderr_copy = dup(2);
   //fclose(stderr);
@@ -636,11 +1147,7 @@ int osra_process_image(
   poppler::document* poppler_doc = NULL;
   if (type.empty() || type == "PDF" || type == "PS")
     {
-#ifdef OSRA_LIB
-      poppler_doc = poppler::document::load_from_raw_data(image_data, image_length);
-#else
-      poppler_doc = poppler::document::load_from_file(input_file);
-#endif
+      poppler_doc = load_pdf_document(image_data, image_length, input_file);
     }
   if (poppler_doc)
     {
@@ -653,42 +1160,25 @@ int osra_process_image(
     }
   else if (!type.empty() && type != "PDF")
     {
-#ifdef OSRA_LIB
-      page = count_pages(blob);
-#else
-      page = count_pages(input_file);
-#endif
+      page = frame_count;
+      if (page == 0)
+        type.clear();
     }
   // dup2(stderr_copy, 2);
   //close(stderr_copy);
 
   if (type.empty())
     {
-#ifdef OSRA_LIB
-      std::cerr << "Cannot detect blob image type" << std::endl;
-#else
-      std::cerr << "Cannot open file \"" << input_file << '"' << std::endl;
-#endif
+      if (image_data != NULL)
+        std::cerr << "Cannot detect blob image type" << std::endl;
+      else
+        std::cerr << "Cannot open file \"" << input_file << '"' << std::endl;
       return ERROR_UNKNOWN_IMAGE_TYPE;
     }
 
   if (verbose)
     std::cout << "Image type: " << type << '.' << std::endl;
 
-#ifndef OSRA_LIB
-  std::ofstream outfile;
-
-  if (!output_file.empty())
-    {
-      outfile.open(output_file.c_str(), std::ios::out | std::ios::trunc);
-      if (outfile.bad() || !outfile.is_open())
-        {
-          std::cerr << "Cannot open file \"" << output_file << "\" for output" << std::endl;
-          return ERROR_OUTPUT_FILE_OPEN_FAILED;
-        }
-    }
-#endif
-
 
   if (show_coordinates && rotate != 0)
     {
@@ -708,7 +1198,7 @@ int osra_process_image(
     }
 
   // This will hide the output "Warning: non-positive median line gap" from GOCR. Remove after this is fixed:
-  fclose(stderr);
+  close_stderr();
   OpenBabel::obErrorLog.StopLogging();
 
   bool is_reaction = false;
@@ -716,11 +1206,7 @@ int osra_process_image(
     is_reaction = true;
 
 
-  std::vector<std::vector<std::string> > pages_of_structures(page, std::vector<std::string> (0));
-  std::vector<std::vector<Image> > pages_of_images(page, std::vector<Image> (0));
-  std::vector<std::vector<double> > pages_of_avg_bonds(page, std::vector<double> (0));
-  std::vector<std::vector<double> > pages_of_ind_conf(page, std::vector<double> (0));
-  std::vector<std::vector<box_t> > pages_of_boxes(page, std::vector<box_t> (0));
+  std::vector<page_result_t> page_results(page);
   std::vector<std::vector<arrow_t> > arrows(page, std::vector<arrow_t>(0));
   std::vector<std::vector<plus_t> > pluses(page, std::vector<plus_t>(0));
 
@@ -730,8 +1216,22 @@ int osra_process_image(
     num_resolutions = 1;
   std::vector<double> array_of_confidence(num_resolutions, 0);
   std::vector<int> boxes_per_res(num_resolutions,0);
+  // Per-page accumulators are summed up in page order after all pages are done, so that the
+  // resolution choice does not depend on the order in which the threads have finished:
+  std::vector<std::vector<double> > array_of_confidence_page(page, std::vector<double>(num_resolutions, 0));
+  std::vector<std::vector<int> > boxes_per_res_page(page, std::vector<int>(num_resolutions, 0));
   std::vector<int> select_resolution(num_resolutions, input_resolution);
   set_select_resolution(select_resolution,input_resolution);
+  // The order in which the resolution passes are tried for a box. When the remaining passes can be skipped after a
+  // confident result, 300 dpi passes come first as the most of the input is expected to be at that resolution.
+  std::vector<int> pass_order;
+  if (early_exit_confidence > 0)
+    for (int res_iter = 0; res_iter < num_resolutions; res_iter++)
+      if (select_resolution[res_iter] == 300)
+        pass_order.push_back(res_iter);
+  for (int res_iter = 0; res_iter < num_resolutions; res_iter++)
+    if (early_exit_confidence <= 0 || select_resolution[res_iter] != 300)
+      pass_order.push_back(res_iter);
   std::vector<std::vector<std::vector<std::string> > > array_of_structures_page(
       page, std::vector<std::vector<std::string> >(num_resolutions));
   std::vector<std::vector<std::vector<double> > > array_of_avg_bonds_page(
@@ -742,13 +1242,84 @@ int osra_process_image(
       page, std::vector<std::vector<Image> > (num_resolutions));
   std::vector<std::vector<std::vector<box_t> > > array_of_boxes_page(
       page, std::vector<std::vector<box_t> >(num_resolutions));
+  std::vector<std::vector<std::vector<molecule_ptr_t> > > array_of_molecules_page(
+      page, std::vector<std::vector<molecule_ptr_t> >(num_resolutions));
+
+#ifdef _OPENMP
+  if (num_threads <= 0)
+    num_threads = omp_get_max_threads();
+#else
+  num_threads = 1;
+#endif
+  if (num_threads < 1)
+    num_threads = 1;
+  // With several pages the threads are spread over pages, otherwise over the boxes within the page
+  // (nested regions run single-threaded):
+  int page_threads = std::min(num_threads, page);
+
+  // Poppler documents can't be rendered concurrently, so the other threads load their own copies of the document:
+  std::vector<poppler::document*> thread_poppler_docs(page_threads, (poppler::document*) NULL);
+  if (poppler_doc)
+    thread_poppler_docs[0] = poppler_doc;
+
+  // A scanned PDF page is rendered at the resolution of the scan, unless the resolution is given. The images of every
+  // page are found in its resources; if the page tree read does not match the pages poppler sees, nothing is detected:
+  std::vector<std::set<std::pair<int, int> > > pdf_image_sizes;
+  if (poppler_doc && input_resolution == 0
+      && (!find_pdf_page_image_sizes(image_data, image_length, input_file, pdf_image_sizes)
+          || (int) pdf_image_sizes.size() != page))
+    pdf_image_sizes.clear();
+
+  // The frames of other multi-page images are decoded a chunk at a time, as the pages are taken by the threads.
+  // The pages that cannot be decoded are processed as blank ones, and are reported with the error in the end:
+  frame_reader_t frame_reader(image_data, image_length, input_file, page_threads);
+  std::vector<char> page_failed(page, 0);
+
+  double best_bond = 0;
+
+  //if (total_structure_count >= STRUCTURE_COUNT)
+  //  find_limits_on_avg_bond(best_bond, pages_of_avg_bonds, pages_of_ind_conf);
+
+  // If multiple pages are processed at several  resolutions different pages
+  // may be processed at different resolutions leading to a seemingly different average bond length
+  // Currently multi-page documents (PDF and PS) are all processed at the same resolution
+  // and single-page images have all structures on the page at the same resolution
+  // (unless the pages are streamed, then every page gets the resolution that suits it best)
 
-//#pragma omp parallel for default(shared) private(OCR_JOB,JOB)
-  for (int l = 0; l < page; l++)
+  //cout << min_bond << " " << max_bond << endl;
+
+  // For Andriod version we will find the structure with maximum confidence value, as the common usecase for Andriod is to analyse the
+  // image (taken by embedded photo camera) that usually contains just one molecule:
+  double max_confidence = -FLT_MAX;
+  osra_structure_t best_structure;
+  Image best_image;
+  int image_count = 0;
+
+  // With streaming the pages are written out in the page order as soon as they and all preceding pages are done.
+  // The pages are then handed to the threads in windows of a few pages per thread, each window started when
+  // the previous one is over, so that a slow page holds back at most a window of finished pages:
+  std::vector<char> page_done(page, 0);
+  int next_output_page = 0;
+  int pages_per_window = page;
+  if (stream_pages)
+    pages_per_window = 4 * page_threads;
+
+  for (int first_page = 0; first_page < page; first_page += pages_per_window)
+  {
+  #pragma omp parallel for num_threads(page_threads) schedule(dynamic) default(shared)
+  for (int l = first_page; l < std::min(first_page + pages_per_window, page); l++)
     {
       Image image;
       double page_scale=1;
+      // Position of the processed image on the page, if only a part of the page is rendered:
+      int page_dx = 0, page_dy = 0;
       poppler::page_renderer poppler_renderer;
+      int thread = 0;
+#ifdef _OPENMP
+      thread = omp_get_thread_num();
+#endif
+      // The seed depends only on the page number, so the background sampling is reproducible:
+      unsigned int seed = l + 1;
 
       int ttt = 0;
 
@@ -764,20 +1335,30 @@ int osra_process_image(
 	  int resolution = input_resolution;
 	  if (resolution == 0)
 	    resolution = 300;
-	  image = process_pdf_page(poppler_doc, poppler_renderer, l, resolution);
+	  // Reactions need the whole page to find the arrows and the preview shows the whole page:
+	  bool use_region = options.pdf_region && !is_reaction && !(l == 0 && !preview.empty());
+	  if (thread_poppler_docs[thread] == NULL)
+	    thread_poppler_docs[thread] = load_pdf_document(image_data, image_length, input_file);
+	  if (thread_poppler_docs[thread] != NULL && thread_poppler_docs[thread] != poppler_doc)
+	    image = process_pdf_page(thread_poppler_docs[thread], poppler_renderer, l, resolution,
+				     pdf_image_sizes.empty() ? NULL : &pdf_image_sizes[l],
+				     use_region, invert, seed, page_dx, page_dy, verbose);
+	  else
+	    {
+	      // The shared document is used by the first thread and by the threads that could not load their own one,
+	      // so every use of it is locked:
+              #pragma omp critical (poppler_shared_document)
+	      {
+		image = process_pdf_page(poppler_doc, poppler_renderer, l, resolution,
+					 pdf_image_sizes.empty() ? NULL : &pdf_image_sizes[l],
+					 use_region, invert, seed, page_dx, page_dy, verbose);
+	      }
+	    }
 	}
       else
 	{
-#ifdef OSRA_LIB
-	  image.read(blob);
-#else
-          std::ostringstream pname;
-	  pname << input_file << "[" << l << "]";
-#pragma omp critical
-	  {
-	    image.read(pname.str());
-	  }
-#endif
+	  if (!read_frame(frame_reader, l, image))
+	    page_failed[l] = 1;
 	}
       if (l == 0 && !preview.empty())
 	{
@@ -790,12 +1371,13 @@ int osra_process_image(
 	}
 
       image.modifyImage();
-      bool adaptive = convert_to_gray(image, invert, adaptive_option, verbose);
+      bool adaptive = convert_to_gray(image, invert, adaptive_option, verbose, seed);
 
       std::vector<std::vector<std::string> > array_of_structures(num_resolutions);
       std::vector<std::vector<double> > array_of_avg_bonds(num_resolutions), array_of_ind_conf(num_resolutions);
       std::vector<std::vector<Image> > array_of_images(num_resolutions);
       std::vector<std::vector<box_t> > array_of_boxes(num_resolutions);
+      std::vector<std::vector<molecule_ptr_t> > array_of_molecules(num_resolutions);
 
       if (input_resolution > 300)
         {
@@ -804,12 +1386,14 @@ int osra_process_image(
           scale << percent << "%";
           image.scale(scale.str());
           page_scale /= (double) percent / 100;
+          page_dx = page_dx * percent / 100;
+          page_dy = page_dy * percent / 100;
         }
 
       if (verbose)
         std::cout << "Input resolutions are " << select_resolution << std::endl;
 
-      ColorGray bgColor = getBgColor(image);
+      ColorGray bgColor = getBgColor(image, seed);
       if (rotate != 0)
         {
           image.backgroundColor(bgColor);
@@ -817,17 +1401,11 @@ int osra_process_image(
         }
 
       double rotation = 0;
-      int unpaper_dx = 0;
-      int unpaper_dy = 0;
-      for (int i = 0; i < do_unpaper; i++)
-        {
-          double radians=0;
-          int dx=0, dy=0;
-          unpaper(image,radians,dx,dy);
-          rotation +=radians;
-          unpaper_dx +=dx;
-          unpaper_dy +=dy;
-        }
+      // The position of the rendered region is accounted for along with the unpaper shift:
+      int unpaper_dx = -page_dx;
+      int unpaper_dy = -page_dy;
+      if (do_unpaper > 0)
+        unpaper(image, do_unpaper, rotation, unpaper_dx, unpaper_dy);
 
       // 0.1 is used for THRESHOLD_BOND here to allow for farther processing.
       std::list<std::list<std::list<point_t> > > clusters = find_segments(image, 0.1, bgColor, adaptive, is_reaction, arrows[l], pluses[l], verbose);
@@ -843,76 +1421,98 @@ int osra_process_image(
       if (verbose)
         std::cout << "Number of boxes: " << boxes.size() << '.' << std::endl;
 
+      // The boxes are cut out of the page before the parallel part, so that worker threads never read the page image:
+      std::vector<Image> box_images(n_boxes);
+      for (int k = 0; k < n_boxes; k++)
+	{
+	  bool fits = false;
+	  for (int res_iter = 0; res_iter < num_resolutions; res_iter++)
+	    if (box_fits_resolution(boxes[k], select_resolution[res_iter]))
+	      fits = true;
+	  if (!fits)
+	    continue;
+
+	  box_images[k] = Image(Geometry(boxes[k].x2 - boxes[k].x1 + 2 * FRAME, boxes[k].y2 - boxes[k].y1 + 2
+					 * FRAME), bgColor);
+	  for (unsigned int p = 0; p < boxes[k].c.size(); p++)
+	    {
+	      int x = boxes[k].c[p].x;
+	      int y = boxes[k].c[p].y;
+	      ColorGray color = image.pixelColor(x, y);
+	      box_images[k].pixelColor(x - boxes[k].x1 + FRAME, y - boxes[k].y1 + FRAME, color);
+	    }
+	}
 
-      for (int res_iter = 0; res_iter < num_resolutions; res_iter++)
-        {
-          int total_boxes = 0;
-          double total_confidence = 0;
+      // Every (box, resolution pass) pair is a separate task. With the early exit a task is a box instead: its passes
+      // run one after another in the pass order, and the ones after the first confident pass are not run at all.
+      std::vector<std::pair<int, int> > tasks;
+      for (int k = 0; k < n_boxes; k++)
+	for (int o = 0; o < num_resolutions; o++)
+	  if (box_fits_resolution(boxes[k], select_resolution[pass_order[o]]))
+	    {
+	      tasks.push_back(std::make_pair(k, o));
+	      if (early_exit_confidence > 0)
+		break;
+	    }
+      std::vector<std::vector<box_result_t> > box_results(num_resolutions, std::vector<box_result_t>(n_boxes));
 
-          int resolution = select_resolution[res_iter];
-          int working_resolution = resolution;
-          if (resolution > 300)
-            working_resolution = 300;
-
-          double THRESHOLD_BOND = set_threshold(threshold,resolution);
-
-          int max_font_height = MAX_FONT_HEIGHT * working_resolution / 150;
-          int max_font_width = MAX_FONT_WIDTH * working_resolution / 150;
-          bool thick = true;
-          if (resolution < 150)
-            thick = false;
-          else if (resolution == 150 && !jaggy)
-            thick = false;
-
-          //Image dbg = image;
-          //dbg.modifyImage();
-          //dbg.backgroundColor("white");
-          //dbg.erase();
-          //dbg.type(TrueColorType);
-          for (int k = 0; k < n_boxes; k++)
-            if ((boxes[k].x2 - boxes[k].x1) > max_font_width && (boxes[k].y2 - boxes[k].y1) > max_font_height
-                && !boxes[k].c.empty() && ((boxes[k].x2 - boxes[k].x1) > 2 * max_font_width || (boxes[k].y2
-                                           - boxes[k].y1) > 2 * max_font_height))
+      #pragma omp parallel for num_threads(num_threads) schedule(dynamic) default(shared)
+      for (int t = 0; t < (int) tasks.size(); t++)
+        for (int o = tasks[t].second; o < (early_exit_confidence > 0 ? num_resolutions : tasks[t].second + 1); o++)
               {
+                int k = tasks[t].first;
+                int res_iter = pass_order[o];
+
+                if (!box_fits_resolution(boxes[k], select_resolution[res_iter]))
+                  continue;
+
+                int resolution = select_resolution[res_iter];
+                int working_resolution = resolution;
+                if (resolution > 300)
+                  working_resolution = 300;
+
+                double THRESHOLD_BOND = set_threshold(threshold,resolution);
+
+                int max_font_height = MAX_FONT_HEIGHT * working_resolution / 150;
+                int max_font_width = MAX_FONT_WIDTH * working_resolution / 150;
+                bool thick = true;
+                if (resolution < 150)
+                  thick = false;
+                else if (resolution == 150 && !jaggy)
+                  thick = false;
+
                 int n_atom = 0, n_bond = 0, n_letters = 0, n_label = 0;
                 std::vector<atom_t> atom;
                 std::vector<bond_t> bond;
                 std::vector<letters_t> letters;
                 std::vector<label_t> label;
                 double box_scale = 1;
-                Image orig_box(Geometry(boxes[k].x2 - boxes[k].x1 + 2 * FRAME, boxes[k].y2 - boxes[k].y1 + 2
-                                        * FRAME), bgColor);
-
-                for (unsigned int p = 0; p < boxes[k].c.size(); p++)
-                  {
-                    int x = boxes[k].c[p].x;
-                    int y = boxes[k].c[p].y;
-                    ColorGray color = image.pixelColor(x, y);
-                    //dbg.pixelColor(x, y, color);
-                    orig_box.pixelColor(x - boxes[k].x1 + FRAME, y - boxes[k].y1 + FRAME, color);
-                  }
+                Image orig_box = box_images[k];
 
 
                 int width = orig_box.columns();
                 int height = orig_box.rows();
                 Image thick_box;
-                create_thick_box(orig_box,thick_box,width,height,resolution,working_resolution,box_scale,bgColor,THRESHOLD_BOND,res_iter,thick,jaggy);
+                // The boxes are binarized once here and all the pixel tests below go to the bitmaps:
+                bitmap_t orig_bitmap, thick_bitmap;
+                create_thick_box(orig_box,thick_box,orig_bitmap,thick_bitmap,width,height,resolution,working_resolution,box_scale,
+                                 bgColor,THRESHOLD_BOND,res_iter,thick,jaggy);
 
                 if (verbose)
                   std::cout << "Analysing box " << boxes[k].x1 << "x" << boxes[k].y1 << "-" << boxes[k].x2 << "x" << boxes[k].y2 << " using working resolution " << working_resolution << '.' << std::endl;
 
-                Image box;
+                bitmap_t box;
                 if (thick)
-                  box = thin_image(thick_box, THRESHOLD_BOND, bgColor);
+                  box = thin_image(thick_bitmap);
                 else
-                  box = thick_box;
-                potrace_state_t * const  st = raster_to_vector(box,bgColor,THRESHOLD_BOND,width,height,working_resolution);
+                  box = thick_bitmap;
+                potrace_state_t * const  st = raster_to_vector(box,width,height,working_resolution);
                 potrace_path_t const * const p = st->plist;
                 n_atom = find_atoms(p, atom, bond, &n_bond,width,height);
 
                 int real_font_width, real_font_height;
-                n_letters = find_chars(p, orig_box, letters, atom, bond, n_atom, n_bond, height, width, bgColor,
-                                       THRESHOLD_BOND, max_font_width, max_font_height, real_font_width, real_font_height,verbose);
+                n_letters = find_chars(p, orig_bitmap, letters, atom, bond, n_atom, n_bond, height, width,
+                                       max_font_width, max_font_height, real_font_width, real_font_height,verbose);
                 if (verbose)
                   std::cout << "Number of atoms: " << n_atom << ", bonds: " << n_bond << ", " << n_letters << " letters: " << n_letters << " " << letters << " after find_atoms()" << std::endl;
 
@@ -921,7 +1521,7 @@ int osra_process_image(
                 double max_area = avg_bond_length * 5;
                 if (thick)
                   max_area = avg_bond_length;
-                n_letters = find_plus_minus(p, orig_box, bgColor, THRESHOLD_BOND, letters, atom, bond, n_atom, n_bond, height, width,
+                n_letters = find_plus_minus(p, orig_bitmap, letters, atom, bond, n_atom, n_bond, height, width,
                                             real_font_height, real_font_width, n_letters, avg_bond_length);
                 n_atom = find_small_bonds(p, atom, bond, n_atom, &n_bond, max_area, avg_bond_length / 2, 5);
 
@@ -936,7 +1536,7 @@ int osra_process_image(
                 if (working_resolution < 150)
                   dist = 2;
 
-                double thickness = skeletize(atom, bond, n_bond, box, THRESHOLD_BOND, bgColor, dist, avg_bond_length);
+                double thickness = skeletize(atom, bond, n_bond, box, dist, avg_bond_length);
                 remove_disconnected_atoms(atom, bond, n_atom, n_bond);
                 collapse_atoms(atom, bond, n_atom, n_bond, 3);
                 remove_zero_bonds(bond, n_bond, atom);
@@ -944,10 +1544,10 @@ int osra_process_image(
 		n_bond = find_wavy_bonds(bond,n_bond,atom,avg_bond_length);
 		//				if (ttt++ == 0)  debug_image(orig_box, atom, n_atom, bond, n_bond, "tmp.png");
                 n_letters = find_fused_chars(bond, n_bond, atom, letters, n_letters, real_font_height,
-                                             real_font_width, 0, orig_box, bgColor, THRESHOLD_BOND, 3, verbose);
+                                             real_font_width, 0, orig_bitmap, 3, verbose);
 
                 n_letters = find_fused_chars(bond, n_bond, atom, letters, n_letters, real_font_height,
-                                             real_font_width, '*', orig_box, bgColor, THRESHOLD_BOND, 5, verbose);
+                                             real_font_width, '*', orig_bitmap, 5, verbose);
 
                 flatten_bonds(bond, n_bond, atom, 3);
                 remove_zero_bonds(bond, n_bond, atom);
@@ -959,13 +1559,12 @@ int osra_process_image(
                 double max_dist_double_bond = dist_double_bonds(atom, bond, n_bond, avg_bond_length);
                 n_bond = double_triple_bonds(atom, bond, n_bond, avg_bond_length, n_atom, max_dist_double_bond);
                 n_atom = find_dashed_bonds(p, atom, bond, n_atom, &n_bond, std::max(MAX_DASH, int(avg_bond_length / 3)),
-                                           avg_bond_length, orig_box, bgColor, THRESHOLD_BOND, thick, avg_bond_length, letters);
+                                           avg_bond_length, orig_bitmap, thick, avg_bond_length, letters);
 
                 n_letters = remove_small_bonds(bond, n_bond, atom, letters, n_letters, real_font_height,
                                                MIN_FONT_HEIGHT, avg_bond_length);
 
-		n_letters = find_numbers(p, orig_box, letters, atom, bond, n_atom, n_bond, height, width, bgColor,
-					 THRESHOLD_BOND, n_letters);
+		n_letters = find_numbers(p, orig_bitmap, letters, atom, bond, n_atom, n_bond, height, width, n_letters);
 
                 dist = 4.;
                 if (working_resolution < 300)
@@ -978,7 +1577,7 @@ int osra_process_image(
                 n_letters = clean_unrecognized_characters(bond, n_bond, atom, real_font_height, real_font_width, 4,
 		          letters, n_letters);
 
-                thickness = find_wedge_bonds(thick_box, atom, n_atom, bond, n_bond, bgColor, THRESHOLD_BOND,
+                thickness = find_wedge_bonds(thick_bitmap, atom, n_atom, bond, n_bond,
                                              max_dist_double_bond, avg_bond_length, 3, 1);
 
                 n_label = assemble_labels(letters, n_letters, label);
@@ -1043,193 +1642,282 @@ int osra_process_image(
                   std::cout << "Final number of atoms: " << real_atoms << ", bonds: " << real_bonds << ", chars: " << n_letters << '.' << std::endl;
 
 
+                box_result_t &result = box_results[res_iter][k];
                 split_fragments_and_assemble_structure_record(atom,n_atom,bond,n_bond,boxes,
-							      l,k,resolution,res_iter,output_image_file_prefix,image,orig_box,real_font_width,real_font_height,
+							      l,k,resolution,0,output_image_file_prefix,image,orig_box,real_font_width,real_font_height,
 							      thickness,avg_bond_length,superatom,real_atoms,real_bonds,bond_max_type,
 							      box_scale,page_scale,rotation,unpaper_dx,unpaper_dy,output_format,embedded_format,is_reaction,show_confidence,
-							      show_resolution_guess,show_page,show_coordinates, show_avg_bond_length,array_of_structures,
-							      array_of_avg_bonds,array_of_ind_conf,array_of_images,array_of_boxes,total_boxes,total_confidence,
+							      show_resolution_guess,show_page,show_coordinates, show_avg_bond_length,options.source,result.structures,
+							      result.avg_bonds,result.ind_conf,result.images,result.boxes,result.molecules,result.total_boxes,result.total_confidence,
 							      recognized_chars,show_learning,res_iter,verbose, bracket_boxes);
 
                 if (st != NULL)
                   potrace_state_free(st);
+
+                if (early_exit_confidence > 0 && is_confident_result(result, early_exit_confidence))
+                  break;
               }
-	  array_of_confidence[res_iter] += total_confidence;
-	  boxes_per_res[res_iter] += total_boxes;
-          //dbg.write("debug.png");
+
+      for (int o = 0; o < num_resolutions; o++)
+        {
+          int res_iter = pass_order[o];
+          int total_boxes = 0;
+          double total_confidence = 0;
+
+          for (int k = 0; k < n_boxes; k++)
+            {
+              if (!box_fits_resolution(boxes[k], select_resolution[res_iter]))
+                continue;
+              const box_result_t *box_result = &box_results[res_iter][k];
+              // The passes after the first confident one have not been run, so they take over its result:
+              if (early_exit_confidence > 0)
+                for (int first = 0; first < o; first++)
+                  if (is_confident_result(box_results[pass_order[first]][k], early_exit_confidence))
+                    {
+                      box_result = &box_results[pass_order[first]][k];
+                      break;
+                    }
+              const box_result_t &result = *box_result;
+              array_of_structures[res_iter].insert(array_of_structures[res_iter].end(), result.structures[0].begin(), result.structures[0].end());
+              array_of_avg_bonds[res_iter].insert(array_of_avg_bonds[res_iter].end(), result.avg_bonds[0].begin(), result.avg_bonds[0].end());
+              array_of_ind_conf[res_iter].insert(array_of_ind_conf[res_iter].end(), result.ind_conf[0].begin(), result.ind_conf[0].end());
+              array_of_images[res_iter].insert(array_of_images[res_iter].end(), result.images[0].begin(), result.images[0].end());
+              array_of_boxes[res_iter].insert(array_of_boxes[res_iter].end(), result.boxes[0].begin(), result.boxes[0].end());
+              array_of_molecules[res_iter].insert(array_of_molecules[res_iter].end(), result.molecules[0].begin(), result.molecules[0].end());
+              total_boxes += result.total_boxes;
+              total_confidence += result.total_confidence;
+            }
+
+	  array_of_confidence_page[l][res_iter] += total_confidence;
+	  boxes_per_res_page[l][res_iter] += total_boxes;
         }
 
-      #pragma omp critical
-      {
-         if (show_learning)
-	  for (int j = 0; j < num_resolutions; j++)
-	    for (unsigned int i = 0; i < array_of_structures[j].size(); i++)
+      // Every page writes only into its own slots, so no locking is needed here:
+      page_result_t &page_result = page_results[l];
+      page_result.page = l + 1;
+      page_result.page_scale = page_scale;
+      page_result.unpaper_dx = unpaper_dx;
+      page_result.unpaper_dy = unpaper_dy;
+      if (show_learning)
+	for (int j = 0; j < num_resolutions; j++)
+	  for (unsigned int i = 0; i < array_of_structures[j].size(); i++)
 	    {
-	      pages_of_structures[l].push_back(array_of_structures[j][i]);
+	      page_result.structures.push_back(array_of_structures[j][i]);
 	      if (!output_image_file_prefix.empty())
-		pages_of_images[l].push_back(array_of_images[j][i]);
-	      pages_of_avg_bonds[l].push_back(array_of_avg_bonds[j][i]);
-	      pages_of_ind_conf[l].push_back(array_of_ind_conf[j][i]);
-	      pages_of_boxes[l].push_back(array_of_boxes[j][i]);
-	      total_structure_count++;
+		page_result.images.push_back(array_of_images[j][i]);
+	      page_result.avg_bonds.push_back(array_of_avg_bonds[j][i]);
+	      page_result.ind_conf.push_back(array_of_ind_conf[j][i]);
+	      page_result.boxes.push_back(array_of_boxes[j][i]);
+	      if (is_reaction)
+		page_result.molecules.push_back(array_of_molecules[j][i]);
 	    }
-	 else
-	   for (int j = 0; j < num_resolutions; j++)
-	     {
-                array_of_structures_page[l][j] = array_of_structures[j];
-		if (!output_image_file_prefix.empty())
-		  array_of_images_page[l][j] = array_of_images[j];
-		array_of_avg_bonds_page[l][j] = array_of_avg_bonds[j];
-		array_of_ind_conf_page[l][j] = array_of_ind_conf[j];
-		array_of_boxes_page[l][j] = array_of_boxes[j];
-	      }
+      else if (stream_pages)
+	{
+	  int max_res = select_best_resolution(array_of_confidence_page[l], boxes_per_res_page[l], select_resolution);
+	  select_page_result(page_result, array_of_structures, array_of_images, array_of_avg_bonds, array_of_ind_conf,
+			     array_of_boxes, array_of_molecules, max_res);
+	  if (output_image_file_prefix.empty())
+	    page_result.images.clear();
+	}
+      else
+	for (int j = 0; j < num_resolutions; j++)
+	  {
+	    array_of_structures_page[l][j] = array_of_structures[j];
+	    if (!output_image_file_prefix.empty())
+	      array_of_images_page[l][j] = array_of_images[j];
+	    array_of_avg_bonds_page[l][j] = array_of_avg_bonds[j];
+	    array_of_ind_conf_page[l][j] = array_of_ind_conf[j];
+	    array_of_boxes_page[l][j] = array_of_boxes[j];
+	    array_of_molecules_page[l][j] = array_of_molecules[j];
+	  }
 
-       }
+      if (stream_pages)
+	{
+          #pragma omp critical (page_output)
+	  {
+	    page_done[l] = 1;
+	    for (; next_output_page < page && page_done[next_output_page]; next_output_page++)
+	      {
+		total_structure_count += page_results[next_output_page].structures.size();
+		output_page_structures(out_stream, page_results[next_output_page], arrows[next_output_page],
+				       pluses[next_output_page], output_format, is_reaction, output_image_file_prefix,
+				       resize, best_bond, options, image_count, max_confidence, best_structure, best_image);
+		out_stream.flush();
+		// The page is released once it is written out, so that only the pages of the current window are kept:
+		page_results[next_output_page] = page_result_t();
+		std::vector<arrow_t>().swap(arrows[next_output_page]);
+		std::vector<plus_t>().swap(pluses[next_output_page]);
+	      }
+	  }
+	}
      }
+  }
 
-    double max_conf = -FLT_MAX;
-    int max_res = 0;
-    for (int i = 0; i < num_resolutions; i++)
-        {
-          if (boxes_per_res[i] > 0 && array_of_confidence[i]/boxes_per_res[i] > max_conf)
-            {
-              max_conf = array_of_confidence[i]/boxes_per_res[i];
-              max_res = i;
-            }
-        }
-      for (int i = 0; i < num_resolutions; i++)
-	if (boxes_per_res[i] > 0 && array_of_confidence[i]/boxes_per_res[i] == max_conf && select_resolution[i] == 300) // second 300 dpi is without thinning
+  for (unsigned int i = 0; i < thread_poppler_docs.size(); i++)
+    if (thread_poppler_docs[i] != poppler_doc)
+      delete thread_poppler_docs[i];
+
+  if (!stream_pages)
+    {
+      for (int l = 0; l < page; l++)
+	for (int j = 0; j < num_resolutions; j++)
 	  {
-	    max_res = i;
-	    break;
+	    array_of_confidence[j] += array_of_confidence_page[l][j];
+	    boxes_per_res[j] += boxes_per_res_page[l][j];
 	  }
 
-	if (!show_learning)
-         for (int l = 0; l < page; l++)
+      int max_res = select_best_resolution(array_of_confidence, boxes_per_res, select_resolution);
+
+      for (int l = 0; l < page; l++)
+	{
+	  if (!show_learning)
 	    {
-	      pages_of_structures[l] = array_of_structures_page[l][max_res];
-	      if (!output_image_file_prefix.empty())
-		pages_of_images[l] = array_of_images_page[l][max_res];
-	      pages_of_avg_bonds[l] = array_of_avg_bonds_page[l][max_res];
-	      pages_of_ind_conf[l] = array_of_ind_conf_page[l][max_res];
-	      pages_of_boxes[l] = array_of_boxes_page[l][max_res];
-	      total_structure_count += array_of_structures_page[l][max_res].size();
+	      select_page_result(page_results[l], array_of_structures_page[l], array_of_images_page[l],
+				 array_of_avg_bonds_page[l], array_of_ind_conf_page[l], array_of_boxes_page[l],
+				 array_of_molecules_page[l], max_res);
+	      if (output_image_file_prefix.empty())
+		page_results[l].images.clear();
 	    }
+	  total_structure_count += page_results[l].structures.size();
+	  output_page_structures(out_stream, page_results[l], arrows[l], pluses[l], output_format, is_reaction,
+				 output_image_file_prefix, resize, best_bond, options, image_count, max_confidence, best_structure,
+				 best_image);
+	}
+    }
 
-  double best_bond = 0;
+  // Output the structure with maximum confidence value:
+  if (output_format == "mol" && max_confidence > -FLT_MAX)
+    {
+      write_structure(out_stream, best_structure, options);
+      if (!output_image_file_prefix.empty())
+	write_structure_image(best_image, output_image_file_prefix + ".png", resize);
+    }
 
-  //if (total_structure_count >= STRUCTURE_COUNT)
-  //  find_limits_on_avg_bond(best_bond, pages_of_avg_bonds, pages_of_ind_conf);
+  out_stream.flush();
 
-  // If multiple pages are processed at several  resolutions different pages
-  // may be processed at different resolutions leading to a seemingly different average bond length
-  // Currently multi-page documents (PDF and PS) are all processed at the same resolution
-  // and single-page images have all structures on the page at the same resolution
+  delete poppler_doc;
 
-  //cout << min_bond << " " << max_bond << endl;
+  if (std::find(page_failed.begin(), page_failed.end(), 1) != page_failed.end())
+    {
+      if (error_output != NULL)
+        {
+          #pragma omp critical (close_stderr)
+          {
+            for (int l = 0; l < page; l++)
+              if (page_failed[l])
+                fprintf(error_output, "Cannot decode page %d\n", l + 1);
+            fflush(error_output);
+          }
+        }
+      return ERROR_UNKNOWN_IMAGE_TYPE;
+    }
 
+  return 0;
+}
+
+int osra_process_image(const osra_context_t *context, const char *image_data, int image_length,
+                       std::ostream &structure_output_stream, const osra_options_t &options)
+{
+  return process_image(context, image_data, image_length, "", structure_output_stream, options);
+}
+
+int osra_process_image_file(const osra_context_t *context, const std::string &input_file,
+                            std::ostream &structure_output_stream, const osra_options_t &options)
+{
+  return process_image(context, NULL, 0, input_file, structure_output_stream, options);
+}
+
+int osra_process_image(
 #ifdef OSRA_LIB
-  std::ostream &out_stream = structure_output_stream;
+  const char *image_data,
+  int image_length,
+  std::ostream &structure_output_stream,
 #else
-  std::ostream &out_stream = outfile.is_open() ? outfile : std::cout;
+  const std::string &input_file,
+  const std::string &output_file,
 #endif
+  int rotate,
+  bool invert,
+  int input_resolution,
+  double threshold,
+  int do_unpaper,
+  bool jaggy,
+  bool adaptive_option,
+  std::string output_format,
+  std::string embedded_format,
+  bool show_confidence,
+  bool show_resolution_guess,
+  bool show_page,
+  bool show_coordinates,
+  bool show_avg_bond_length,
+  bool show_learning,
+  const std::string &osra_dir,
+  const std::string &spelling_file,
+  const std::string &superatom_file,
+  bool debug,
+  bool verbose,
+  const std::string &output_image_file_prefix,
+  const std::string &resize,
+  const std::string &preview,
+  int num_threads,
+  double early_exit_confidence,
+  bool stream_pages,
+  bool pdf_region
+)
+{
+  osra_options_t options;
+  options.rotate = rotate;
+  options.invert = invert;
+  options.input_resolution = input_resolution;
+  options.threshold = threshold;
+  options.do_unpaper = do_unpaper;
+  options.jaggy = jaggy;
+  options.adaptive = adaptive_option;
+  options.output_format = output_format;
+  options.embedded_format = embedded_format;
+  options.show_confidence = show_confidence;
+  options.show_resolution_guess = show_resolution_guess;
+  options.show_page = show_page;
+  options.show_coordinates = show_coordinates;
+  options.show_avg_bond_length = show_avg_bond_length;
+  options.show_learning = show_learning;
+  options.debug = debug;
+  options.verbose = verbose;
+  options.output_image_file_prefix = output_image_file_prefix;
+  options.resize = resize;
+  options.preview = preview;
+  options.num_threads = num_threads;
+  options.early_exit_confidence = early_exit_confidence;
+  options.stream_pages = stream_pages;
+  options.pdf_region = pdf_region;
+
+  int err;
+  osra_context_t *context = osra_create_context(osra_dir, spelling_file, superatom_file, verbose, &err);
+  if (context == NULL)
+    return err;
 
-  // For Andriod version we will find the structure with maximum confidence value, as the common usecase for Andriod is to analyse the
-  // image (taken by embedded photo camera) that usually contains just one molecule:
-  double max_confidence = -FLT_MAX;
-  int l_index = 0;
-  int i_index = 0;
-  int image_count = 0;
-
-  for (int l = 0; l < page; l++)
-    {
-      for (unsigned int i = 0; i < pages_of_structures[l].size(); i++)
-	if (best_bond == 0 || (pages_of_avg_bonds[l][i] > best_bond/2 && pages_of_avg_bonds[l][i] < 2*best_bond))
-	  {
-	    if (pages_of_ind_conf[l][i] > max_confidence)
-	      {
-		max_confidence = pages_of_ind_conf[l][i];
-		l_index = l;
-		i_index = i;
-	      }
+#ifdef OSRA_LIB
+  err = osra_process_image(context, image_data, image_length, structure_output_stream, options);
+#else
+  std::ofstream outfile;
 
-	    if (output_format != "mol" && !is_reaction)
-	      {
-		out_stream << pages_of_structures[l][i];
-
-		// Dump this structure into a separate file:
-		if (!output_image_file_prefix.empty())
-		  {
-                    std::ostringstream fname;
-		    fname << output_image_file_prefix << image_count << ".png";
-		    image_count++;
-		    if (fname.str() != "")
-		      {
-			Image tmp = pages_of_images[l][i];
-			if (resize != "")
-			  {
-			    tmp.scale(resize);
-			  }
-			tmp.write(fname.str());
-		      }
-		  }
-	      }
-	  }
-      if (is_reaction && !arrows[l].empty())
-	 {
-           std::vector<std::string> reactions;
-           std::vector<box_t> rbox;
-	   arrange_reactions(arrows[l], pages_of_boxes[l], pluses[l], reactions, rbox, pages_of_structures[l],output_format);
-	   for (int k=0; k<reactions.size(); k++)
-	     {
-               out_stream << reactions[k] << std::endl;
-
-	       if (!output_image_file_prefix.empty())
-		 {
-                   std::ostringstream fname;
-		   fname << output_image_file_prefix << image_count << ".png";
-		   image_count++;
-		   if (fname.str() != "")
-		     {
-		       Image tmp = pages_of_images[l][k];
-		       Geometry geometry = Geometry(rbox[k].x2 - rbox[k].x1, rbox[k].y2 - rbox[k].y1, rbox[k].x1, rbox[k].y1);
-		       tmp.crop(geometry);
-		       if (resize != "")
-			 {
-			   tmp.scale(resize);
-			 }
-		       tmp.write(fname.str());
-		     }
-		 }
-	     }
-	 }
-    }
-  // Output the structure with maximum confidence value:
-  if (output_format == "mol")
+  if (!output_file.empty())
     {
-      out_stream << pages_of_structures[l_index][i_index];
-      if (!output_image_file_prefix.empty())
-	{
-          std::ostringstream fname;
-	  fname << output_image_file_prefix  << ".png";
-	  if (fname.str() != "")
-	    {
-	      Image tmp = pages_of_images[l_index][i_index];
-	      if (resize != "")
-		{
-		  tmp.scale(resize);
-		}
-	      tmp.write(fname.str());
-	    }
-	}
+      outfile.open(output_file.c_str(), std::ios::out | std::ios::trunc);
+      if (outfile.bad() || !outfile.is_open())
+        {
+          std::cerr << "Cannot open file \"" << output_file << "\" for output" << std::endl;
+          osra_destroy_context(context);
+          return ERROR_OUTPUT_FILE_OPEN_FAILED;
+        }
     }
 
-  out_stream.flush();
+  err = osra_process_image_file(context, input_file, outfile.is_open() ? outfile : std::cout, options);
 
-#ifndef OSRA_LIB
   if (!output_file.empty())
     outfile.close();
 #endif
 
-  return 0;
+  osra_destroy_context(context);
+  return err;
 }
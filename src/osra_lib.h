@@ -25,14 +25,159 @@
 #include <string> // std::string
 #include <ostream> // std:ostream
 
+//
+// Section: Types
+//
+
+// struct: osra_structure_s
+//      A recognized structure (or reaction) as it is passed to <osra_structure_callback_t>
+struct osra_structure_s
+{
+  // the record, exactly as it would be written to the output stream
+  std::string record;
+  // page number, starting from 1
+  int page;
+  // the box on the page, in pixels of the input image
+  int x1, y1, x2, y2;
+  // 0 for reactions
+  double confidence;
+  // in pixels of the input image, 0 for reactions
+  double avg_bond_length;
+
+  osra_structure_s() : page(0), x1(0), y1(0), x2(0), y2(0), confidence(0), avg_bond_length(0)
+  {
+  }
+};
+// Typedef: osra_structure_t
+//      defines osra_structure_t type based on osra_structure_s struct
+typedef struct osra_structure_s osra_structure_t;
+
+// Typedef: osra_structure_callback_t
+//      receives the structures one by one, in the output order. The calls never overlap, but may come from
+//      different threads.
+typedef void (*osra_structure_callback_t)(const osra_structure_t &structure, void *user_data);
+
+// struct: osra_options_s
+//      Recognition and output options, see <osra_process_image()> for their meaning
+struct osra_options_s
+{
+  int rotate;
+  bool invert;
+  int input_resolution;
+  double threshold;
+  int do_unpaper;
+  bool jaggy;
+  bool adaptive;
+  std::string output_format;
+  std::string embedded_format;
+  bool show_confidence;
+  bool show_resolution_guess;
+  bool show_page;
+  bool show_coordinates;
+  bool show_avg_bond_length;
+  bool show_learning;
+  bool debug;
+  bool verbose;
+  std::string output_image_file_prefix;
+  std::string resize;
+  std::string preview;
+  int num_threads;
+  double early_exit_confidence;
+  bool stream_pages;
+  // experimental: render only the part of PDF pages holding the structures; off by default, as neither the recall
+  // nor the speed of it has been measured
+  bool pdf_region;
+  // if not empty, added to every structure as the name of the input it comes from (percent-encoded in SMILES
+  // output, where whitespace would split the field)
+  std::string source;
+  // if set, the structures are passed to the callback (together with "structure_callback_data") as soon as
+  // they are written out, instead of being written to the output stream
+  osra_structure_callback_t structure_callback;
+  void *structure_callback_data;
+
+  osra_options_s() : rotate(0), invert(false), input_resolution(0), threshold(0), do_unpaper(0), jaggy(false), adaptive(false),
+    output_format("smi"), show_confidence(false), show_resolution_guess(false), show_page(false), show_coordinates(false),
+    show_avg_bond_length(false), show_learning(false), debug(false), verbose(false), num_threads(0), early_exit_confidence(0),
+    stream_pages(false), pdf_region(false), structure_callback(NULL), structure_callback_data(NULL)
+  {
+  }
+};
+// Typedef: osra_options_t
+//      defines osra_options_t type based on osra_options_s struct
+typedef struct osra_options_s osra_options_t;
+
+// struct: osra_context_s
+//      Opaque recognition context, that keeps the parsed spelling and superatom dictionaries between the calls.
+//      It holds nothing else: the OCR engines (one per thread), the OpenBabel conversions and the compiled
+//      superatoms are shared by the whole process, and the options are passed with every call.
+struct osra_context_s;
+// Typedef: osra_context_t
+//      defines osra_context_t type based on osra_context_s struct
+typedef struct osra_context_s osra_context_t;
+
 //
 // Section: Functions
 //
 
+// Function: osra_create_context()
+//
+// Creates the recognition context, that can be reused by any number of (concurrent) recognitions.
+// Contexts only differ in their dictionaries; they are not isolated from each other otherwise, see <osra_context_s>.
+//
+// Parameters:
+//      osra_dir - the directory to look for the dictionaries in, if they are not found in the data directory
+//      spelling_file, superatom_file - custom dictionary files (optional)
+//      verbose - print debug information
+//      error - if not NULL, receives 0 or the error code
+//
+// Returns:
+//      the context (to be released with <osra_destroy_context()>) or NULL if the dictionaries cannot be loaded
+osra_context_t *osra_create_context(const std::string &osra_dir = "", const std::string &spelling_file = "",
+                                    const std::string &superatom_file = "", bool verbose = false, int *error = NULL);
+
+// Function: osra_destroy_context()
+//
+// Releases the recognition context.
+void osra_destroy_context(osra_context_t *context);
+
+// Function: osra_process_image()
+//
+// Recognizes the structures in the image in memory using the given context.
+//
+// Parameters:
+//      context - the context created by <osra_create_context()>
+//      image_data, image_length - the binary image
+//      structure_output_stream - stream to write the structures to
+//      options - recognition and output options
+//
+// Returns:
+//      0, if processing was completed successfully. If some pages of a multi-page image cannot be decoded,
+//      the structures of the other pages are still written out and ERROR_UNKNOWN_IMAGE_TYPE is returned.
+int osra_process_image(const osra_context_t *context, const char *image_data, int image_length,
+                       std::ostream &structure_output_stream, const osra_options_t &options);
+
+// Function: osra_process_image_file()
+//
+// Recognizes the structures in the image file using the given context, see <osra_process_image()>.
+int osra_process_image_file(const osra_context_t *context, const std::string &input_file,
+                            std::ostream &structure_output_stream, const osra_options_t &options);
+
+
 // Function: osra_process_image()
 //
+// Recognizes the structures in a single image. The dictionaries are loaded for this call only, use
+// <osra_create_context()> to keep them between the calls.
+//
 // Parameters:
 //      image_data - the binary image
+//      num_threads - number of threads processing pages and boxes in parallel, 0 means as many as there are available cores
+//      early_exit_confidence - if positive, the remaining resolution passes for a box are skipped once a pass
+//                              yields structures with at least this confidence
+//      stream_pages - write out the structures of every page as soon as the page is done, choosing the resolution
+//                     for each page separately, instead of buffering the whole document
+//      pdf_region - render only the part of a PDF page that holds the structures, as located on a low resolution
+//                   render of the page (the whole page is rendered if nothing is found there); experimental,
+//                   the recall and the speed of it have not been measured
 //
 // Returns:
 //      0, if processing was completed successfully
@@ -67,5 +212,9 @@ int osra_process_image(
   bool verbose = false,
   const std::string &output_image_file_prefix = "",
   const std::string &resize = "",
-  const std::string &preview = ""
+  const std::string &preview = "",
+  int num_threads = 0,
+  double early_exit_confidence = 0,
+  bool stream_pages = false,
+  bool pdf_region = false
 );
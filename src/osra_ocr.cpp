@@ -95,30 +95,61 @@ void osra_ocr_destroy()
 // Function: osra_gocr_ocr()
 //      Make an attempt to OCR the image box with GOCR engine.
 //
+//      GOCR keeps the job being processed in JOB/OCR_JOB globals and is not reentrant, so all recognitions
+//      share one job slot, guarded by "gocr" lock. The lock covers only GOCR itself, other engines run in
+//      parallel with it.
+//
 // Parameters:
-//      job_t - includes pixel map and character filter
+//      pixmap - pixel map (0 means pixel, 255 means empty), is not freed by this function
+//      width, height - dimensions of the pixel map
+//      char_filter - character filter, empty string means no filtering
 //
 // Returns:
-//      0 in case the recognition failed or valid alphanumeric character
-char osra_gocr_ocr(job_t &gocr_job)
+//      the first recognized text line or empty string in case the recognition failed
+const std::string osra_gocr_ocr(unsigned char *pixmap, int width, int height, const std::string &char_filter)
 {
-  OCR_JOB = &gocr_job;
-  JOB = &gocr_job;
-// cout<<"Before gocr"<<endl;
-  try
-    {
-      pgm2asc(&gocr_job);
-    }
-  catch (...)
-    {
-    }
-//cout<<"After gocr"<<endl;
-  char *l = (char *) gocr_job.res.linelist.start.next->data;
+  std::string line;
 
-  if (l != NULL && strlen(l) == 1 && isalnum(l[0]))
-    return l[0];
+  #pragma omp critical (gocr)
+  {
+    job_t gocr_job;
+    JOB = &gocr_job;
+    OCR_JOB = &gocr_job;
+    job_init(&gocr_job);
+    job_init_image(&gocr_job);
 
-  return UNKNOWN_CHAR;
+    //gocr_job.cfg.cs = 160;
+    //gocr_job.cfg.certainty = 80;
+    //gocr_job.cfg.dust_size = 1;
+    gocr_job.src.p.x = width;
+    gocr_job.src.p.y = height;
+    gocr_job.src.p.bpp = 1;
+    gocr_job.src.p.p = pixmap;
+    if (char_filter.empty())
+      gocr_job.cfg.cfilter = (char*) NULL;
+    else
+      gocr_job.cfg.cfilter = (char*) char_filter.c_str();
+
+    try
+      {
+        pgm2asc(&gocr_job);
+      }
+    catch (...)
+      {
+      }
+
+    char *l = (char *) gocr_job.res.linelist.start.next->data;
+    if (l != NULL)
+      line = l;
+
+    // The pixel map belongs to the caller, so it should not be freed together with the job:
+    gocr_job.src.p.p = NULL;
+    job_free_image(&gocr_job);
+    OCR_JOB = NULL;
+    JOB = NULL;
+  }
+
+  return line;
 }
 
 // Function: osra_ocrad_ocr()
@@ -135,19 +166,23 @@ char osra_ocrad_ocr(const OCRAD_Pixmap * const ocrad_pixmap, const std::string &
   char result = 0;
   std::string line;
 
-  OCRAD_Descriptor * const ocrad_res = OCRAD_open();
+  // OCRAD library is not known to be reentrant, so only one image is recognized at a time:
+  #pragma omp critical (ocrad)
+  {
+    OCRAD_Descriptor * const ocrad_res = OCRAD_open();
 
-  // If the box height is less than 10px, it should be scaled up a bit, otherwise OCRAD is unable to catch it:
-  if (ocrad_res && OCRAD_get_errno(ocrad_res) == OCRAD_ok && OCRAD_set_image(ocrad_res, ocrad_pixmap, 0) == 0
-      && (ocrad_pixmap->height >= 10 || OCRAD_scale(ocrad_res, 2) == 0) && OCRAD_recognize(ocrad_res, 0) == 0)
-    {
-      result = OCRAD_result_first_character(ocrad_res);
-      if (OCRAD_result_blocks(ocrad_res) >= 1 && OCRAD_result_lines(ocrad_res, 0) && OCRAD_result_line(
-            ocrad_res, 0, 0) != 0)
-        line = OCRAD_result_line(ocrad_res, 0, 0);
-    }
+    // If the box height is less than 10px, it should be scaled up a bit, otherwise OCRAD is unable to catch it:
+    if (ocrad_res && OCRAD_get_errno(ocrad_res) == OCRAD_ok && OCRAD_set_image(ocrad_res, ocrad_pixmap, 0) == 0
+        && (ocrad_pixmap->height >= 10 || OCRAD_scale(ocrad_res, 2) == 0) && OCRAD_recognize(ocrad_res, 0) == 0)
+      {
+        result = OCRAD_result_first_character(ocrad_res);
+        if (OCRAD_result_blocks(ocrad_res) >= 1 && OCRAD_result_lines(ocrad_res, 0) && OCRAD_result_line(
+              ocrad_res, 0, 0) != 0)
+          line = OCRAD_result_line(ocrad_res, 0, 0);
+      }
 
-  OCRAD_close(ocrad_res);
+    OCRAD_close(ocrad_res);
+  }
 
   // TODO: Why line should have 0 or 1 characters? Give examples...
   if (line.length() > 2 || !isalnum(result) || (!char_filter.empty() && char_filter.find(result, 0) == std::string::npos))
@@ -178,20 +213,25 @@ char osra_cuneiform_ocr(Magick::Image &cuneiform_img, const std::string &char_fi
   char str[256];
   memset(str, 0, sizeof(str));
 
-  if (!PUMA_XOpen(dib, NULL) || !PUMA_XFinalRecognition() || !PUMA_SaveToMemory(NULL, PUMA_TOTEXT, PUMA_CODE_ASCII, str, sizeof(str) - 1))
+  bool recognized;
+
+  // Cuneiform keeps the recognition state in PUMA globals, so only one image can be processed at a time:
+  #pragma omp critical (cuneiform)
+  {
+    recognized = PUMA_XOpen(dib, NULL) && PUMA_XFinalRecognition() && PUMA_SaveToMemory(NULL, PUMA_TOTEXT, PUMA_CODE_ASCII, str, sizeof(str) - 1);
+    PUMA_XClose();
+  }
+
+  delete []dib;
+
+  if (!recognized)
     {
       //if (verbose)
       //  cout << "Cuneiform recognition failed." << endl;
 
-      PUMA_XClose();
-      delete []dib;
-
       return UNKNOWN_CHAR;
     }
 
-  PUMA_XClose();
-  delete []dib;
-
   // As we have initialized the image with two identical samples, it is expected that they go in the string
   // one after another, or separated by space (e.g. "ZZ\n" or "Z Z\n").
   if (((str[0] == str[1] && isspace(str[2])) || (str[0] == str[2] && str[1] == ' ')) && isalnum(str[0])
@@ -202,8 +242,8 @@ char osra_cuneiform_ocr(Magick::Image &cuneiform_img, const std::string &char_fi
 }
 #endif
 
-char get_atom_label(const Magick::Image &image, const Magick::ColorGray &bg, int x1, int y1, int x2, int y2,
-                    double THRESHOLD, int dropx, int dropy, bool no_filtering, bool verbose, bool numbers)
+char get_atom_label(const bitmap_t &bitmap, int x1, int y1, int x2, int y2,
+                    int dropx, int dropy, bool no_filtering, bool verbose, bool numbers)
 {
   char c = UNKNOWN_CHAR;
 
@@ -214,7 +254,7 @@ char get_atom_label(const Magick::Image &image, const Magick::ColorGray &bg, int
 
   for (int i = y1; i <= y2; i++)
     for (int j = x1; j <= x2; j++)
-      pixmap[(i - y1) * width + j - x1] = (unsigned char) (255 - 255 * get_pixel(image, bg, j, i, THRESHOLD));
+      pixmap[(i - y1) * width + j - x1] = (unsigned char) (255 - 255 * get_pixel(bitmap, j, i));
 
   // Here we drop down from the top of the box, middle of x coordinate and extract connected component
   int t = 1;
@@ -233,181 +273,186 @@ char get_atom_label(const Magick::Image &image, const Magick::ColorGray &bg, int
       return 0;
     }
 
-  #pragma omp critical
-  {
-    y--;
+  y--;
 
-    pixmap[y * width + x] = 2;
+  pixmap[y * width + x] = 2;
 
-    std::list<int> cx;
-    std::list<int> cy;
+  std::list<int> cx;
+  std::list<int> cy;
 
-    cx.push_back(x);
-    cy.push_back(y);
-
-    while (!cx.empty())
-      {
-        x = cx.front();
-        y = cy.front();
-        cx.pop_front();
-        cy.pop_front();
-        pixmap[y * width + x] = 1;
-
-        // this goes around 3x3 square touching the chosen pixel
-        for (int i = x - 1; i < x + 2; i++)
-          for (int j = y - 1; j < y + 2; j++)
-            if (i < width && j < height && i >= 0 && j >= 0 && pixmap[j * width + i] == 0)
-              {
-                cx.push_back(i);
-                cy.push_back(j);
-                pixmap[j * width + i] = 2;
-              }
-      }
-
-    // Flatten the bitmap. Note: the bitmap is inverted after this cycle (255 means "empty", 0 means "pixel").
-    for (int i = 0; i < height; i++)
-      for (int j = 0; j < width; j++)
-        pixmap[i * width + j] = (pixmap[i * width + j] == 1 ? 0 : 255);
-
-    job_t gocr_job;
+  cx.push_back(x);
+  cy.push_back(y);
 
-    // The list of all characters, that can be recognised as atom label:
-    std::string char_filter = RECOGNIZED_CHARS;
-    if (numbers) char_filter = "1";
-    if (no_filtering) char_filter.clear();
+  while (!cx.empty())
+    {
+      x = cx.front();
+      y = cy.front();
+      cx.pop_front();
+      cy.pop_front();
+      pixmap[y * width + x] = 1;
+
+      // this goes around 3x3 square touching the chosen pixel
+      for (int i = x - 1; i < x + 2; i++)
+        for (int j = y - 1; j < y + 2; j++)
+          if (i < width && j < height && i >= 0 && j >= 0 && pixmap[j * width + i] == 0)
+            {
+              cx.push_back(i);
+              cy.push_back(j);
+              pixmap[j * width + i] = 2;
+            }
+    }
 
-    job_init(&gocr_job);
-    job_init_image(&gocr_job);
+  // Flatten the bitmap. Note: the bitmap is inverted after this cycle (255 means "empty", 0 means "pixel").
+  for (int i = 0; i < height; i++)
+    for (int j = 0; j < width; j++)
+      pixmap[i * width + j] = (pixmap[i * width + j] == 1 ? 0 : 255);
 
-    //gocr_job.cfg.cs = 160;
-    //gocr_job.cfg.certainty = 80;
-    //gocr_job.cfg.dust_size = 1;
-    gocr_job.src.p.x = width;
-    gocr_job.src.p.y = height;
-    gocr_job.src.p.bpp = 1;
-    gocr_job.src.p.p = pixmap;
-    if (char_filter.empty())
-      gocr_job.cfg.cfilter = (char*)NULL;
-    else
-      gocr_job.cfg.cfilter = (char*) char_filter.c_str();
+  // The list of all characters, that can be recognised as atom label:
+  std::string char_filter = RECOGNIZED_CHARS;
+  if (numbers) char_filter = "1";
+  if (no_filtering) char_filter.clear();
 
-    struct OCRAD_Pixmap *ocrad_pixmap = new OCRAD_Pixmap();
-    unsigned char *ocrad_bitmap = (unsigned char *) malloc(width * height);
+  struct OCRAD_Pixmap *ocrad_pixmap = new OCRAD_Pixmap();
+  unsigned char *ocrad_bitmap = (unsigned char *) malloc(width * height);
 
-    memset(ocrad_bitmap, 0, width * height);
+  memset(ocrad_bitmap, 0, width * height);
 
-    ocrad_pixmap->height = height;
-    ocrad_pixmap->width = width;
-    ocrad_pixmap->mode = OCRAD_bitmap;
-    ocrad_pixmap->data = ocrad_bitmap;
+  ocrad_pixmap->height = height;
+  ocrad_pixmap->width = width;
+  ocrad_pixmap->mode = OCRAD_bitmap;
+  ocrad_pixmap->data = ocrad_bitmap;
 
-    // Number of non-zero pixels on the bitmap, excluding the 1px border:
-    int pixmap_pixels_count = 0;
-    // Number of zero pixels on the bitmap, excluding the 1px border:
-    int pixmap_zeros_count = 0;
+  // Number of non-zero pixels on the bitmap, excluding the 1px border:
+  int pixmap_pixels_count = 0;
+  // Number of zero pixels on the bitmap, excluding the 1px border:
+  int pixmap_zeros_count = 0;
 
-    // The code below initialises "opix->data" buffer ("bitmap_data") for OCRAD from "tmp" buffer:
+  // The code below initialises "opix->data" buffer ("bitmap_data") for OCRAD from "tmp" buffer:
 #ifdef HAVE_CUNEIFORM_LIB
-    Magick::Image cuneiform_img(Magick::Geometry(2 * width + 2, height), "white");
-    // From cuneiform_src/cli/cuneiform-cli.cpp::preprocess_image(Magick::Image&):168
-    cuneiform_img.monochrome();
-    cuneiform_img.type(Magick::BilevelType);
+  Magick::Image cuneiform_img(Magick::Geometry(2 * width + 2, height), "white");
+  // From cuneiform_src/cli/cuneiform-cli.cpp::preprocess_image(Magick::Image&):168
+  cuneiform_img.monochrome();
+  cuneiform_img.type(Magick::BilevelType);
 #endif
-    for (int y = 0; y < height; y++)
-      {
-        for (int x = 0; x < width; x++)
-          {
-            if (pixmap[y * width + x] == 0)
-              {
-                ocrad_bitmap[y * width + x] = 1;
+  for (int y = 0; y < height; y++)
+    {
+      for (int x = 0; x < width; x++)
+        {
+          if (pixmap[y * width + x] == 0)
+            {
+              ocrad_bitmap[y * width + x] = 1;
 #ifdef HAVE_CUNEIFORM_LIB
-                // Draw two identical samples that follow one another. We do so because Cuneiform has difficulties in recognizing single characters:
-                cuneiform_img.pixelColor(x, y, "black");
-                cuneiform_img.pixelColor(x + width + 2, y, "black");
+              // Draw two identical samples that follow one another. We do so because Cuneiform has difficulties in recognizing single characters:
+              cuneiform_img.pixelColor(x, y, "black");
+              cuneiform_img.pixelColor(x + width + 2, y, "black");
 #endif
-                if (x > 0 && x < width - 1 && y > 0 && y < height - 1)
-                  pixmap_pixels_count++;
-              }
-            else if (x > 0 && x < width - 1 && y > 0 && y < height - 1)
-              pixmap_zeros_count++;
-          }
-      }
+              if (x > 0 && x < width - 1 && y > 0 && y < height - 1)
+                pixmap_pixels_count++;
+            }
+          else if (x > 0 && x < width - 1 && y > 0 && y < height - 1)
+            pixmap_zeros_count++;
+        }
+    }
 
-    if (verbose)
+  if (verbose)
+    {
+      // Keep the dumps of the boxes, recognized concurrently, apart from each other:
+      #pragma omp critical (verbose_output)
       {
         std::cout << "Box to OCR: " << x1 << "x" << y1 << "-" << x2 << "x" << y2 << " w/h: " << width << "x" << height << std::endl;
         for (int i = 0; i < height; i++)
           {
             for (int j = 0; j < width; j++)
-              std::cout << (gocr_job.src.p.p[i * width + j] / 255 ? '#' : '.');
+              std::cout << (pixmap[i * width + j] / 255 ? '#' : '.');
             std::cout << std::endl;
           }
       }
+    }
 
-    if (pixmap_pixels_count <= MIN_CHAR_POINTS || pixmap_zeros_count <= MIN_CHAR_POINTS)
-      goto FINALIZE;
+  if (pixmap_pixels_count <= MIN_CHAR_POINTS || pixmap_zeros_count <= MIN_CHAR_POINTS)
+    goto FINALIZE;
 
-    c = osra_gocr_ocr(gocr_job);
+  {
+    const std::string line = osra_gocr_ocr(pixmap, width, height, char_filter);
+    if (line.length() == 1 && isalnum(line[0]))
+      c = line[0];
+  }
 
-    if (verbose)
-      std::cout << "GOCR: c=" << c << std::endl;
+  if (verbose)
+    {
+      #pragma omp critical (verbose_output)
+      {
+        std::cout << "GOCR: c=" << c << std::endl;
+      }
+    }
 
-    //c = UNKNOWN_CHAR; // Switch off GOCR recognition
+  //c = UNKNOWN_CHAR; // Switch off GOCR recognition
 
-    // Character recognition succeeded for GOCR:
-    if (c != UNKNOWN_CHAR)
-      goto FINALIZE;
+  // Character recognition succeeded for GOCR:
+  if (c != UNKNOWN_CHAR)
+    goto FINALIZE;
 
-    // Character recognition failed for GOCR and we try OCRAD:
-    c = osra_ocrad_ocr(ocrad_pixmap, char_filter);
+  // Character recognition failed for GOCR and we try OCRAD:
+  c = osra_ocrad_ocr(ocrad_pixmap, char_filter);
 
-    if (verbose)
-      std::cout << "OCRAD: c=" << c << std::endl;
+  if (verbose)
+    {
+      #pragma omp critical (verbose_output)
+      {
+        std::cout << "OCRAD: c=" << c << std::endl;
+      }
+    }
 
-    //c = UNKNOWN_CHAR;  // Switch off OCRAD recognition
+  //c = UNKNOWN_CHAR;  // Switch off OCRAD recognition
 
-    // Character recognition succeeded for OCRAD:
-    if (c != UNKNOWN_CHAR)
-      goto FINALIZE;
+  // Character recognition succeeded for OCRAD:
+  if (c != UNKNOWN_CHAR)
+    goto FINALIZE;
 
 #ifdef HAVE_TESSERACT_LIB
-    c = osra_tesseract_ocr(gocr_job.src.p.p, width, height, char_filter);
+  c = osra_tesseract_ocr(pixmap, width, height, char_filter);
 
-    if (verbose)
-      std::cout << "Tesseract: c=" << c << std::endl;
+  if (verbose)
+    {
+      #pragma omp critical (verbose_output)
+      {
+        std::cout << "Tesseract: c=" << c << std::endl;
+      }
+    }
 
-    //c = UNKNOWN_CHAR;  // Switch off Tesseract recognition
+  //c = UNKNOWN_CHAR;  // Switch off Tesseract recognition
 
-    // Character recognition succeeded for Tesseract:
-    if (c != UNKNOWN_CHAR)
-      goto FINALIZE;
+  // Character recognition succeeded for Tesseract:
+  if (c != UNKNOWN_CHAR)
+    goto FINALIZE;
 #endif
 #ifdef HAVE_CUNEIFORM_LIB
-    // TODO: Why box width should be more than 7 for Cuneiform?
-    if (width <= 7)
-      goto FINALIZE;
+  // TODO: Why box width should be more than 7 for Cuneiform?
+  if (width <= 7)
+    goto FINALIZE;
 
-    c = osra_cuneiform_ocr(cuneiform_img, char_filter);
+  c = osra_cuneiform_ocr(cuneiform_img, char_filter);
 
-    if (verbose)
-      std::cout << "Cuneiform: c=" << c << std::endl;
+  if (verbose)
+    {
+      #pragma omp critical (verbose_output)
+      {
+        std::cout << "Cuneiform: c=" << c << std::endl;
+      }
+    }
 
-    //c = UNKNOWN_CHAR; // Switch off Cuneiform recognition
+  //c = UNKNOWN_CHAR; // Switch off Cuneiform recognition
 #endif
 
 FINALIZE:
-    // "pixmap" is freed together with "gocr_job".
-    job_free_image(&gocr_job);
-    OCR_JOB = NULL;
-    JOB = NULL;
+  free(pixmap);
 
-    delete ocrad_pixmap; // delete OCRAD Pixmap
-    free(ocrad_bitmap);
+  delete ocrad_pixmap; // delete OCRAD Pixmap
+  free(ocrad_bitmap);
 
-    // TODO: Why there are problems with "7" with a given box size? If the problem is engine-specific, it should be moved to appropriate section
-    if (c == '7' && (width <= 10 || height <= 20))
-      c = UNKNOWN_CHAR;
-  } // #pragma omp critical
+  // TODO: Why there are problems with "7" with a given box size? If the problem is engine-specific, it should be moved to appropriate section
+  if (c == '7' && (width <= 10 || height <= 20))
+    c = UNKNOWN_CHAR;
 
   return(c == UNKNOWN_CHAR ? 0 : c);
 }
@@ -494,26 +539,6 @@ bool detect_bracket(int x, int y, unsigned char *pic)
 {
   bool res = false;
 
-
-#pragma omp critical
-  {
-  char c1 = 0;
-  job_t job;
-  JOB = &job;
-  OCR_JOB = &job;
-  job_init(&job);
-  job_init_image(&job);
-  job.cfg.cfilter = (char *) "([{";
-
-  //job.cfg.cs = 160;
-  //job.cfg.certainty = 80;
-  //job.cfg.dust_size = 1;
-
-  job.src.p.x = x;
-  job.src.p.y = y;
-  job.src.p.bpp = 1;
-  job.src.p.p = pic;
-
   struct OCRAD_Pixmap *ocrad_pixmap = new OCRAD_Pixmap();
   unsigned char *ocrad_bitmap = (unsigned char *) malloc(x * y);
   memset(ocrad_bitmap, 0, x * y);
@@ -552,15 +577,10 @@ bool detect_bracket(int x, int y, unsigned char *pic)
   */
   if (count > MIN_CHAR_POINTS && zeros > MIN_CHAR_POINTS)
     {
-      try
-	{
-	  pgm2asc(&job);
-	}
-      catch (...) {  }
-      char *l;
-      l = (char *) job.res.linelist.start.next->data;
-      if (l != NULL)
-	c1 = l[0];
+      char c1 = 0;
+      const std::string line = osra_gocr_ocr(pic, x, y, "([{");
+      if (!line.empty())
+	c1 = line[0];
       if (c1 == '(' || c1 == '[' || c1 == '{')
 	res = true;
       else
@@ -576,17 +596,15 @@ bool detect_bracket(int x, int y, unsigned char *pic)
   /*
   if (res)
     {
-      std::cout << "Found! " << c1 << std::endl;
+      std::cout << "Found! " << std::endl;
     }
   */
 
   delete ocrad_pixmap;
   free(ocrad_bitmap);
 
-  job_free_image(&job);
-  OCR_JOB = NULL;
-  JOB = NULL;
-}
+  // "pic" used to be freed together with GOCR job:
+  free(pic);
 
   return (res);
 }
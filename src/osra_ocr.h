@@ -25,7 +25,7 @@
 #include <string> // std::string
 #include <map> // std::map
 
-#include <Magick++.h> // Magick::Image, Magick::ColorGray
+#include "osra.h" // bitmap_t
 
 //
 // Section: Functions
@@ -48,10 +48,8 @@ void osra_ocr_destroy();
 // OCR engine function, does single character recognition
 //
 // Parameters:
-//      image - image object
-//      bg - gray-level background color
+//      bitmap - binarized image
 //      x1, y1, x2, y2 - coordinates of the character box
-//      THRESHOLD - graylevel threshold for image binarization
 //      dropx, dropy - coordinates of drop point from where breadth-first algorithm will search for single connected component
 //                     which is hopefully the character we are trying to recognize
 //      no_filtering - do not apply character filter
@@ -59,8 +57,8 @@ void osra_ocr_destroy();
 //
 // Returns:
 //      recognized character or 0
-char get_atom_label(const Magick::Image &image, const Magick::ColorGray &bg, int x1, int y1, int x2, int y2,
-                    double THRESHOLD, int dropx, int dropy, bool no_filtering, bool verbose, bool numbers = false);
+char get_atom_label(const bitmap_t &bitmap, int x1, int y1, int x2, int y2,
+                    int dropx, int dropy, bool no_filtering, bool verbose, bool numbers = false);
 
 // Function: fix_atom_name()
 //
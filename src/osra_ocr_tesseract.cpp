@@ -23,29 +23,66 @@
 #include <string.h> // strlen()
 
 #include <string> // std::string
+#include <vector> // std::vector
 
 #include <tesseract/baseapi.h>
 
 const char UNKNOWN_CHAR = '_';
 
-// Global variable:
-tesseract::TessBaseAPI tess;
+// Tesseract engine can't be shared by concurrent recognitions, so each thread gets an engine of its own.
+// It is created on the first use by the thread and stays in "tess_engines" until osra_tesseract_destroy().
+// The destroy call frees the engines of all threads, but can only reset the pointer of the calling one, so every
+// engine remembers the generation it was created in, and the threads drop the engines of the earlier generations:
+static __thread tesseract::TessBaseAPI *thread_tess = NULL;
+static __thread unsigned int thread_tess_generation = 0;
+static std::vector<tesseract::TessBaseAPI *> tess_engines;
+static unsigned int tess_generation = 0;
+
+static tesseract::TessBaseAPI *get_thread_tesseract()
+{
+  // osra_tesseract_destroy() is never called while a recognition is running, so the generation is stable here:
+  if (thread_tess == NULL || thread_tess_generation != tess_generation)
+    {
+      // Engine initialization reads the shared language data, so engines are created one at a time:
+      #pragma omp critical (tesseract_engines)
+      {
+        thread_tess = new tesseract::TessBaseAPI();
+        thread_tess->Init(NULL, "eng", tesseract::OEM_DEFAULT, NULL, 0, NULL, NULL, false);
+        thread_tess_generation = tess_generation;
+        tess_engines.push_back(thread_tess);
+      }
+    }
+
+  return thread_tess;
+}
 
 void osra_tesseract_init()
 {
-  tess.Init(NULL, "eng", tesseract::OEM_DEFAULT, NULL, 0, NULL, NULL, false);
+  // The engine of the initializing (main) thread is created right away, as it used to be:
+  get_thread_tesseract();
 }
 
 void osra_tesseract_destroy()
 {
-  tess.End();
+  #pragma omp critical (tesseract_engines)
+  {
+    for (std::vector<tesseract::TessBaseAPI *>::iterator it = tess_engines.begin(); it != tess_engines.end(); ++it)
+      {
+        (*it)->End();
+        delete *it;
+      }
+    tess_engines.clear();
+    tess_generation++;
+  }
+
+  thread_tess = NULL;
 }
 
 char osra_tesseract_ocr(unsigned char *pixmap, int width, int height, const std::string &char_filter)
 {
   char result = UNKNOWN_CHAR;
 
-  char *text = tess.TesseractRect(pixmap, 1, width, 0, 0, width, height);
+  char *text = get_thread_tesseract()->TesseractRect(pixmap, 1, width, 0, 0, width, height);
 
   // TODO: Why text length should be exactly 3? Give examples...
   if (text != NULL && strlen(text) == 3 && isalnum(text[0]) && (char_filter.empty() || char_filter.find(text[0], 0) != std::string::npos))
@@ -17,6 +17,8 @@
  St, Fifth Floor, Boston, MA 02110-1301, USA
  *****************************************************************************/
 
+#include <stdio.h> // snprintf()
+
 #include <openbabel/mol.h>
 #include <openbabel/obconversion.h>
 #include <openbabel/builder.h>
@@ -50,6 +52,156 @@ using namespace OpenBabel;
 // Look at this issue: https://sourceforge.net/tracker/?func=detail&aid=3425216&group_id=40728&atid=428740
 #define AROMATIC_BOND_ORDER     5
 
+// struct: openbabel_worker_s
+//      OpenBabel objects of a recognition thread, reused for all the molecules the thread builds
+struct openbabel_worker_s
+{
+  OBMol mol;
+  // conversions to the output format, to the embedded format and to InChI key
+  OBConversion output_conv;
+  OBConversion embedded_conv;
+  OBConversion inchi_key_conv;
+  // formats the conversions are currently set up for
+  std::string output_format;
+  std::string embedded_format;
+
+  openbabel_worker_s()
+  {
+    inchi_key_conv.SetOutFormat("inchi");
+    inchi_key_conv.SetOptions("K", OBConversion::OUTOPTIONS);
+  }
+};
+// Typedef: openbabel_worker_t
+//      defines openbabel_worker_t type based on openbabel_worker_s struct
+typedef struct openbabel_worker_s openbabel_worker_t;
+
+// Every thread gets its worker on the first use, the worker stays in "openbabel_workers" until osra_openbabel_destroy().
+// As with the Tesseract engines, the destroy call bumps the generation, so that the other threads drop their deleted workers:
+static __thread openbabel_worker_t *thread_openbabel_worker = NULL;
+static __thread unsigned int thread_openbabel_generation = 0;
+static std::vector<openbabel_worker_t *> openbabel_workers;
+static unsigned int openbabel_generation = 0;
+
+static openbabel_worker_t *get_thread_openbabel_worker()
+{
+  // osra_openbabel_destroy() is never called while a recognition is running, so the generation is stable here:
+  if (thread_openbabel_worker == NULL || thread_openbabel_generation != openbabel_generation)
+    {
+      thread_openbabel_worker = new openbabel_worker_t();
+      #pragma omp critical (openbabel_workers)
+      {
+        thread_openbabel_generation = openbabel_generation;
+        openbabel_workers.push_back(thread_openbabel_worker);
+      }
+    }
+
+  return thread_openbabel_worker;
+}
+
+// struct: superatom_bond_s
+//      Bond of a precompiled superatom, see <superatom_s>
+struct superatom_bond_s
+{
+  // 1-based indexes of the atoms within the superatom
+  int begin, end;
+  int order;
+  int flags;
+};
+// Typedef: superatom_bond_t
+//      defines superatom_bond_t type based on superatom_bond_s struct
+typedef struct superatom_bond_s superatom_bond_t;
+
+// struct: superatom_s
+//      Superatom SMILES parsed into the atoms and bonds that are copied into the molecule
+struct superatom_s
+{
+  std::vector<int> anum;
+  std::vector<int> charge;
+  std::vector<superatom_bond_t> bonds;
+};
+// Typedef: superatom_t
+//      defines superatom_t type based on superatom_s struct
+typedef struct superatom_s superatom_t;
+
+// Superatoms compiled so far, by their SMILES. The molecules are built in "openbabel" critical section,
+// which guards the table as well:
+static std::map<std::string, superatom_t> compiled_superatoms;
+
+// Function: compile_superatom()
+//
+// Returns the superatom for the SMILES, parsing it on the first use. Should be called in "openbabel" critical section.
+static const superatom_t &compile_superatom(const std::string &smiles)
+{
+  std::map<std::string, superatom_t>::iterator it = compiled_superatoms.find(smiles);
+  if (it != compiled_superatoms.end())
+    return it->second;
+
+  superatom_t &superatom = compiled_superatoms[smiles];
+
+  OBConversion conv;
+  OBMol superatom_mol;
+
+  conv.SetInFormat("SMI");
+  conv.ReadString(&superatom_mol, smiles);
+
+  OBAtomIterator atom_iter;
+  for (OBAtom *a = superatom_mol.BeginAtom(atom_iter); a; a = superatom_mol.NextAtom(atom_iter))
+    {
+      superatom.anum.push_back(a->GetAtomicNum());
+      superatom.charge.push_back(a->GetFormalCharge());
+    }
+
+  OBBondIterator bond_iter;
+  for (OBBond *b = superatom_mol.BeginBond(bond_iter); b; b = superatom_mol.NextBond(bond_iter))
+    {
+      superatom_bond_t bond;
+      bond.begin = b->GetBeginAtomIdx();
+      bond.end = b->GetEndAtomIdx();
+      bond.order = b->GetBondOrder();
+      bond.flags = b->GetFlags();
+      superatom.bonds.push_back(bond);
+    }
+
+  return superatom;
+}
+
+// Function: write_molecule()
+//
+// Writes the molecule out in the given format, reusing the conversion
+static std::string write_molecule(OBConversion &conv, std::string &conv_format, const std::string &format, OBMol &mol)
+{
+  if (conv_format != format)
+    {
+      conv.SetOutFormat(format.c_str());
+      conv_format = format;
+    }
+  // Every molecule is written as the first one, as it would be by a new conversion:
+  conv.SetOutputIndex(0);
+  return conv.WriteString(&mol, true);
+}
+
+// Function: escape_field()
+//
+// Percent-encodes whitespace, control characters and '%' in the value, so that it stays a single field
+// of the whitespace-separated SMILES line
+static std::string escape_field(const std::string &value)
+{
+  std::string escaped;
+  for (unsigned int i = 0; i < value.length(); i++)
+    {
+      unsigned char c = value[i];
+      if (c <= ' ' || c == '%' || c == 127)
+        {
+          char code[4];
+          snprintf(code, sizeof(code), "%%%02X", c);
+          escaped += code;
+        }
+      else
+        escaped += value[i];
+    }
+  return escaped;
+}
+
 int osra_openbabel_init()
 {
   OBConversion conv;
@@ -64,6 +216,28 @@ int osra_openbabel_init()
   return 0;
 }
 
+void osra_openbabel_compile_superatoms(const std::map<std::string, std::string> &superatom)
+{
+  #pragma omp critical (openbabel)
+  {
+    for (std::map<std::string, std::string>::const_iterator it = superatom.begin(); it != superatom.end(); it++)
+      compile_superatom(it->second);
+  }
+}
+
+void osra_openbabel_destroy()
+{
+  #pragma omp critical (openbabel_workers)
+  {
+    for (std::vector<openbabel_worker_t *>::iterator it = openbabel_workers.begin(); it != openbabel_workers.end(); ++it)
+      delete *it;
+    openbabel_workers.clear();
+    openbabel_generation++;
+  }
+
+  thread_openbabel_worker = NULL;
+}
+
 // Function: create_atom()
 //
 // For the atom represented by its OCR'ed label create a new atom in the given molecule.
@@ -94,12 +268,7 @@ bool create_atom(OBMol &mol, atom_t &atom, double scale,
         {
           // "superatom" case (e.g. "COOH")
           const std::string &smiles_superatom = it->second;
-
-          OBConversion conv;
-          OBMol superatom_mol;
-
-          conv.SetInFormat("SMI");
-          conv.ReadString(&superatom_mol, smiles_superatom);
+          const superatom_t &superatom_mol = compile_superatom(smiles_superatom);
 
           if (verbose)
             std::cout << "Considering superatom " << atom.label << "->" << smiles_superatom <<
@@ -108,20 +277,18 @@ bool create_atom(OBMol &mol, atom_t &atom, double scale,
           // This is the index of first atom in superatom in molecule:
           atom.n = mol.NumAtoms() + 1;
 
-          OBAtomIterator atom_iter;
-
           // Transfer all atoms from "superatom" molecule to current molecule.
 
 
-          for (OBAtom *a = superatom_mol.BeginAtom(atom_iter); a; a = superatom_mol.NextAtom(atom_iter))
+          for (unsigned int i = 0; i < superatom_mol.anum.size(); i++)
             {
               if (verbose)
-                std::cout << "Adding atom #" << mol.NumAtoms() + 1 << ", anum: " << a->GetAtomicNum() << std::endl;
+                std::cout << "Adding atom #" << mol.NumAtoms() + 1 << ", anum: " << superatom_mol.anum[i] << std::endl;
 
               OBAtom *new_atom = mol.NewAtom();
 
-              new_atom->SetAtomicNum(a->GetAtomicNum());
-              new_atom->SetFormalCharge(a->GetFormalCharge());
+              new_atom->SetAtomicNum(superatom_mol.anum[i]);
+              new_atom->SetFormalCharge(superatom_mol.charge[i]);
 	      if (!atom.label.empty() && atom.label != " ")
 		{
 		  // Unknown atom?
@@ -150,17 +317,16 @@ bool create_atom(OBMol &mol, atom_t &atom, double scale,
 
           int first_bond_index = mol.NumBonds();
 
-          OBBondIterator bond_iter;
-
           // Transfer all bonds from "superatom" molecule to current molecule:
-          for (OBBond *b = superatom_mol.BeginBond(bond_iter); b; b = superatom_mol.NextBond(bond_iter))
+          for (unsigned int i = 0; i < superatom_mol.bonds.size(); i++)
             {
+              const superatom_bond_t &b = superatom_mol.bonds[i];
+
               if (verbose)
-                std::cout << "Adding bond #" << mol.NumBonds() << " " << b->GetBeginAtomIdx() + atom.n - 1 << "->" << b->GetEndAtomIdx() + atom.n - 1
-                          << ", order: " << b->GetBondOrder() << ", flags: " << b->GetFlags() << '.' << std::endl;
+                std::cout << "Adding bond #" << mol.NumBonds() << " " << b.begin + atom.n - 1 << "->" << b.end + atom.n - 1
+                          << ", order: " << b.order << ", flags: " << b.flags << '.' << std::endl;
 
-              mol.AddBond(b->GetBeginAtomIdx() + atom.n - 1, b->GetEndAtomIdx() + atom.n - 1,
-                          b->GetBondOrder(), b->GetFlags());
+              mol.AddBond(b.begin + atom.n - 1, b.end + atom.n - 1, b.order, b.flags);
             }
 
           // If at least one bond was added, the "superatom" coordinates should be recalculated:
@@ -740,14 +906,15 @@ molecule_statistics_t calculate_molecule_statistics(
     const std::map<std::string, std::string> &superatom, bool verbose)
 {
   molecule_statistics_t molecule_statistics;
+  OBMol &mol = get_thread_openbabel_worker()->mol;
+  std::vector <bracket_t> brackets;
 
-  #pragma omp critical
+  // OpenBabel 2 perceives aromaticity and atom types with the shared typers, so the molecules are built one at a time:
+  #pragma omp critical (openbabel)
   {
-    OBMol mol;
-    std::vector <bracket_t> brackets;
     create_molecule(mol, atom, bond, n_bond, avg_bond_length, molecule_statistics, false, NULL, superatom, 0, NULL, false, brackets);
-    mol.Clear();
   }
+  mol.Clear();
 
   if (verbose)
     std::cout << "Molecule fragments: " << molecule_statistics.fragments << '.' << std::endl;
@@ -762,14 +929,22 @@ const std::string get_formatted_structure(
     double &confidence, bool show_confidence,
     double avg_bond_length, double scaled_avg_bond_length, bool show_avg_bond_length,
     const int * const resolution, const int * const page, const box_t * const surrounding_box,
-    const std::map<std::string, std::string> &superatom, int n_letters, bool show_learning,
-    int resolution_iteration, bool verbose, const std::vector<bracket_t>& brackets)
+    const std::string * const source, const std::map<std::string, std::string> &superatom, int n_letters, bool show_learning,
+    int resolution_iteration, bool verbose, const std::vector<bracket_t>& brackets,
+    molecule_ptr_t *molecule)
 {
   std::ostringstream strstr;
-  #pragma omp critical
+  openbabel_worker_t *worker = get_thread_openbabel_worker();
+  // The requested molecule is built in place, so that it does not need to be copied:
+  if (molecule != NULL)
+    molecule->reset(new OBMol);
+  OBMol &mol = molecule != NULL ? **molecule : worker->mol;
+  std::string confidence_parameters;
+  std::string structure;
+
+  // See calculate_molecule_statistics(); InChI library is not thread-safe either:
+  #pragma omp critical (openbabel)
   {
-    OBMol mol;
-    std::string confidence_parameters;
     create_molecule(mol, atom, bond, n_bond, avg_bond_length, molecule_statistics, format == "sdf" || format == "mol" || format == "sd" || format == "mdl", &confidence, superatom,
 		    n_letters, &confidence_parameters, verbose, brackets);
 
@@ -871,15 +1046,17 @@ const std::string get_formatted_structure(
         mol.SetData(label);
       }
 
-    if (!embedded_format.empty())
+    if (source)
       {
-        std::string value;
-
-        OBConversion conv;
-
-        conv.SetOutFormat(embedded_format.c_str());
+        OBPairData *label = new OBPairData;
+        label->SetAttribute("Source");
+        label->SetValue(*source);
+        mol.SetData(label);
+      }
 
-        value = conv.WriteString(&mol);
+    if (!embedded_format.empty())
+      {
+        std::string value = write_molecule(worker->embedded_conv, worker->embedded_format, embedded_format, mol);
         trim(value);
 
         if (!value.empty())
@@ -890,9 +1067,8 @@ const std::string get_formatted_structure(
             mol.SetData(label);
             if (embedded_format == "inchi")
               {
-                conv.SetOptions("K", conv.OUTOPTIONS);
-
-                value = conv.WriteString(&mol);
+                worker->inchi_key_conv.SetOutputIndex(0);
+                value = worker->inchi_key_conv.WriteString(&mol, true);
                 trim(value);
 
                 label = new OBPairData;
@@ -903,33 +1079,36 @@ const std::string get_formatted_structure(
           }
       }
 
-    OBConversion conv;
+    if (molecule == NULL)
+      structure = write_molecule(worker->output_conv, worker->output_format, format, mol);
+  }
 
-    conv.SetOutFormat(format.c_str());
-    conv.Read(&mol);
+  if (molecule != NULL)
+    return "";
 
-    strstr << conv.WriteString(&mol, true);
+  mol.Clear();
 
-    if (format == "smi" || format == "can")
-      {
-        if (show_avg_bond_length)
-          strstr << " " << scaled_avg_bond_length;
-        if (resolution)
-          strstr << " " << *resolution;
-        if (show_confidence)
-          strstr << " " << confidence;
-	if (show_learning)
-          strstr << " " << confidence_parameters<<" "<<resolution_iteration;
-        if (page)
-          strstr << " " << *page;
-        if (surrounding_box)
-          strstr << " "<< surrounding_box->x1 << 'x' << surrounding_box->y1 << '-' << surrounding_box->x2 << 'x' << surrounding_box->y2;
-      }
+  strstr << structure;
 
-    strstr << std::endl;
+  if (format == "smi" || format == "can")
+    {
+      if (show_avg_bond_length)
+        strstr << " " << scaled_avg_bond_length;
+      if (resolution)
+        strstr << " " << *resolution;
+      if (show_confidence)
+        strstr << " " << confidence;
+      if (show_learning)
+        strstr << " " << confidence_parameters<<" "<<resolution_iteration;
+      if (page)
+        strstr << " " << *page;
+      if (surrounding_box)
+        strstr << " "<< surrounding_box->x1 << 'x' << surrounding_box->y1 << '-' << surrounding_box->x2 << 'x' << surrounding_box->y2;
+      if (source)
+        strstr << " " << escape_field(*source);
+    }
 
-    mol.Clear();
-  }
+  strstr << std::endl;
 
   if (verbose)
     std::cout << "Structure length: " << strstr.str().length() << ", molecule fragments: " << molecule_statistics.fragments << '.' << std::endl;
@@ -24,6 +24,8 @@
 #include <map> // std::map
 #include <vector> // std::vector
 
+#include <openbabel/shared_ptr.h> // shared_ptr<T> in global namespace
+
 #include "osra.h"
 #include "osra_segment.h"
 
@@ -34,6 +36,20 @@
 //
 
 
+// openbabel/shared_ptr.h declares shared_ptr<T> in global namespace.
+// Here we encapsulate it into OpenBabel:: namespace, and use only fully specified
+// name OpenBabel::shared_ptr<T> in the code.
+namespace OpenBabel
+{
+  template<typename T> using shared_ptr = shared_ptr<T>;
+
+  class OBMol;
+}
+
+// Typedef: molecule_ptr_t
+//      a molecule kept in memory instead of its text presentation, see <get_formatted_structure()>
+typedef OpenBabel::shared_ptr<OpenBabel::OBMol> molecule_ptr_t;
+
 //struct: molecule_statistics_s
 //      contains the statistical information about molecule used for analysis of recognition accuracy
 struct molecule_statistics_s
@@ -80,6 +96,20 @@ typedef struct molecule_statistics_s molecule_statistics_t;
 //      non-zero value in case of error
 int osra_openbabel_init();
 
+// Function: osra_openbabel_compile_superatoms()
+//
+// Parses the SMILES of the superatom dictionary once, so that the superatoms are copied into the molecules
+// without parsing. The superatoms missing from the dictionaries compiled so far are parsed on the first use.
+//
+// Parameters:
+//      superatom - dictionary of superatom labels mapped to SMILES
+void osra_openbabel_compile_superatoms(const std::map<std::string, std::string> &superatom);
+
+// Function: osra_openbabel_destroy()
+//
+// Releases OpenBabel objects kept by the recognition threads. Should be called at e.g. program exit.
+void osra_openbabel_destroy();
+
 // Function: calculate_molecule_statistics()
 //
 // Converts vectors of atoms and bonds into a molecular object and calculates the molecule statistics.
@@ -119,11 +149,15 @@ molecule_statistics_t calculate_molecule_statistics(
 //      resolution - resolution at which image is being processed in DPI (to be included into output if provided)
 //      page - page number (to be included into output if provided)
 //      surrounding_box - the coordinates of surrounding image box that contains the structure (to be included into output if provided)
+//      source - the input the structure comes from (to be included into output if provided)
 //      superatom - dictionary of superatom labels mapped to SMILES
 //      verbose - print debug info
+//      molecule - if not NULL, receives the molecule itself (built as for the given format) and the text
+//                 presentation is skipped; used to assemble the reactions without parsing the text back
 //
 //  Returns:
-//      string containing SMILES, SDF or other representation of the molecule
+//      string containing SMILES, SDF or other representation of the molecule, or an empty string if the
+//      molecule is requested
 const std::string get_formatted_structure(
     std::vector<atom_t> &atom, const std::vector<bond_t> &bond, int n_bond,
     const std::string &format, const std::string &second_format,
@@ -131,7 +165,8 @@ const std::string get_formatted_structure(
     double &confidence, bool show_confidence,
     double avg_bond_length, double scaled_avg_bond_length, bool show_avg_bond_length,
     const int * const resolution, const int * const page, const box_t * const surrounding_box,
-    const std::map<std::string, std::string> &superatom, int n_letters, bool show_learning,
-    int resolution_iteration, bool verbose, const std::vector<bracket_t>&  brackets);
+    const std::string * const source, const std::map<std::string, std::string> &superatom, int n_letters, bool show_learning,
+    int resolution_iteration, bool verbose, const std::vector<bracket_t>&  brackets,
+    molecule_ptr_t *molecule = NULL);
 
 #endif
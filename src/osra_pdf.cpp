@@ -0,0 +1,624 @@
+/******************************************************************************
+ OSRA: Optical Structure Recognition Application
+
+ Created by Igor Filippov, 2007-2013 (igor.v.filippov@gmail.com)
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along with
+ this program; if not, write to the Free Software Foundation, Inc., 51 Franklin
+ St, Fifth Floor, Boston, MA 02110-1301, USA
+ *****************************************************************************/
+
+// File: osra_pdf.cpp
+//
+// Reads the page tree of PDF documents to find the images of every page
+//
+
+#include <ctype.h> // isdigit()
+#include <stdlib.h> // strtod()
+#include <string.h> // memcmp(), memset()
+
+#include <algorithm> // std::search(), std::sort()
+#include <fstream> // std::ifstream
+#include <map> // std::map
+
+#include <zlib.h> // inflate()
+
+#include "osra_pdf.h"
+
+// Nesting allowed for the PDF values and the page tree, deeper ones are taken for damaged:
+#define PDF_MAX_DEPTH 64
+// Nesting of form XObjects searched for the images:
+#define PDF_MAX_FORM_DEPTH 4
+
+// struct: pdf_value_s
+//      PDF object, as far as it is needed to walk the page tree; strings, booleans and null are all "other"
+struct pdf_value_s
+{
+  enum { OTHER, NUMBER, NAME, REFERENCE, ARRAY, DICTIONARY } type;
+  double number;
+  // name without the slash
+  std::string name;
+  // object number of the reference
+  int reference;
+  std::vector<pdf_value_s> array;
+  std::map<std::string, pdf_value_s> dictionary;
+
+  pdf_value_s() : type(OTHER), number(0), reference(0)
+  {
+  }
+};
+// Typedef: pdf_value_t
+//      defines pdf_value_t type based on pdf_value_s struct
+typedef struct pdf_value_s pdf_value_t;
+
+// Function: is_pdf_space()
+//
+// Tells if the character is PDF white-space
+static bool is_pdf_space(char c)
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\0';
+}
+
+// Function: is_pdf_regular()
+//
+// Tells if the character is neither white-space nor a delimiter
+static bool is_pdf_regular(char c)
+{
+  return !is_pdf_space(c) && strchr("()<>[]{}/%", c) == NULL;
+}
+
+// Function: skip_pdf_space()
+//
+// Skips white-space and comments
+static const char *skip_pdf_space(const char *pos, const char *end)
+{
+  while (pos < end)
+    {
+      if (*pos == '%')
+        while (pos < end && *pos != '\n' && *pos != '\r')
+          pos++;
+      else if (is_pdf_space(*pos))
+        pos++;
+      else
+        break;
+    }
+  return pos;
+}
+
+// Function: read_pdf_integer()
+//
+// Reads an unsigned integer, returns the position after it or "pos" itself if there is none
+static const char *read_pdf_integer(const char *pos, const char *end, int &value)
+{
+  const char *digits = pos;
+  value = 0;
+  while (pos < end && isdigit(*pos) && pos - digits < 10)
+    value = value * 10 + (*pos++ - '0');
+  if (pos < end && isdigit(*pos))
+    return digits;
+  return pos;
+}
+
+// Function: parse_pdf_value()
+//
+// Parses the PDF value at the position
+//
+// Parameters:
+//      pos - the position, moved past the value (returned to the caller)
+//      end - the end of the data
+//      value - the parsed value (returned to the caller)
+//      depth - nesting of the value
+//
+// Returns:
+//      false if the data is damaged
+static bool parse_pdf_value(const char *&pos, const char *end, pdf_value_t &value, int depth)
+{
+  if (depth > PDF_MAX_DEPTH)
+    return false;
+
+  pos = skip_pdf_space(pos, end);
+  if (pos == end)
+    return false;
+
+  if (*pos == '<' && pos + 1 < end && pos[1] == '<')
+    {
+      value.type = pdf_value_t::DICTIONARY;
+      pos += 2;
+      while (true)
+        {
+          pos = skip_pdf_space(pos, end);
+          if (pos + 1 < end && pos[0] == '>' && pos[1] == '>')
+            {
+              pos += 2;
+              return true;
+            }
+          pdf_value_t key;
+          if (!parse_pdf_value(pos, end, key, depth + 1) || key.type != pdf_value_t::NAME)
+            return false;
+          if (!parse_pdf_value(pos, end, value.dictionary[key.name], depth + 1))
+            return false;
+        }
+    }
+  if (*pos == '[')
+    {
+      value.type = pdf_value_t::ARRAY;
+      pos++;
+      while (true)
+        {
+          pos = skip_pdf_space(pos, end);
+          if (pos < end && *pos == ']')
+            {
+              pos++;
+              return true;
+            }
+          value.array.push_back(pdf_value_t());
+          if (!parse_pdf_value(pos, end, value.array.back(), depth + 1))
+            return false;
+        }
+    }
+  if (*pos == '<')
+    {
+      // hex string
+      pos = std::find(pos, end, '>');
+      if (pos == end)
+        return false;
+      pos++;
+      return true;
+    }
+  if (*pos == '(')
+    {
+      // literal string, with balanced parentheses and escapes
+      int level = 0;
+      for (; pos < end; pos++)
+        {
+          if (*pos == '\\')
+            pos++;
+          else if (*pos == '(')
+            level++;
+          else if (*pos == ')' && --level == 0)
+            {
+              pos++;
+              return true;
+            }
+        }
+      return false;
+    }
+  if (*pos == '/')
+    {
+      value.type = pdf_value_t::NAME;
+      const char *name = ++pos;
+      while (pos < end && is_pdf_regular(*pos))
+        pos++;
+      value.name.assign(name, pos);
+      return true;
+    }
+  if (isdigit(*pos) || *pos == '+' || *pos == '-' || *pos == '.')
+    {
+      const char *number = pos;
+      while (pos < end && is_pdf_regular(*pos))
+        pos++;
+      value.type = pdf_value_t::NUMBER;
+      value.number = strtod(std::string(number, pos).c_str(), NULL);
+
+      // "<object> <generation> R" is a reference:
+      int object, generation;
+      const char *next = read_pdf_integer(number, pos, object);
+      if (next == pos)
+        {
+          const char *gen = skip_pdf_space(pos, end);
+          next = read_pdf_integer(gen, end, generation);
+          if (next > gen)
+            {
+              const char *r = skip_pdf_space(next, end);
+              if (r > next && r < end && *r == 'R' && (r + 1 == end || !is_pdf_regular(r[1])))
+                {
+                  value.type = pdf_value_t::REFERENCE;
+                  value.reference = object;
+                  pos = r + 1;
+                }
+            }
+        }
+      return true;
+    }
+  if (is_pdf_regular(*pos))
+    {
+      // keywords: true, false, null
+      while (pos < end && is_pdf_regular(*pos))
+        pos++;
+      return true;
+    }
+  return false;
+}
+
+// Function: inflate_pdf_stream()
+//
+// Decodes FlateDecode stream data; the data decoded before an error is kept
+static bool inflate_pdf_stream(const char *data, size_t length, std::string &decoded)
+{
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK)
+    return false;
+
+  stream.next_in = (Bytef *) data;
+  stream.avail_in = length;
+  char buffer[16384];
+  int result;
+  do
+    {
+      stream.next_out = (Bytef *) buffer;
+      stream.avail_out = sizeof(buffer);
+      result = inflate(&stream, Z_NO_FLUSH);
+      decoded.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+  while (result == Z_OK && (stream.avail_in > 0 || stream.avail_out == 0));
+
+  inflateEnd(&stream);
+  return !decoded.empty();
+}
+
+// struct: pdf_document_s
+//      The raw document with its objects indexed by their numbers
+struct pdf_document_s
+{
+  const char *data;
+  const char *end;
+  // positions right after "<number> <generation> obj", the last definition of an object wins (incremental updates)
+  std::map<int, const char *> objects;
+  // objects packed into object streams: the decoded stream and the position of the object in it;
+  // the objects defined directly take precedence over these
+  std::vector<std::string> object_streams;
+  std::map<int, std::pair<int, size_t> > packed_objects;
+
+  pdf_document_s(const char *begin, size_t length) : data(begin), end(begin + length)
+  {
+  }
+};
+// Typedef: pdf_document_t
+//      defines pdf_document_t type based on pdf_document_s struct
+typedef struct pdf_document_s pdf_document_t;
+
+// Function: load_pdf_object()
+//
+// Parses the object with the given number
+//
+// Returns:
+//      false if there is no such object or it is damaged
+static bool load_pdf_object(const pdf_document_t &doc, int number, pdf_value_t &value)
+{
+  std::map<int, const char *>::const_iterator direct = doc.objects.find(number);
+  if (direct != doc.objects.end())
+    {
+      const char *pos = direct->second;
+      return parse_pdf_value(pos, doc.end, value, 0);
+    }
+
+  std::map<int, std::pair<int, size_t> >::const_iterator packed = doc.packed_objects.find(number);
+  if (packed != doc.packed_objects.end())
+    {
+      const std::string &stream = doc.object_streams[packed->second.first];
+      if (packed->second.second >= stream.size())
+        return false;
+      const char *pos = stream.data() + packed->second.second;
+      return parse_pdf_value(pos, stream.data() + stream.size(), value, 0);
+    }
+
+  return false;
+}
+
+// Function: resolve_pdf_value()
+//
+// Follows the references until a direct value is reached
+static bool resolve_pdf_value(const pdf_document_t &doc, const pdf_value_t &value, pdf_value_t &resolved)
+{
+  resolved = value;
+  for (int i = 0; resolved.type == pdf_value_t::REFERENCE; i++)
+    {
+      int number = resolved.reference;
+      resolved = pdf_value_t();
+      if (i == PDF_MAX_DEPTH || !load_pdf_object(doc, number, resolved))
+        return false;
+    }
+  return true;
+}
+
+// Function: get_pdf_entry()
+//
+// Finds the dictionary entry and resolves it
+static bool get_pdf_entry(const pdf_document_t &doc, const pdf_value_t &dictionary, const std::string &key,
+                          pdf_value_t &entry)
+{
+  std::map<std::string, pdf_value_t>::const_iterator it = dictionary.dictionary.find(key);
+  return it != dictionary.dictionary.end() && resolve_pdf_value(doc, it->second, entry);
+}
+
+// Function: is_pdf_name()
+//
+// Tells if the dictionary entry is the given name
+static bool is_pdf_name(const pdf_value_t &dictionary, const std::string &key, const std::string &name)
+{
+  std::map<std::string, pdf_value_t>::const_iterator it = dictionary.dictionary.find(key);
+  return it != dictionary.dictionary.end() && it->second.type == pdf_value_t::NAME && it->second.name == name;
+}
+
+// Function: find_pdf_stream_data()
+//
+// Finds the data of the stream object that starts at the position of its dictionary
+static bool find_pdf_stream_data(const pdf_document_t &doc, const char *dictionary_end, const pdf_value_t &dictionary,
+                                 const char *&begin, const char *&end)
+{
+  const std::string stream = "stream", endstream = "endstream";
+  const char *pos = skip_pdf_space(dictionary_end, doc.end);
+  if ((size_t) (doc.end - pos) < stream.size() || memcmp(pos, stream.data(), stream.size()) != 0)
+    return false;
+  pos += stream.size();
+  if (pos < doc.end && *pos == '\r')
+    pos++;
+  if (pos < doc.end && *pos == '\n')
+    pos++;
+  begin = pos;
+
+  pdf_value_t length;
+  if (get_pdf_entry(doc, dictionary, "Length", length) && length.type == pdf_value_t::NUMBER && length.number >= 0
+      && length.number <= doc.end - begin)
+    end = begin + (size_t) length.number;
+  else
+    end = std::search(begin, doc.end, endstream.begin(), endstream.end());
+  return true;
+}
+
+// Function: index_pdf_objects()
+//
+// Finds all "<number> <generation> obj" headers in the document and unpacks the object streams
+static void index_pdf_objects(pdf_document_t &doc)
+{
+  const std::string obj = "obj";
+  const char *pos = doc.data;
+  while ((pos = std::search(pos, doc.end, obj.begin(), obj.end())) != doc.end)
+    {
+      const char *header_end = pos + obj.size();
+      pos = header_end;
+      if (header_end < doc.end && is_pdf_regular(*header_end))
+        continue;
+
+      // "<number> <generation> " must be right before, from the start of the line or after a delimiter:
+      const char *p = header_end - obj.size();
+      if (p == doc.data || !is_pdf_space(p[-1]))
+        continue;
+      while (p > doc.data && is_pdf_space(p[-1]))
+        p--;
+      const char *gen_end = p;
+      while (p > doc.data && isdigit(p[-1]))
+        p--;
+      if (p == gen_end || p == doc.data || !is_pdf_space(p[-1]))
+        continue;
+      while (p > doc.data && is_pdf_space(p[-1]))
+        p--;
+      const char *number_end = p;
+      while (p > doc.data && isdigit(p[-1]))
+        p--;
+      int number;
+      if (p == number_end || (p > doc.data && is_pdf_regular(p[-1])) || read_pdf_integer(p, number_end, number) != number_end)
+        continue;
+
+      doc.objects[number] = header_end;
+    }
+
+  // The object streams are unpacked in the order they come in the document, so that the later updates win:
+  std::vector<std::pair<const char *, int> > object_streams;
+  for (std::map<int, const char *>::const_iterator it = doc.objects.begin(); it != doc.objects.end(); it++)
+    object_streams.push_back(std::make_pair(it->second, it->first));
+  std::sort(object_streams.begin(), object_streams.end());
+
+  for (unsigned int i = 0; i < object_streams.size(); i++)
+    {
+      const char *pos = object_streams[i].first;
+      pdf_value_t dictionary;
+      if (!parse_pdf_value(pos, doc.end, dictionary, 0) || !is_pdf_name(dictionary, "Type", "ObjStm"))
+        continue;
+
+      // Object streams are compressed with no predictor, if at all:
+      const char *begin, *end;
+      if (!find_pdf_stream_data(doc, pos, dictionary, begin, end) || dictionary.dictionary.count("DecodeParms") > 0)
+        continue;
+      std::string stream;
+      if (is_pdf_name(dictionary, "Filter", "FlateDecode"))
+        {
+          if (!inflate_pdf_stream(begin, end - begin, stream))
+            continue;
+        }
+      else if (dictionary.dictionary.count("Filter") == 0)
+        stream.assign(begin, end);
+      else
+        continue;
+
+      pdf_value_t count, first;
+      if (!get_pdf_entry(doc, dictionary, "N", count) || count.type != pdf_value_t::NUMBER
+          || !get_pdf_entry(doc, dictionary, "First", first) || first.type != pdf_value_t::NUMBER || first.number < 0)
+        continue;
+
+      // The stream starts with the pairs of the object numbers and their offsets after "First":
+      doc.object_streams.push_back(stream);
+      const std::string &objects = doc.object_streams.back();
+      const char *p = objects.data(), *objects_end = objects.data() + objects.size();
+      for (int j = 0; j < count.number; j++)
+        {
+          int number, offset;
+          p = skip_pdf_space(p, objects_end);
+          const char *next = read_pdf_integer(p, objects_end, number);
+          if (next == p)
+            break;
+          p = skip_pdf_space(next, objects_end);
+          next = read_pdf_integer(p, objects_end, offset);
+          if (next == p)
+            break;
+          p = next;
+          if (doc.objects.count(number) == 0)
+            doc.packed_objects[number] = std::make_pair((int) doc.object_streams.size() - 1, (size_t) first.number + offset);
+        }
+    }
+}
+
+// Function: find_pdf_catalog()
+//
+// Finds the document catalog: the root of the last trailer or cross-reference stream, or any catalog object
+static bool find_pdf_catalog(const pdf_document_t &doc, pdf_value_t &catalog)
+{
+  const std::string trailer = "trailer";
+  const char *last_root = NULL;
+  pdf_value_t root;
+
+  // Classic trailers:
+  const char *pos = doc.data;
+  while ((pos = std::search(pos, doc.end, trailer.begin(), trailer.end())) != doc.end)
+    {
+      pos += trailer.size();
+      const char *p = pos;
+      pdf_value_t dictionary;
+      if (parse_pdf_value(p, doc.end, dictionary, 0) && dictionary.dictionary.count("Root") > 0
+          && (last_root == NULL || pos > last_root))
+        {
+          root = dictionary.dictionary["Root"];
+          last_root = pos;
+        }
+    }
+
+  // Cross-reference streams, which replace the trailers since PDF 1.5:
+  for (std::map<int, const char *>::const_iterator it = doc.objects.begin(); it != doc.objects.end(); it++)
+    {
+      const char *p = it->second;
+      pdf_value_t dictionary;
+      if (parse_pdf_value(p, doc.end, dictionary, 0) && is_pdf_name(dictionary, "Type", "XRef")
+          && dictionary.dictionary.count("Root") > 0 && (last_root == NULL || it->second > last_root))
+        {
+          root = dictionary.dictionary["Root"];
+          last_root = it->second;
+        }
+    }
+
+  if (last_root != NULL && resolve_pdf_value(doc, root, catalog) && catalog.type == pdf_value_t::DICTIONARY)
+    return true;
+
+  for (std::map<int, const char *>::const_iterator it = doc.objects.begin(); it != doc.objects.end(); it++)
+    {
+      catalog = pdf_value_t();
+      if (load_pdf_object(doc, it->first, catalog) && is_pdf_name(catalog, "Type", "Catalog"))
+        return true;
+    }
+  for (std::map<int, std::pair<int, size_t> >::const_iterator it = doc.packed_objects.begin(); it != doc.packed_objects.end(); it++)
+    {
+      catalog = pdf_value_t();
+      if (load_pdf_object(doc, it->first, catalog) && is_pdf_name(catalog, "Type", "Catalog"))
+        return true;
+    }
+
+  return false;
+}
+
+// Function: collect_pdf_images()
+//
+// Collects the sizes of the image XObjects of the resources, looking into the form XObjects as well
+static void collect_pdf_images(const pdf_document_t &doc, const pdf_value_t &resources, int depth,
+                               std::set<std::pair<int, int> > &sizes)
+{
+  pdf_value_t xobjects;
+  if (!get_pdf_entry(doc, resources, "XObject", xobjects) || xobjects.type != pdf_value_t::DICTIONARY)
+    return;
+
+  for (std::map<std::string, pdf_value_t>::const_iterator it = xobjects.dictionary.begin(); it != xobjects.dictionary.end(); it++)
+    {
+      pdf_value_t xobject;
+      if (!resolve_pdf_value(doc, it->second, xobject) || xobject.type != pdf_value_t::DICTIONARY)
+        continue;
+
+      if (is_pdf_name(xobject, "Subtype", "Image"))
+        {
+          pdf_value_t width, height;
+          if (get_pdf_entry(doc, xobject, "Width", width) && width.type == pdf_value_t::NUMBER && width.number > 0
+              && get_pdf_entry(doc, xobject, "Height", height) && height.type == pdf_value_t::NUMBER && height.number > 0)
+            sizes.insert(std::make_pair((int) width.number, (int) height.number));
+        }
+      else if (is_pdf_name(xobject, "Subtype", "Form") && depth < PDF_MAX_FORM_DEPTH)
+        {
+          pdf_value_t form_resources;
+          if (get_pdf_entry(doc, xobject, "Resources", form_resources) && form_resources.type == pdf_value_t::DICTIONARY)
+            collect_pdf_images(doc, form_resources, depth + 1, sizes);
+        }
+    }
+}
+
+// Function: walk_pdf_pages()
+//
+// Walks the page tree in the page order, the pages get the resources of the nearest node that has them;
+// "visited" keeps the node objects already seen, so that a cyclic tree is walked once
+static void walk_pdf_pages(const pdf_document_t &doc, const pdf_value_t &node, const pdf_value_t &inherited_resources,
+                           int depth, std::set<int> &visited, std::vector<std::set<std::pair<int, int> > > &sizes)
+{
+  if (depth > PDF_MAX_DEPTH)
+    return;
+
+  pdf_value_t resources;
+  if (!get_pdf_entry(doc, node, "Resources", resources) || resources.type != pdf_value_t::DICTIONARY)
+    resources = inherited_resources;
+
+  pdf_value_t kids;
+  if (!is_pdf_name(node, "Type", "Page") && get_pdf_entry(doc, node, "Kids", kids) && kids.type == pdf_value_t::ARRAY)
+    {
+      for (unsigned int i = 0; i < kids.array.size(); i++)
+        {
+          if (kids.array[i].type == pdf_value_t::REFERENCE && !visited.insert(kids.array[i].reference).second)
+            continue;
+          pdf_value_t kid;
+          if (resolve_pdf_value(doc, kids.array[i], kid) && kid.type == pdf_value_t::DICTIONARY)
+            walk_pdf_pages(doc, kid, resources, depth + 1, visited, sizes);
+        }
+      return;
+    }
+
+  sizes.push_back(std::set<std::pair<int, int> >());
+  collect_pdf_images(doc, resources, 0, sizes.back());
+}
+
+bool find_pdf_page_image_sizes(const char *image_data, int image_length, const std::string &input_file,
+                               std::vector<std::set<std::pair<int, int> > > &sizes)
+{
+  std::vector<char> buffer;
+  if (image_data == NULL)
+    {
+      std::ifstream in(input_file.c_str(), std::ios::in | std::ios::binary);
+      if (!in)
+        return false;
+      in.seekg(0, std::ios::end);
+      std::streamoff length = in.tellg();
+      in.seekg(0, std::ios::beg);
+      if (length <= 0)
+        return false;
+      buffer.resize(length);
+      in.read(&buffer[0], length);
+      image_data = &buffer[0];
+      image_length = in.gcount();
+    }
+
+  pdf_document_t doc(image_data, image_length);
+  index_pdf_objects(doc);
+
+  pdf_value_t catalog, pages;
+  if (!find_pdf_catalog(doc, catalog) || !get_pdf_entry(doc, catalog, "Pages", pages) || pages.type != pdf_value_t::DICTIONARY)
+    return false;
+
+  std::set<int> visited;
+  std::map<std::string, pdf_value_t>::const_iterator root_pages = catalog.dictionary.find("Pages");
+  if (root_pages->second.type == pdf_value_t::REFERENCE)
+    visited.insert(root_pages->second.reference);
+  walk_pdf_pages(doc, pages, pdf_value_t(), 0, visited, sizes);
+  return !sizes.empty();
+}
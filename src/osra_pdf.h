@@ -0,0 +1,49 @@
+/******************************************************************************
+ OSRA: Optical Structure Recognition Application
+
+ Created by Igor Filippov, 2007-2013 (igor.v.filippov@gmail.com)
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along with
+ this program; if not, write to the Free Software Foundation, Inc., 51 Franklin
+ St, Fifth Floor, Boston, MA 02110-1301, USA
+ *****************************************************************************/
+
+// Header: osra_pdf.h
+//
+// Defines functions reading the parts of PDF documents that poppler C++ interface does not expose.
+//
+
+#include <set> // std::set
+#include <string> // std::string
+#include <utility> // std::pair
+#include <vector> // std::vector
+
+//
+// Section: Functions
+//
+
+// Function: find_pdf_page_image_sizes()
+//
+// Collects the sizes of the images every page of the PDF document may draw: the image XObjects of the page resources
+// (inherited ones included), and of the form XObjects found there. The objects are located by scanning the document,
+// including the compressed object streams, so that a damaged cross-reference table does not matter. Inline images
+// are not seen, and resources shared by several pages are reported for each of them.
+//
+// Parameters:
+//      image_data, image_length - the document in memory, or NULL if it is to be read from the file
+//      input_file - the document file name
+//      sizes - the widths and heights of the images of every page, in the page order (returned to the caller)
+//
+// Returns:
+//      false if the page tree cannot be read
+bool find_pdf_page_image_sizes(const char *image_data, int image_length, const std::string &input_file,
+                               std::vector<std::set<std::pair<int, int> > > &sizes);
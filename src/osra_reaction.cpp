@@ -25,82 +25,100 @@
 #include <openbabel/mol.h>
 #include <openbabel/obconversion.h>
 #include <openbabel/reaction.h>
-#include <openbabel/shared_ptr.h> // shared_ptr<T> in global namespace
 
 #include "osra_segment.h"
+#include "osra_structure.h"
+#include "osra_openbabel.h" // molecule_ptr_t
 #include "osra_reaction.h"
 #include "osra_common.h"
 
 using namespace OpenBabel;
 
-// openbabel/shared_ptr.h declares shared_ptr<T> in global namespace.
-// Here we encapsulate it into OpenBabel:: namespace, and use only fully specified
-// name OpenBabel::shared_ptr<T> in the code.
-namespace OpenBabel {
-  template<typename T> using shared_ptr = shared_ptr<T>;
+//
+// Copy a molecule of the page for a single reaction or agent SMILES. The molecules used to be parsed back from
+// their MDL text for every reaction, so each reaction gets its own copy, without the labels (confidence, page,
+// embedded format etc.) that get_formatted_structure() attaches to the molecule. Should be called in
+// "openbabel" critical section.
+//
+// Parameters:
+//      molecule - molecule of the page
+//
+// Returns:
+//      the copy of the molecule
+//
+static molecule_ptr_t copy_reaction_molecule(const molecule_ptr_t &molecule)
+{
+  molecule_ptr_t copy(new OBMol(*molecule));
+  copy->DeleteData(OBGenericDataType::PairData);
+  return copy;
 }
 
 //
 // Create a reaction representation for input vector of structures
 //
 // Parameters:
-//      page_of_structures - input vector of reactants, intermediates and products
+//      page_of_molecules - input vector of reactants, intermediates and products
 //      output_format - format of the returned result, i.e. rsmi or cmlr
 //
 // Returns:
 //      resulting reaction in the format set up by output_format parameter
 //
 std::string convert_page_to_reaction(
-    const std::vector<std::string> &page_of_structures, const std::string &output_format,
+    const std::vector<molecule_ptr_t> &page_of_molecules, const std::string &output_format,
     const std::vector<int> &reactants, const std::vector <int> &products,
     std::string value, bool reversible)
 {
   std::string reaction;
-  OBConversion *conv=new OBConversion;
-  conv->SetInAndOutFormats(SUBSTITUTE_REACTION_FORMAT,output_format.c_str());
   std::ostringstream strstr;
 
-  OBReaction react;
-  for (int j=0; j<reactants.size(); j++)
-    {
-      OpenBabel::shared_ptr<OBMol> reactant(new OBMol);
-      conv->ReadString(reactant.get(), page_of_structures[reactants[j]]);
-      react.AddReactant(reactant);
-    }
-  for (int j=0; j<products.size(); j++)
-    {
-      OpenBabel::shared_ptr<OBMol> product(new OBMol);
-      conv->ReadString(product.get(), page_of_structures[products[j]]);
-      react.AddProduct(product);
-    }
-  //	  react.AddAgent(transition);
-  if (reversible) react.SetReversible(true);
-
-  trim(value);
-  if (!value.empty())
-    {
-            OBPairData *label = new OBPairData;
-            label->SetAttribute("OSRA_REACTION_AGENT");
-            label->SetValue(value.c_str());
-            react.SetData(label);
-//      react.SetComment(value);
-      react.SetTitle(value);
-    }
-  strstr << conv->WriteString(&react, true);
+  // The pages are written out concurrently, and OpenBabel 2 is not thread-safe, see get_formatted_structure():
+  #pragma omp critical (openbabel)
+  {
+    OBConversion *conv=new OBConversion;
+    conv->SetOutFormat(output_format.c_str());
+
+    // The molecules are shared with the other reactions on the page, a product of one step being
+    // a reactant of the next one, so each reaction writes its own copies:
+    OBReaction react;
+    for (int j=0; j<reactants.size(); j++)
+      react.AddReactant(copy_reaction_molecule(page_of_molecules[reactants[j]]));
+    for (int j=0; j<products.size(); j++)
+      react.AddProduct(copy_reaction_molecule(page_of_molecules[products[j]]));
+    //	  react.AddAgent(transition);
+    if (reversible) react.SetReversible(true);
+
+    trim(value);
+    if (!value.empty())
+      {
+	OBPairData *label = new OBPairData;
+	label->SetAttribute("OSRA_REACTION_AGENT");
+	label->SetValue(value.c_str());
+	react.SetData(label);
+	//      react.SetComment(value);
+	react.SetTitle(value);
+      }
+    strstr << conv->WriteString(&react, true);
+    if (output_format != "rxn") // rxn format seems to have a double-free problem in OB 2.3.1
+      delete conv;
+  }
   reaction = strstr.str();
-  if (output_format != "rxn") // rxn format seems to have a double-free problem in OB 2.3.1
-   delete conv;
   return(reaction);
 }
 
-std::string convert_to_smiles_agent_structure(const std::string &structure)
+std::string convert_to_smiles_agent_structure(const molecule_ptr_t &molecule)
 {
-  OBConversion conv;
-  conv.SetInAndOutFormats(SUBSTITUTE_REACTION_FORMAT,"smi");
   std::string result;
-  OBMol mol;
-  if (conv.ReadString(&mol,structure))
-    result = conv.WriteString(&mol,true);
+  if (molecule)
+    {
+      // See convert_page_to_reaction():
+      #pragma omp critical (openbabel)
+      {
+	OBConversion conv;
+	conv.SetOutFormat("smi");
+	molecule_ptr_t copy = copy_reaction_molecule(molecule);
+	result = conv.WriteString(copy.get(),true);
+      }
+    }
   return result;
 }
 
@@ -318,7 +336,7 @@ void sort_boxes_from_arrows(std::vector<std::vector<int> > &before, const std::v
 
 void arrange_structures_between_arrows_before(
     std::vector<arrow_t> &arrows, std::vector<std::vector<int> > &before,
-    const std::vector<box_t> &page_of_boxes, const std::vector<std::string> &page_of_structures)
+    const std::vector<box_t> &page_of_boxes, const std::vector<molecule_ptr_t> &page_of_molecules)
 {
   for (int j=0; j<arrows.size(); j++)
     {
@@ -338,7 +356,7 @@ void arrange_structures_between_arrows_before(
 	  if (rx1>=0 && rx1<=l && rx2>=0 && rx2<=l && rx3>=0 && rx3<=l && rx4>=0 && rx4<=l &&
 	      cr < std::max(page_of_boxes[i].x2 - page_of_boxes[i].x1, page_of_boxes[i].y2 - page_of_boxes[i].y1))
 	    {
-              std::string smi = convert_to_smiles_agent_structure(page_of_structures[i]);
+              std::string smi = convert_to_smiles_agent_structure(page_of_molecules[i]);
               if (!smi.empty())
                   arrows[j].agent += " OSRA_AGENT_SMILES="+smi;
 	    }
@@ -356,7 +374,7 @@ void arrange_structures_between_arrows_before(
 
 void arrange_structures_between_arrows_after(
     std::vector<arrow_t> &arrows, std::vector<std::vector<int> > &after, const std::vector<std::vector<int> > &before,
-    const std::vector<box_t> &page_of_boxes, const std::vector<std::string> &page_of_structures)
+    const std::vector<box_t> &page_of_boxes, const std::vector<molecule_ptr_t> &page_of_molecules)
 {
   for (int j=0; j<arrows.size(); j++)
     {
@@ -457,7 +475,7 @@ void arrange_plus_sings_between_boxes(const std::vector<std::vector<int> > &befo
 
 void arrange_reactions(std::vector<arrow_t> &arrows, const std::vector<box_t> &page_of_boxes, const std::vector<plus_t> &pluses,
                        std::vector<std::string> &results, std::vector<box_t> &rbox,
-		       const std::vector<std::string> &page_of_structures, const std::string &output_format)
+		       const std::vector<molecule_ptr_t> &page_of_molecules, const std::string &output_format)
 {
   std::vector<std::vector<int> > before;
   std::vector<std::vector<int> > after;
@@ -524,9 +542,9 @@ void arrange_reactions(std::vector<arrow_t> &arrows, const std::vector<box_t> &p
     {
       // arrange structures to best fit between arrows
       std::vector<std::vector<int> > before_group(arrow_groups[i].size());
-      arrange_structures_between_arrows_before(arrow_groups[i],before_group,page_of_boxes,page_of_structures);
+      arrange_structures_between_arrows_before(arrow_groups[i],before_group,page_of_boxes,page_of_molecules);
       std::vector<std::vector<int> > after_group(arrow_groups[i].size());
-      arrange_structures_between_arrows_after(arrow_groups[i],after_group,before_group,page_of_boxes,page_of_structures);
+      arrange_structures_between_arrows_after(arrow_groups[i],after_group,before_group,page_of_boxes,page_of_molecules);
 
 
       sort_boxes_from_arrows(before_group,after_group,page_of_boxes,true);
@@ -684,7 +702,7 @@ void arrange_reactions(std::vector<arrow_t> &arrows, const std::vector<box_t> &p
       if (!r.empty() && !p.empty())
 	{
           std::string result = convert_page_to_reaction(
-              page_of_structures,output_format, r, p, arrows[i].agent, arrows[i].reversible);
+              page_of_molecules,output_format, r, p, arrows[i].agent, arrows[i].reversible);
 	  trim(result);
 	  if (!result.empty())
 	    {
@@ -38,12 +38,13 @@
 //      page_of_boxes - a vector of box_t objects representing bounding boxes of molecules
 //      pluses - a vector of plus sing centers
 //      results - a vector of strings to represent output results
-//      page_of_structures - input vector of reactants, intermediates and products
+//      page_of_molecules - input vector of reactants, intermediates and products, as built by
+//                          <get_formatted_structure()>
 //      output_format - format of the returned result, i.e. rsmi or cmlr
 //
 
 
 void arrange_reactions(std::vector<arrow_t> &arrows, const std::vector<box_t> &page_of_boxes,
                        const std::vector<plus_t> &pluses, std::vector<std::string> &results,
-                       std::vector<box_t> &rbox, const std::vector<std::string> &page_of_structures,
+                       std::vector<box_t> &rbox, const std::vector<molecule_ptr_t> &page_of_molecules,
                        const std::string &output_format);
@@ -75,91 +75,153 @@ unsigned int distance_between_segments(const std::vector<point_t> &s1, const std
   return r;
 }
 
-void find_connected_components(const Image &image, double threshold, const ColorGray &bgColor,
-                               std::vector<std::list<point_t> > &segments,
+void find_connected_components(const bitmap_t &bitmap, std::vector<std::list<point_t> > &segments,
                                std::vector<std::vector<point_t> > &margins, bool adaptive)
 {
-  point_t p;
-  std::list<point_t> points;
+  const int width = bitmap.width;
+  const int height = bitmap.height;
   int speckle_area = 2;
   if (adaptive)
     {
-      int speckle_side = std::min(image.columns(), image.rows()) / 200;
+      int speckle_side = std::min(width, height) / 200;
       speckle_area = speckle_side * speckle_side;
       if (speckle_area < 2) speckle_area = 2;
     }
 
-  std::vector<std::vector<int> > tmp(image.columns(), std::vector<int> (image.rows(), 0));
+  if (width == 0 || height == 0)
+    return;
 
-  for (unsigned int i = 0; i < image.columns(); i++)
-    for (unsigned int j = 0; j < image.rows(); j++)
-      if (get_pixel(image, bgColor, i, j, threshold) == 1) // populate with low threshold for future anisotropic smoothing
-        tmp[i][j] = 1;
+  // Components are labelled column by column, as this is the order in which they have always been discovered
+  // (by the leftmost, then topmost pixel). The bitmap (populated with low threshold for future anisotropic smoothing)
+  // is transposed for that, so that each column is contiguous:
+  std::vector<unsigned char> column_major(width * height);
+  for (int y = 0; y < height; y++)
+    {
+      const unsigned char *row = &bitmap.pixels[y * width];
+      for (int x = 0; x < width; x++)
+        column_major[x * height + y] = row[x] ? 1 : 0;
+    }
 
+  // Vertical runs of set pixels: runs of column "x" are [column_runs[x], column_runs[x + 1]), top to bottom.
+  std::vector<int> run_top, run_bottom, parent;
+  std::vector<int> column_runs(width + 1, 0);
+  for (int x = 0; x < width; x++)
+    {
+      column_runs[x] = run_top.size();
+      const unsigned char *column = &column_major[x * height];
+      int y = 0;
+      while (y < height)
+        {
+          while (y < height && column[y] == 0)
+            y++;
+          if (y == height)
+            break;
+          int top = y;
+          while (y < height && column[y] != 0)
+            y++;
+          run_top.push_back(top);
+          run_bottom.push_back(y - 1);
+          parent.push_back(parent.size());
+        }
+    }
+  column_runs[width] = run_top.size();
 
-  for (unsigned int i = 0; i < image.columns(); i++)
-    for (unsigned int j = 0; j < image.rows(); j++)
-      if (tmp[i][j] == 1)
+  // Join each run with the 8-connected runs of the previous column. The smaller index always becomes the root,
+  // so the root of a component is its first run, the one holding the pixel the component was discovered by:
+  for (int x = 1; x < width; x++)
+    {
+      int q_begin = column_runs[x - 1];
+      const int q_end = column_runs[x];
+      for (int r = column_runs[x]; r < column_runs[x + 1]; r++)
         {
-          tmp[i][j] = 2;
-          p.x = i;
-          p.y = j;
-          points.push_back(p);
-          std::list<point_t> new_segment;
-          std::vector<point_t> new_margin;
-          int counter = 0;
-          point_t p1;
-          while (!points.empty())
+          while (q_begin < q_end && run_bottom[q_begin] < run_top[r] - 1)
+            q_begin++;
+          for (int q = q_begin; q < q_end && run_top[q] <= run_bottom[r] + 1; q++)
             {
-              p = points.back();
-              points.pop_back();
-              new_segment.push_back(p);
-              tmp[p.x][p.y] = -1;
-              bool on_the_margin = false;
-
-              // "k" should be in range "[0 .. image.columns) intercepted with [p.x - 1 .. p.x + 2)" ==> "p.x + 2" should be positive ==> "p.x >= -1"
-              // "l" should be in range "[0 .. image.rows)    intercepted with [p.y - 1 .. p.y + 2)" ==> "p.y + 2" should be positive ==> "p.y >= -1"
-              if (p.x >= -1 && p.y >= -1)
+              int a = find_root(parent, q);
+              int b = find_root(parent, r);
+              if (a < b)
+                parent[b] = a;
+              else if (b < a)
+                parent[a] = b;
+            }
+        }
+    }
+
+  std::vector<int> area(parent.size(), 0);
+  for (unsigned int r = 0; r < parent.size(); r++)
+    {
+      parent[r] = find_root(parent, r);
+      area[parent[r]] += run_bottom[r] - run_top[r] + 1;
+    }
+
+  // Components are taken in the discovery order; speckles are dropped and the search stops after MAX_SEGMENTS
+  // segments are exceeded, as before:
+  std::vector<int> segment_index(parent.size(), -1);
+  unsigned int n_segments = 0;
+  for (unsigned int r = 0; r < parent.size(); r++)
+    if (parent[r] == (int) r)
+      {
+        if (n_segments > MAX_SEGMENTS)
+          break;
+        if (area[r] > speckle_area)
+          segment_index[r] = n_segments++;
+      }
+
+  // The kept segments are walked the way the flood fill has always walked them, depth first from the discovery pixel
+  // with the neighbours stacked column by column, so that the pixels and the margin samples come in the same order.
+  // Pixels already stacked are marked with 2, visited ones with 3; background pixels stay 0.
+  const unsigned int first_segment = segments.size();
+  segments.resize(first_segment + n_segments);
+  margins.resize(first_segment + n_segments);
+  std::vector<point_t> points;
+
+  for (int x = 0; x < width; x++)
+    for (int r = column_runs[x]; r < column_runs[x + 1]; r++)
+      {
+        if (parent[r] != r || segment_index[r] < 0)
+          continue;
+
+        std::list<point_t> &new_segment = segments[first_segment + segment_index[r]];
+        std::vector<point_t> &new_margin = margins[first_segment + segment_index[r]];
+        int counter = 0;
+
+        points.push_back(point_t(x, run_top[r]));
+        column_major[x * height + run_top[r]] = 2;
+        while (!points.empty())
+          {
+            const point_t p = points.back();
+            points.pop_back();
+            new_segment.push_back(p);
+            column_major[p.x * height + p.y] = 3;
+            bool on_the_margin = false;
+
+            const int x_lower = std::max(p.x - 1, 0);
+            const int x_upper = std::min(p.x + 2, width);
+            const int y_lower = std::max(p.y - 1, 0);
+            const int y_upper = std::min(p.y + 2, height);
+            for (int k = x_lower; k < x_upper; k++)
+              for (int l = y_lower; l < y_upper; l++)
                 {
-                  unsigned int x_lower = p.x > 1 ? p.x - 1 : 0; // "k" cannot be less then zero
-                  unsigned int y_lower = p.y > 1 ? p.y - 1 : 0; // "l" cannot be less then zero
-                  unsigned int x_upper = p.x + 2;
-                  if (x_upper > image.columns())
-                    x_upper = image.columns();
-                  unsigned int y_upper = p.y + 2;
-                  if (y_upper > image.rows())
-                    y_upper = image.rows();
-
-                  for (int k = x_lower; k < x_upper; k++)
-                    for (int l = y_lower; l < y_upper; l++)
-                      {
-                        if (tmp[k][l] == 1)
-                          {
-                            p1.x = k;
-                            p1.y = l;
-                            points.push_back(p1);
-                            tmp[k][l] = 2;
-                          }
-                        else if ((int) k != p.x && (int) l != p.y && tmp[k][l] == 0)
-                          {
-                            on_the_margin = true;
-                          }
-                      }
+                  unsigned char &pixel = column_major[k * height + l];
+                  if (pixel == 1)
+                    {
+                      points.push_back(point_t(k, l));
+                      pixel = 2;
+                    }
+                  // The pixel is on the margin if any of its diagonal neighbours is background:
+                  else if (k != p.x && l != p.y && pixel == 0)
+                    {
+                      on_the_margin = true;
+                    }
                 }
 
-              if (on_the_margin && (new_margin.size() < PARTS_IN_MARGIN || (counter % PARTS_IN_MARGIN) == 0))
-                new_margin.push_back(p);
-              if (on_the_margin)
-                counter++;
-            }
-          if (segments.size() > MAX_SEGMENTS)
-            return;
-          if (new_segment.size() > speckle_area)
-            {
-              segments.push_back(new_segment);
-              margins.push_back(new_margin);
-            }
-        }
+            if (on_the_margin && (new_margin.size() < PARTS_IN_MARGIN || (counter % PARTS_IN_MARGIN) == 0))
+              new_margin.push_back(p);
+            if (on_the_margin)
+              counter++;
+          }
+      }
 }
 
 unsigned int area_ratio(unsigned int a, unsigned int b)
@@ -168,33 +230,102 @@ unsigned int area_ratio(unsigned int a, unsigned int b)
   return (unsigned int) r;
 }
 
-void build_distance_matrix(const std::vector<std::vector<point_t> > &margins, unsigned int max_dist,
-                           std::vector<std::vector<int> > &distance_matrix,
+bool comp_neighbors(const neighbor_t &a, const neighbor_t &b)
+{
+  return a.segment < b.segment;
+}
+
+void build_segment_neighbors(const std::vector<std::vector<point_t> > &margins, unsigned int max_dist,
+                           std::vector<std::vector<neighbor_t> > &neighbors,
                            std::vector<std::vector<int> > &features,
                            const std::vector<std::list<point_t> > &segments,
-                           unsigned int max_area_ratio, std::vector<std::vector<int> > &area_matrix)
+                           unsigned int max_area_ratio)
 {
   unsigned int d;
   unsigned int ar;
 
-  for (unsigned int s1 = 0; s1 < margins.size(); s1++)
-    for (unsigned int s2 = s1 + 1; s2 < margins.size(); s2++)
-      if (distance_between_points(margins[s1].front(), margins[s2].front()) < (PARTS_IN_MARGIN
-          * margins[s1].size() + PARTS_IN_MARGIN * margins[s2].size()) / 2 + max_dist)
+  neighbors.assign(margins.size(), std::vector<neighbor_t>());
+
+  // Bounding boxes of the margins. The distance between two margins can't be less than the distance between their boxes:
+  std::vector<box_t> bounds(margins.size());
+  int max_x = 0, max_y = 0;
+  for (unsigned int s = 0; s < margins.size(); s++)
+    {
+      bounds[s].x1 = INT_MAX;
+      bounds[s].y1 = INT_MAX;
+      bounds[s].x2 = 0;
+      bounds[s].y2 = 0;
+      for (std::vector<point_t>::const_iterator p = margins[s].begin(); p != margins[s].end(); p++)
         {
-          d = distance_between_segments(margins[s1], margins[s2]);
-          if (d < max_dist)
+          bounds[s].x1 = std::min(bounds[s].x1, p->x);
+          bounds[s].y1 = std::min(bounds[s].y1, p->y);
+          bounds[s].x2 = std::max(bounds[s].x2, p->x);
+          bounds[s].y2 = std::max(bounds[s].y2, p->y);
+        }
+      max_x = std::max(max_x, bounds[s].x2);
+      max_y = std::max(max_y, bounds[s].y2);
+    }
+
+  // Spatial grid with max_dist cells: each segment is registered in all cells its box covers, so only the segments
+  // registered in the cells within max_dist from the box of a segment can be its neighbors:
+  const int cell = std::max(max_dist, 1u);
+  const int grid_width = max_x / cell + 1;
+  const int grid_height = max_y / cell + 1;
+  std::vector<std::vector<int> > grid(grid_width * grid_height);
+  for (unsigned int s = 0; s < margins.size(); s++)
+    if (!margins[s].empty())
+      for (int gy = bounds[s].y1 / cell; gy <= bounds[s].y2 / cell; gy++)
+        for (int gx = bounds[s].x1 / cell; gx <= bounds[s].x2 / cell; gx++)
+          grid[gy * grid_width + gx].push_back(s);
+
+  // Segment for which the candidate was already seen, to test every pair once:
+  std::vector<int> seen(margins.size(), -1);
+
+  for (unsigned int s1 = 0; s1 < margins.size(); s1++)
+    if (!margins[s1].empty())
+      {
+        const int gx1 = std::max(bounds[s1].x1 - cell, 0) / cell;
+        const int gy1 = std::max(bounds[s1].y1 - cell, 0) / cell;
+        const int gx2 = std::min((bounds[s1].x2 + cell) / cell, grid_width - 1);
+        const int gy2 = std::min((bounds[s1].y2 + cell) / cell, grid_height - 1);
+
+        for (int gy = gy1; gy <= gy2; gy++)
+          for (int gx = gx1; gx <= gx2; gx++)
             {
-              distance_matrix[s1][s2] = d;
-              distance_matrix[s2][s1] = d;
-              ar = area_ratio(segments[s1].size(), segments[s2].size());
-              //cout << ar << endl;
-              area_matrix[s1][s2] = ar;
-              area_matrix[s2][s1] = ar;
-              if (ar < max_area_ratio && d < max_dist)
-                features[ar][d]++;
+              const std::vector<int> &candidates = grid[gy * grid_width + gx];
+              for (std::vector<int>::const_iterator c = candidates.begin(); c != candidates.end(); c++)
+                {
+                  const unsigned int s2 = *c;
+                  if (s2 <= s1 || seen[s2] == (int) s1)
+                    continue;
+                  seen[s2] = s1;
+
+                  const int box_distance = std::max(std::max(bounds[s1].x1 - bounds[s2].x2, bounds[s2].x1 - bounds[s1].x2),
+                                                    std::max(bounds[s1].y1 - bounds[s2].y2, bounds[s2].y1 - bounds[s1].y2));
+                  if (box_distance >= (int) max_dist)
+                    continue;
+
+                  if (distance_between_points(margins[s1].front(), margins[s2].front()) < (PARTS_IN_MARGIN
+                      * margins[s1].size() + PARTS_IN_MARGIN * margins[s2].size()) / 2 + max_dist)
+                    {
+                      d = distance_between_segments(margins[s1], margins[s2]);
+                      if (d < max_dist)
+                        {
+                          ar = area_ratio(segments[s1].size(), segments[s2].size());
+                          //cout << ar << endl;
+                          neighbors[s1].push_back(neighbor_t(s2, d, ar));
+                          neighbors[s2].push_back(neighbor_t(s1, d, ar));
+                          if (ar < max_area_ratio && d < max_dist)
+                            features[ar][d]++;
+                        }
+                    }
+                }
             }
-        }
+      }
+
+  // Neighbors are kept in the order of segment indices, the order in which the dense matrix used to be scanned:
+  for (unsigned int s = 0; s < neighbors.size(); s++)
+    std::sort(neighbors[s].begin(), neighbors[s].end(), comp_neighbors);
 }
 
 std::list<std::list<std::list<point_t> > > build_explicit_clusters(
@@ -543,33 +674,40 @@ void remove_tables(std::vector<std::list<point_t> > &segments, std::vector<std::
 
 std::list<std::list<int> > assemble_clusters(
     const std::vector<std::vector<point_t> > &margins, int dist,
-    const std::vector<std::vector<int> > &distance_matrix, std::vector<int> &avail, bool text,
-    const std::vector<std::vector<int> > &area_matrix)
+    const std::vector<std::vector<neighbor_t> > &neighbors, std::vector<int> &avail, bool text)
 {
   std::list<std::list<int> > clusters;
-  std::list<int> bag;
+  std::vector<int> parent(margins.size());
+
+  for (unsigned int s = 0; s < margins.size(); s++)
+    parent[s] = s;
 
+  // Each near pair of available segments is joined once. The smaller index always becomes the root,
+  // so the root of a cluster is its first segment:
   for (unsigned int s = 0; s < margins.size(); s++)
     if (avail[s] == 1)
-      {
-        bag.push_back(s);
-        avail[s] = 2;
-        std::list<int> new_cluster;
-        while (!bag.empty())
+      for (std::vector<neighbor_t>::const_iterator n = neighbors[s].begin(); n != neighbors[s].end(); n++)
+        if (n->segment > (int) s && avail[n->segment] == 1 && n->distance < dist)
+          // && (!text || n->area_ratio <= 10))
           {
-            int c = bag.back();
-            bag.pop_back();
-            new_cluster.push_back(c);
-            avail[c] = 0;
-            for (unsigned int i = 0; i < margins.size(); i++)
-              if (avail[i] == 1 && distance_matrix[c][i] < dist)
-                // && (!text || area_matrix[i][c] <= 10))
-                {
-                  bag.push_back(i);
-                  avail[i] = 2;
-                }
+            int a = find_root(parent, s);
+            int b = find_root(parent, n->segment);
+            if (a < b)
+              parent[b] = a;
+            else if (b < a)
+              parent[a] = b;
           }
-        clusters.push_back(new_cluster);
+
+  // Clusters go in the order of their first segment, segments within a cluster are in ascending order:
+  std::vector<std::list<std::list<int> >::iterator> cluster_of(margins.size(), clusters.end());
+  for (unsigned int s = 0; s < margins.size(); s++)
+    if (avail[s] == 1)
+      {
+        int r = find_root(parent, s);
+        if (r == (int) s)
+          cluster_of[s] = clusters.insert(clusters.end(), std::list<int>());
+        cluster_of[r]->push_back(s);
+        avail[s] = 0;
       }
 
   return (clusters);
@@ -874,8 +1012,7 @@ int comp_labels_int(const void *l, const void *r)
   return (1);
 }
 
-std::string ocr_agent_strings(const std::vector<std::list<point_t> > &agents, const Image &image,
-                              double threshold, const ColorGray &bgColor, bool verbose)
+std::string ocr_agent_strings(const std::vector<std::list<point_t> > &agents, const bitmap_t &bitmap, bool verbose)
 {
   std::string agent_string;
   std::vector<letters_t> letters;
@@ -895,7 +1032,7 @@ std::string ocr_agent_strings(const std::vector<std::list<point_t> > &agents, co
       if ((bottom - top) <= 2*MAX_FONT_HEIGHT && (right - left) <= 2*MAX_FONT_WIDTH && (bottom - top) > MIN_FONT_HEIGHT)
             {
               char label = 0;
-              label = get_atom_label(image, bgColor, left, top, right, bottom, threshold, (right + left) / 2, top, true, verbose);
+              label = get_atom_label(bitmap, left, top, right, bottom, (right + left) / 2, top, true, verbose);
               if (label != 0)
                 {
                   letters_t lt;
@@ -928,7 +1065,7 @@ std::string ocr_agent_strings(const std::vector<std::list<point_t> > &agents, co
 
 void find_agent_strings(std::vector<std::vector<point_t> > &margins,
                         std::vector<std::list<point_t> > &segments, std::vector<arrow_t> &arrows,
-			const Image &image, double threshold, const ColorGray &bgColor, bool verbose)
+			const bitmap_t &bitmap, bool verbose)
 {
   for (int i=0; i<arrows.size(); i++)
     {
@@ -992,7 +1129,7 @@ void find_agent_strings(std::vector<std::vector<point_t> > &margins,
 		}
 	    }
 	}
-      arrows[i].agent=ocr_agent_strings(agents,image,threshold,bgColor,verbose);
+      arrows[i].agent=ocr_agent_strings(agents,bitmap,verbose);
     }
 }
 
@@ -1006,7 +1143,10 @@ std::list<std::list<std::list<point_t> > > find_segments(
 
   // 1m34s
 
-  find_connected_components(image, threshold, bgColor, segments, margins, adaptive);
+  bitmap_t bitmap;
+  binarize_image(image, bgColor, threshold, bitmap);
+
+  find_connected_components(bitmap, segments, margins, adaptive);
 
   if (verbose)
     std::cout << "Number of segments: " << segments.size() << '.' << std::endl;
@@ -1019,7 +1159,7 @@ std::list<std::list<std::list<point_t> > > find_segments(
   if (is_reaction)
     {
       find_arrows_pluses(margins,segments,arrows, pluses);
-      find_agent_strings(margins,segments,arrows,image,threshold,bgColor,verbose);
+      find_agent_strings(margins,segments,arrows,bitmap,verbose);
     }
 
   remove_separators(segments, margins, SEPARATOR_ASPECT, SEPARATOR_AREA);
@@ -1030,11 +1170,11 @@ std::list<std::list<std::list<point_t> > > find_segments(
 
   unsigned int max_dist = MAX_DIST;
   unsigned int max_area_ratio = MAX_AREA_RATIO;
-  std::vector<std::vector<int> > distance_matrix(segments.size(), std::vector<int> (segments.size(), INT_MAX));
-  std::vector<std::vector<int> > area_matrix(segments.size(), std::vector<int> (segments.size(), INT_MAX));
+  // Only the pairs of segments closer than max_dist are kept, other pairs are too far apart to be clustered together:
+  std::vector<std::vector<neighbor_t> > neighbors;
   std::vector<std::vector<int> > features(max_area_ratio, std::vector<int> (max_dist, 0));
 
-  build_distance_matrix(margins, max_dist, distance_matrix, features, segments, max_area_ratio, area_matrix);
+  build_segment_neighbors(margins, max_dist, neighbors, features, segments, max_area_ratio);
 
   // 2m53s
 
@@ -1070,7 +1210,7 @@ std::list<std::list<std::list<point_t> > > find_segments(
       int dist_text = locate_first_min(text_stats);
 
       const std::list<std::list<int> > &text_blocks = assemble_clusters(
-          margins, dist_text, distance_matrix, avail, true, area_matrix);
+          margins, dist_text, neighbors, avail, true);
       remove_text_blocks(text_blocks, segments, avail);
 
       dist = 2 * dist_text;
@@ -1081,7 +1221,7 @@ std::list<std::list<std::list<point_t> > > find_segments(
       avail[i] = 1;
 
   const std::list<std::list<int> > &clusters = assemble_clusters(
-      margins, dist, distance_matrix, avail, false, area_matrix);
+      margins, dist, neighbors, avail, false);
 
   explicit_clusters = build_explicit_clusters(clusters, segments);
   return explicit_clusters;
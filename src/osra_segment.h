@@ -84,6 +84,25 @@ arrow_s(point_t _head, point_t _tail,int _min_x,int _min_y,int _max_x,int _max_y
 // defines arrow_t type based on arrow_s struct
 typedef struct arrow_s arrow_t;
 
+// struct: neighbor_s
+//      a segment lying close to another one, entry of the sparse segment adjacency lists built in <find_segments()>
+struct neighbor_s
+{
+neighbor_s(int s, int d, int ar) : segment(s), distance(d), area_ratio(ar) {}
+  // int: segment
+  //    index of the neighboring segment
+  int segment;
+  // int: distance
+  //    distance between the margins of the two segments, less than MAX_DIST
+  int distance;
+  // int: area_ratio
+  //    ratio of the larger segment area to the smaller one
+  int area_ratio;
+};
+// typedef: neighbor_t
+//      defines neighbor_t type based on neighbor_s struct
+typedef struct neighbor_s neighbor_t;
+
 struct plus_s
 {
   point_t center;
@@ -0,0 +1,697 @@
+/******************************************************************************
+ OSRA: Optical Structure Recognition Application
+
+ Created by Igor Filippov, 2007-2013 (igor.v.filippov@gmail.com)
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along with
+ this program; if not, write to the Free Software Foundation, Inc., 51 Franklin
+ St, Fifth Floor, Boston, MA 02110-1301, USA
+ *****************************************************************************/
+
+// File: osra_server.cpp
+//
+// Recognition server: keeps the recognition context loaded and serves the requests coming over
+// a Unix domain socket or a localhost TCP port.
+//
+// Every connection carries any number of requests. A request is a header line followed by the image:
+//
+//      <image length> [<option>=<value> ...]\n
+//      <image bytes>
+//
+// The options are named after the long options of osra CLI: format, embedded-format, rotate, negate,
+// resolution, threshold, unpaper, jaggy, adaptive, print, guess, page, coordinates, bond, learn,
+// early-exit, threads, stream, pdf-region. Switches take 1/0 values.
+//
+// The response is the recognized structures in chunks, which are sent as soon as they are ready
+// (e.g. page by page with stream=1), followed by the status line:
+//
+//      <chunk length>\n<chunk bytes>
+//      ...
+//      0\n
+//      OK\n or ERR <error code>\n
+//
+// A worker is taken by a connection only for the time of a request. Between the requests the connection is watched
+// by the main thread, and it is closed if no request comes within the timeout; a request stalled for that long
+// is dropped as well.
+
+#include <stdlib.h> // atoi(), atof(), strtol()
+#include <string.h> // strncpy(), memset()
+#include <errno.h> // errno, EINTR
+#include <signal.h> // signal(), SIGPIPE
+#include <time.h> // time()
+#include <unistd.h> // read(), write(), close(), unlink(), pipe()
+#include <poll.h> // poll()
+#include <libgen.h> // dirname()
+#include <pthread.h> // pthread_create(), pthread_mutex_*(), pthread_cond_*()
+#include <sys/socket.h> // socket(), bind(), listen(), accept(), send(), setsockopt()
+#include <sys/time.h> // timeval
+#include <sys/un.h> // sockaddr_un
+#include <netinet/in.h> // sockaddr_in, INADDR_LOOPBACK
+#include <arpa/inet.h> // htons(), htonl()
+
+#include <string> // std::string
+#include <vector> // std::vector
+#include <deque> // std::deque
+#include <algorithm> // std::min(), std::max()
+#include <streambuf> // std::streambuf
+#include <ostream> // std::ostream
+#include <sstream> // std::istringstream, std::ostringstream
+#include <iostream> // std::cerr
+
+#include <tclap/CmdLine.h>
+
+#include "osra.h" // ERROR_*
+#include "osra_lib.h"
+#include "config.h" // PACKAGE_VERSION
+
+// Largest request header line accepted
+#define MAX_HEADER_LENGTH 4096
+
+// struct: connection_s
+//      Client connection
+struct connection_s
+{
+  int fd;
+  // bytes read from the socket ahead of the current request
+  std::string pending;
+  // time of the end of the last request, for the idle timeout
+  time_t last_active;
+};
+// Typedef: connection_t
+//      defines connection_t type based on connection_s struct
+typedef struct connection_s connection_t;
+
+// struct: connection_queue_s
+//      Connections with a request waiting for a worker, and the idle ones watched by the main thread. The queue is
+//      bounded: when it is full, no more connections are accepted or taken from the idle ones, so the clients
+//      are held back by the socket backlog.
+struct connection_queue_s
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  std::deque<connection_t *> connections;
+  std::vector<connection_t *> idle;
+  unsigned int capacity;
+  // pipe waking up the main thread when a connection becomes idle or the queue gets room
+  int wakeup[2];
+};
+// Typedef: connection_queue_t
+//      defines connection_queue_t type based on connection_queue_s struct
+typedef struct connection_queue_s connection_queue_t;
+
+// struct: server_s
+//      State shared by all workers
+struct server_s
+{
+  const osra_context_t *context;
+  osra_options_t default_options;
+  connection_queue_t queue;
+  int max_image_length;
+  int timeout;
+};
+// Typedef: server_t
+//      defines server_t type based on server_s struct
+typedef struct server_s server_t;
+
+// Function: write_fully()
+//
+// Writes the whole buffer to the socket.
+//
+// Returns:
+//      false, if the connection is broken
+bool write_fully(int fd, const char *data, size_t length)
+{
+  while (length > 0)
+    {
+      ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      length -= n;
+    }
+  return true;
+}
+
+// Function: read_fully()
+//
+// Reads exactly the given number of bytes from the socket.
+//
+// Returns:
+//      false, if the connection is closed or broken before that
+bool read_fully(int fd, char *data, size_t length)
+{
+  while (length > 0)
+    {
+      ssize_t n = read(fd, data, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      length -= n;
+    }
+  return true;
+}
+
+// Function: read_line()
+//
+// Reads a line terminated by '\n' from the connection (the terminator is not stored). The socket is read in blocks,
+// the bytes past the line are kept for the following reads.
+//
+// Returns:
+//      false, if the connection is closed, the read times out or the line is too long
+bool read_line(connection_t *connection, std::string &line)
+{
+  size_t eol;
+  while ((eol = connection->pending.find('\n')) == std::string::npos)
+    {
+      if (connection->pending.length() > MAX_HEADER_LENGTH)
+        return false;
+      char block[MAX_HEADER_LENGTH];
+      ssize_t n = read(connection->fd, block, sizeof(block));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      connection->pending.append(block, n);
+    }
+  if (eol > MAX_HEADER_LENGTH)
+    return false;
+  line = connection->pending.substr(0, eol);
+  connection->pending.erase(0, eol + 1);
+  return true;
+}
+
+// Function: read_request_data()
+//
+// Reads exactly the given number of bytes from the connection, starting with the ones already read ahead.
+//
+// Returns:
+//      false, if the connection is closed, broken or the read times out before that
+bool read_request_data(connection_t *connection, char *data, size_t length)
+{
+  size_t ahead = std::min(length, connection->pending.length());
+  connection->pending.copy(data, ahead);
+  connection->pending.erase(0, ahead);
+  return read_fully(connection->fd, data + ahead, length - ahead);
+}
+
+// class: chunked_socket_buf
+//      Stream buffer sending everything written into it as chunks of the response. A chunk is sent on
+//      every flush of the stream or when the buffer gets full.
+class chunked_socket_buf : public std::streambuf
+{
+public:
+  chunked_socket_buf(int fd) : fd_(fd), failed_(false), buffer_(64 * 1024)
+  {
+    setp(&buffer_[0], &buffer_[0] + buffer_.size());
+  }
+
+  // Function: failed()
+  //
+  // Returns:
+  //      true, if the connection was broken while sending
+  bool failed() const
+  {
+    return failed_;
+  }
+
+protected:
+  virtual int_type overflow(int_type c)
+  {
+    if (send_chunk() != 0)
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+      {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+      }
+    return traits_type::not_eof(c);
+  }
+
+  virtual int sync()
+  {
+    return send_chunk();
+  }
+
+private:
+  int send_chunk()
+  {
+    size_t length = pptr() - pbase();
+    if (length > 0 && !failed_)
+      {
+        std::ostringstream header;
+        header << length << '\n';
+        failed_ = !write_fully(fd_, header.str().c_str(), header.str().length()) || !write_fully(fd_, pbase(), length);
+      }
+    setp(&buffer_[0], &buffer_[0] + buffer_.size());
+    return failed_ ? -1 : 0;
+  }
+
+  int fd_;
+  bool failed_;
+  std::vector<char> buffer_;
+};
+
+// Function: parse_bool()
+//
+// Parses the value of a switch option.
+bool parse_bool(const std::string &value, bool &result)
+{
+  if (value == "1" || value == "true" || value == "yes")
+    result = true;
+  else if (value == "0" || value == "false" || value == "no")
+    result = false;
+  else
+    return false;
+  return true;
+}
+
+// Function: parse_request_header()
+//
+// Parses the request header line into the image length and the options (on top of the server defaults).
+//
+// Returns:
+//      false, if the header is malformed or has unknown options
+bool parse_request_header(const std::string &header, int &image_length, osra_options_t &options)
+{
+  std::istringstream fields(header);
+  if (!(fields >> image_length) || image_length <= 0)
+    return false;
+
+  std::string field;
+  while (fields >> field)
+    {
+      size_t eq = field.find('=');
+      if (eq == std::string::npos)
+        return false;
+      std::string key = field.substr(0, eq);
+      std::string value = field.substr(eq + 1);
+      bool ok = true;
+
+      if (key == "format")
+        options.output_format = value;
+      else if (key == "embedded-format")
+        options.embedded_format = value;
+      else if (key == "rotate")
+        options.rotate = atoi(value.c_str());
+      else if (key == "resolution")
+        options.input_resolution = atoi(value.c_str());
+      else if (key == "threshold")
+        options.threshold = atof(value.c_str());
+      else if (key == "unpaper")
+        options.do_unpaper = atoi(value.c_str());
+      else if (key == "early-exit")
+        options.early_exit_confidence = atof(value.c_str());
+      else if (key == "threads")
+        options.num_threads = atoi(value.c_str());
+      else if (key == "negate")
+        ok = parse_bool(value, options.invert);
+      else if (key == "jaggy")
+        ok = parse_bool(value, options.jaggy);
+      else if (key == "adaptive")
+        ok = parse_bool(value, options.adaptive);
+      else if (key == "print")
+        ok = parse_bool(value, options.show_confidence);
+      else if (key == "guess")
+        ok = parse_bool(value, options.show_resolution_guess);
+      else if (key == "page")
+        ok = parse_bool(value, options.show_page);
+      else if (key == "coordinates")
+        ok = parse_bool(value, options.show_coordinates);
+      else if (key == "bond")
+        ok = parse_bool(value, options.show_avg_bond_length);
+      else if (key == "learn")
+        ok = parse_bool(value, options.show_learning);
+      else if (key == "stream")
+        ok = parse_bool(value, options.stream_pages);
+      else if (key == "pdf-region")
+        ok = parse_bool(value, options.pdf_region);
+      else
+        ok = false;
+
+      if (!ok)
+        return false;
+    }
+  return true;
+}
+
+// Function: serve_request()
+//
+// Processes a single request coming over the connection.
+//
+// Returns:
+//      true, if the connection can take more requests
+bool serve_request(server_t *server, connection_t *connection)
+{
+  int fd = connection->fd;
+  std::string header;
+  if (!read_line(connection, header))
+    return false;
+
+  int image_length = 0;
+  osra_options_t options = server->default_options;
+  if (!parse_request_header(header, image_length, options) || image_length <= 0
+      || image_length > server->max_image_length)
+    {
+      std::ostringstream status;
+      status << "0\nERR " << ERROR_ILLEGAL_ARGUMENT_COMBINATION << '\n';
+      write_fully(fd, status.str().c_str(), status.str().length());
+      // The image bytes cannot be skipped reliably after a malformed header:
+      return false;
+    }
+
+  std::vector<char> image(image_length);
+  if (!read_request_data(connection, &image[0], image_length))
+    return false;
+
+  chunked_socket_buf buf(fd);
+  std::ostream structure_output_stream(&buf);
+  int result;
+  try
+    {
+      result = osra_process_image(server->context, &image[0], image_length, structure_output_stream, options);
+    }
+  catch (...)
+    {
+      result = ERROR_UNKNOWN_IMAGE_TYPE;
+    }
+  structure_output_stream.flush();
+  if (buf.failed())
+    return false;
+
+  std::ostringstream status;
+  if (result == 0)
+    status << "0\nOK\n";
+  else
+    status << "0\nERR " << result << '\n';
+  return write_fully(fd, status.str().c_str(), status.str().length());
+}
+
+// Function: wake_up_main_thread()
+//
+// Makes the main thread look at the queue and the idle connections again.
+void wake_up_main_thread(connection_queue_t &queue)
+{
+  char c = 0;
+  while (write(queue.wakeup[1], &c, 1) < 0 && errno == EINTR)
+    ;
+}
+
+// Function: close_connection()
+//
+// Closes the connection and releases it.
+void close_connection(connection_t *connection)
+{
+  close(connection->fd);
+  delete connection;
+}
+
+// Function: worker()
+//
+// Worker thread: takes the connections with a request from the queue and serves one request at a time.
+// After the request the connection goes back to the idle ones, unless the next request has already been read ahead.
+void *worker(void *arg)
+{
+  server_t *server = (server_t *) arg;
+  connection_queue_t &queue = server->queue;
+
+  while (true)
+    {
+      pthread_mutex_lock(&queue.mutex);
+      while (queue.connections.empty())
+        pthread_cond_wait(&queue.not_empty, &queue.mutex);
+      connection_t *connection = queue.connections.front();
+      queue.connections.pop_front();
+      pthread_mutex_unlock(&queue.mutex);
+      // There is room in the queue now:
+      wake_up_main_thread(queue);
+
+      if (!serve_request(server, connection))
+        {
+          close_connection(connection);
+          continue;
+        }
+
+      connection->last_active = time(NULL);
+      pthread_mutex_lock(&queue.mutex);
+      if (connection->pending.find('\n') != std::string::npos)
+        {
+          queue.connections.push_back(connection);
+          pthread_cond_signal(&queue.not_empty);
+        }
+      else
+        queue.idle.push_back(connection);
+      pthread_mutex_unlock(&queue.mutex);
+      wake_up_main_thread(queue);
+    }
+
+  return NULL;
+}
+
+// Function: open_listening_socket()
+//
+// Opens the socket the server listens on: a Unix domain socket, if the path is given, otherwise the localhost TCP port.
+//
+// Returns:
+//      the socket or -1 in case of error
+int open_listening_socket(const std::string &socket_path, int port, int backlog)
+{
+  int fd;
+  if (!socket_path.empty())
+    {
+      struct sockaddr_un address;
+      if (socket_path.length() >= sizeof(address.sun_path))
+        return -1;
+      memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0)
+        return -1;
+      // The socket file may be left from the previous run:
+      unlink(socket_path.c_str());
+      if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0)
+        {
+          close(fd);
+          return -1;
+        }
+    }
+  else
+    {
+      struct sockaddr_in address;
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_port = htons(port);
+      // Only local clients are served:
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (fd < 0)
+        return -1;
+      int reuse = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+      if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0)
+        {
+          close(fd);
+          return -1;
+        }
+    }
+
+  if (listen(fd, backlog) != 0)
+    {
+      close(fd);
+      return -1;
+    }
+  return fd;
+}
+
+int main(int argc,
+         char **argv
+        )
+{
+  TCLAP::CmdLine cmd("OSRA recognition server, created by Igor Filippov, 2013", ' ', PACKAGE_VERSION);
+
+  TCLAP::ValueArg<std::string> socket_option("", "socket", "Listen on the Unix domain socket", false, "", "path");
+  cmd.add(socket_option);
+
+  TCLAP::ValueArg<int> port_option("", "port", "Listen on the localhost TCP port", false, 0, "port");
+  cmd.add(port_option);
+
+  TCLAP::ValueArg<int> workers_option("", "workers", "Number of requests processed in parallel", false, 0, "default: all cores");
+  cmd.add(workers_option);
+
+  TCLAP::ValueArg<int> queue_option("", "queue", "Number of connections waiting for a worker before new connections are held back", false, 16, "default: 16");
+  cmd.add(queue_option);
+
+  TCLAP::ValueArg<int> max_size_option("", "max-size", "Largest image accepted, in megabytes", false, 256, "default: 256");
+  cmd.add(max_size_option);
+
+  TCLAP::ValueArg<int> timeout_option("", "timeout", "Seconds an idle connection is kept open and a stalled request is waited for", false, 30, "default: 30");
+  cmd.add(timeout_option);
+
+  TCLAP::ValueArg<std::string> spelling_file_option("l", "spelling", "Spelling correction dictionary", false, "", "configfile");
+  cmd.add(spelling_file_option);
+
+  TCLAP::ValueArg<std::string> superatom_file_option("a", "superatom", "Superatom label map to SMILES", false, "", "configfile");
+  cmd.add(superatom_file_option);
+
+  TCLAP::ValueArg<std::string> output_format_option("f", "format", "Default output format", false, "can", "can/smi/sdf");
+  cmd.add(output_format_option);
+
+  TCLAP::SwitchArg verbose_option("v", "verbose", "Be verbose and print the program flow", false);
+  cmd.add(verbose_option);
+
+  cmd.parse(argc, argv);
+
+  if (socket_option.getValue().empty() == (port_option.getValue() <= 0))
+    {
+      std::cerr << "Either a socket path (--socket) or a port (--port) should be given." << std::endl;
+      return ERROR_ILLEGAL_ARGUMENT_COMBINATION;
+    }
+
+  // Calculating the current dir:
+  char progname[1024];
+  strncpy(progname, cmd.getProgramName().c_str(), sizeof(progname) - 1);
+  progname[sizeof(progname) - 1] = '\0';
+  std::string osra_dir = dirname(progname);
+
+  int workers = workers_option.getValue();
+  if (workers <= 0)
+    workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers < 1)
+    workers = 1;
+
+  server_t server;
+  int result;
+  server.context = osra_create_context(osra_dir, spelling_file_option.getValue(), superatom_file_option.getValue(),
+                                       verbose_option.getValue(), &result);
+  if (server.context == NULL)
+    return result;
+  server.default_options.output_format = output_format_option.getValue();
+  server.default_options.verbose = verbose_option.getValue();
+  // Parallelism comes from the workers, every request is processed by a single thread by default:
+  server.default_options.num_threads = 1;
+  server.max_image_length = std::min(max_size_option.getValue(), 2047) * 1024 * 1024;
+  server.timeout = std::max(timeout_option.getValue(), 1);
+  server.queue.capacity = std::max(queue_option.getValue(), 1);
+  pthread_mutex_init(&server.queue.mutex, NULL);
+  pthread_cond_init(&server.queue.not_empty, NULL);
+  if (pipe(server.queue.wakeup) != 0)
+    {
+      std::cerr << "Cannot create the wakeup pipe" << std::endl;
+      return ERROR_ILLEGAL_ARGUMENT_COMBINATION;
+    }
+
+  int listen_fd = open_listening_socket(socket_option.getValue(), port_option.getValue(), server.queue.capacity);
+  if (listen_fd < 0)
+    {
+      std::cerr << "Cannot listen on " << (socket_option.getValue().empty() ? "the port" : "the socket") << std::endl;
+      return ERROR_ILLEGAL_ARGUMENT_COMBINATION;
+    }
+
+  // Clients closing the connection early should not kill the server:
+  signal(SIGPIPE, SIG_IGN);
+
+  for (int i = 0; i < workers; i++)
+    {
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, worker, &server) == 0)
+        pthread_detach(thread);
+    }
+
+  struct timeval io_timeout;
+  io_timeout.tv_sec = server.timeout;
+  io_timeout.tv_usec = 0;
+  connection_queue_t &queue = server.queue;
+
+  while (true)
+    {
+      // The idle connections past the timeout are closed, the rest are watched for the next request. New connections
+      // are accepted and the idle ones taken up only when there is room for them in the queue:
+      std::vector<struct pollfd> fds;
+      std::vector<connection_t *> watched;
+      struct pollfd pfd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      pthread_mutex_lock(&queue.mutex);
+      bool room = queue.connections.size() < queue.capacity;
+      time_t now = time(NULL);
+      for (unsigned int i = 0; i < queue.idle.size(); )
+        if (now - queue.idle[i]->last_active >= server.timeout)
+          {
+            close_connection(queue.idle[i]);
+            queue.idle.erase(queue.idle.begin() + i);
+          }
+        else
+          i++;
+      pfd.fd = queue.wakeup[0];
+      fds.push_back(pfd);
+      if (room)
+        {
+          pfd.fd = listen_fd;
+          fds.push_back(pfd);
+          for (unsigned int i = 0; i < queue.idle.size(); i++)
+            {
+              pfd.fd = queue.idle[i]->fd;
+              fds.push_back(pfd);
+              watched.push_back(queue.idle[i]);
+            }
+        }
+      pthread_mutex_unlock(&queue.mutex);
+
+      // Waking up every second to close the connections that became idle for too long:
+      if (poll(&fds[0], fds.size(), 1000) <= 0)
+        continue;
+
+      if (fds[0].revents != 0)
+        {
+          char drain[64];
+          while (read(queue.wakeup[0], drain, sizeof(drain)) < 0 && errno == EINTR)
+            ;
+        }
+
+      connection_t *accepted = NULL;
+      if (room && fds[1].revents != 0)
+        {
+          int fd = accept(listen_fd, NULL, NULL);
+          if (fd >= 0)
+            {
+              // Reads and writes stalled for longer than the timeout fail, so that a client cannot hold a worker:
+              setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &io_timeout, sizeof(io_timeout));
+              setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &io_timeout, sizeof(io_timeout));
+              accepted = new connection_t;
+              accepted->fd = fd;
+              accepted->last_active = time(NULL);
+            }
+        }
+
+      pthread_mutex_lock(&queue.mutex);
+      // The new connection waits for its first request as an idle one:
+      if (accepted != NULL)
+        queue.idle.push_back(accepted);
+      for (unsigned int i = 0; i < watched.size() && queue.connections.size() < queue.capacity; i++)
+        if (fds[i + 2].revents != 0)
+          {
+            queue.idle.erase(std::find(queue.idle.begin(), queue.idle.end(), watched[i]));
+            queue.connections.push_back(watched[i]);
+            pthread_cond_signal(&queue.not_empty);
+          }
+      pthread_mutex_unlock(&queue.mutex);
+    }
+
+  return 0;
+}
@@ -27,6 +27,7 @@
 #include <float.h> // FLT_MAX
 #include <iostream> // std::cout
 #include <set>
+#include <algorithm> // std::sort(), std::unique()
 
 #include "osra_common.h"
 #include "osra_structure.h"
@@ -36,20 +37,20 @@
 void remove_disconnected_atoms(std::vector<atom_t> &atom, std::vector<bond_t> &bond,
                                int n_atom, int n_bond)
 {
+  // The atoms with an existing bond ending on them are marked in one pass over the bonds:
+  std::vector<bool> connected(n_atom, false);
+  for (int j = 0; j < n_bond; j++)
+    if (bond[j].exists)
+      {
+        if (bond[j].a >= 0 && bond[j].a < n_atom)
+          connected[bond[j].a] = true;
+        if (bond[j].b >= 0 && bond[j].b < n_atom)
+          connected[bond[j].b] = true;
+      }
+
   for (int i = 0; i < n_atom; i++)
-    {
-      if (atom[i].exists)
-        {
-          atom[i].exists = false;
-          for (int j = 0; j < n_bond; j++)
-            {
-              if ((bond[j].exists) && (i == bond[j].a || i == bond[j].b))
-                {
-                  atom[i].exists = true;
-                }
-            }
-        }
-    }
+    if (atom[i].exists && !connected[i])
+      atom[i].exists = false;
 }
 
 void remove_zero_bonds(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &atom)
@@ -118,7 +119,7 @@ bool bonds_within_each_other(const std::vector<bond_t> &bond, int ii, int jj,
 }
 
 bool no_white_space(int ai, int bi, int aj, int bj, const std::vector<atom_t> &atom,
-                    const Image &image, double threshold, const ColorGray &bgColor)
+                    const bitmap_t &image)
 {
   std::vector<double> xx(4);
   double dx1 = atom[bi].x - atom[ai].x;
@@ -152,7 +153,7 @@ bool no_white_space(int ai, int bi, int aj, int bj, const std::vector<atom_t> &a
             for (int y = int(p1) + dp; y != int(p2); y += dp)
               {
                 s++;
-                if (get_pixel(image, bgColor, x, y, threshold) == 0)
+                if (get_pixel(image, x, y) == 0)
                   {
                     w++;
                     white = true;
@@ -186,7 +187,7 @@ bool no_white_space(int ai, int bi, int aj, int bj, const std::vector<atom_t> &a
             for (int x = int(p1) + dp; x != int(p2); x += dp)
               {
                 s++;
-                if (get_pixel(image, bgColor, x, y, threshold) == 0)
+                if (get_pixel(image, x, y) == 0)
                   {
                     w++;
                     white = true;
@@ -362,8 +363,8 @@ int find_wavy_bonds(std::vector<bond_t> &bond, int n_bond, const std::vector<ato
   return n_bond;
 }
 
-double skeletize(std::vector<atom_t> &atom, std::vector<bond_t> &bond, int n_bond, const Image &image,
-                 double threshold, const ColorGray &bgColor, double dist, double avg)
+double skeletize(std::vector<atom_t> &atom, std::vector<bond_t> &bond, int n_bond, const bitmap_t &image,
+                 double dist, double avg)
 {
   double thickness = 0;
   std::vector<double> a;
@@ -379,7 +380,7 @@ double skeletize(std::vector<atom_t> &atom, std::vector<bond_t> &bond, int n_bon
               double tt = distance_between_bonds(bond, i, j, atom);
               double tang = angle_between_bonds(bond, i, j, atom);
               if ((fabs(tang) > D_T_TOLERANCE && no_white_space(bond[i].a, bond[i].b, bond[j].a, bond[j].b, atom,
-                   image, threshold, bgColor) && tt < MAX_BOND_THICKNESS) || tt < dist)
+                   image) && tt < MAX_BOND_THICKNESS) || tt < dist)
                 {
                   double l2 = bond_length(bond, j, atom);
                   a.push_back(tt);
@@ -785,11 +786,13 @@ void extend_terminal_bond_to_label(
     const std::vector<bond_t> &bond, int n_bond, const std::vector<label_t> &label,
     int n_label, double avg, double maxh, double max_dist_double_bond)
 {
+  atom_bonds_t index;
+  index_atom_bonds(bond, n_bond, atom.size(), index);
   for (int j = 0; j < n_bond; j++)
     if (bond[j].exists)
       {
-        bool not_corner_a = terminal_bond(bond[j].a, j, bond, n_bond);
-        bool not_corner_b = terminal_bond(bond[j].b, j, bond, n_bond);
+        bool not_corner_a = terminal_bond(bond[j].a, j, bond, index);
+        bool not_corner_b = terminal_bond(bond[j].b, j, bond, index);
         if (atom[bond[j].a].label != " ")
           not_corner_a = false;
         if (atom[bond[j].b].label != " ")
@@ -951,6 +954,8 @@ void extend_terminal_bond_to_label(
 void extend_terminal_bond_to_bonds(std::vector<atom_t> &atom, std::vector<bond_t> &bond, int n_bond,
                                    double avg, double maxh, double max_dist_double_bond)
 {
+  atom_bonds_t index;
+  index_atom_bonds(bond, n_bond, atom.size(), index);
   bool found_intersection = true;
 
   while (found_intersection)
@@ -959,8 +964,8 @@ void extend_terminal_bond_to_bonds(std::vector<atom_t> &atom, std::vector<bond_t
       for (int j = 0; j < n_bond; j++)
         if (bond[j].exists)
           {
-            bool not_corner_a = terminal_bond(bond[j].a, j, bond, n_bond);
-            bool not_corner_b = terminal_bond(bond[j].b, j, bond, n_bond);
+            bool not_corner_a = terminal_bond(bond[j].a, j, bond, index);
+            bool not_corner_b = terminal_bond(bond[j].b, j, bond, index);
             double xa = atom[bond[j].a].x;
             double ya = atom[bond[j].a].y;
             double xb = atom[bond[j].b].x;
@@ -969,7 +974,7 @@ void extend_terminal_bond_to_bonds(std::vector<atom_t> &atom, std::vector<bond_t
             double minb = FLT_MAX;
             bool found = false;
             int l = -1;
-            for (int i = 0; i < n_bond; i++)
+            for (int i = 0; not_corner_a && i < n_bond; i++)
               if (bond[i].exists && i != j)
                 if (not_corner_a)
                   {
@@ -1019,7 +1024,7 @@ void extend_terminal_bond_to_bonds(std::vector<atom_t> &atom, std::vector<bond_t
 		    atom[l].min_y = std::min(atom[bond[j].a].min_y ,atom[l].min_y);
 		    atom[l].max_x = std::max(atom[bond[j].a].max_x ,atom[l].max_x);
 		    atom[l].max_y = std::max(atom[bond[j].a].max_y ,atom[l].max_y);
-		    bond[j].a = l;
+		    set_bond_ends(bond, j, l, bond[j].b, index);
 		    found_intersection = true;
 		  }
 		//cout<<atom[bond[j].a].label<<" "<<atom[l].label<<endl;
@@ -1028,7 +1033,7 @@ void extend_terminal_bond_to_bonds(std::vector<atom_t> &atom, std::vector<bond_t
             found = false;
             minb = FLT_MAX;
             l = -1;
-            for (int i = 0; i < n_bond; i++)
+            for (int i = 0; not_corner_b && i < n_bond; i++)
               if (bond[i].exists && i != j)
                 if (not_corner_b)
                   {
@@ -1078,7 +1083,7 @@ void extend_terminal_bond_to_bonds(std::vector<atom_t> &atom, std::vector<bond_t
 		    atom[l].min_y = std::min(atom[bond[j].b].min_y ,atom[l].min_y);
 		    atom[l].max_x = std::max(atom[bond[j].b].max_x ,atom[l].max_x);
 		    atom[l].max_y = std::max(atom[bond[j].b].max_y ,atom[l].max_y);
-		    bond[j].b = l;
+		    set_bond_ends(bond, j, bond[j].a, l, index);
 		    found_intersection = true;
 		  }
 		//cout<<atom[bond[j].b].label<<" "<<atom[l].label<<endl;
@@ -1392,18 +1397,18 @@ void extend_dashed_bond(int a, int b, int n, std::vector<atom_t> &atom)
   atom[b].y = ky * l / (n - 1) + y1;
 }
 
-int count_area(std::vector<std::vector<int> > &box, double &x0, double &y0)
+int count_area(bitmap_t &box, double &x0, double &y0)
 {
   int a = 0;
-  int w = box.size();
-  int h = box[0].size();
+  int w = box.width;
+  int h = box.height;
   int x = int(x0);
   int y = int(y0);
   int xm = 0, ym = 0;
 
-  if (box[x][y] == 1)
+  if (x < w && y < h && box.pixels[y * w + x] == 1)
     {
-      box[x][y] = 2;
+      box.pixels[y * w + x] = 2;
       std::list<int> cx;
       std::list<int> cy;
       cx.push_back(x);
@@ -1414,17 +1419,17 @@ int count_area(std::vector<std::vector<int> > &box, double &x0, double &y0)
           y = cy.front();
           cx.pop_front();
           cy.pop_front();
-          box[x][y] = 0;
+          box.pixels[y * w + x] = 0;
           a++;
           xm += x;
           ym += y;
           for (int i = x - 1; i < x + 2; i++)
             for (int j = y - 1; j < y + 2; j++)
-              if (i < w && j < h && i >= 0 && j >= 0 && box[i][j] == 1)
+              if (i < w && j < h && i >= 0 && j >= 0 && box.pixels[j * w + i] == 1)
                 {
                   cx.push_back(i);
                   cy.push_back(j);
-                  box[i][j] = 2;
+                  box.pixels[j * w + i] = 2;
                 }
         }
     }
@@ -1447,19 +1452,17 @@ bool curve_in_letter(const potrace_path_t *p, std::vector<letters_t> &letters)
 }
 
 int find_dashed_bonds(const potrace_path_t *p, std::vector<atom_t> &atom, std::vector<bond_t> &bond,
-                      int n_atom, int *n_bond, int max, double avg, const Image &img,
-                      const ColorGray &bg, double THRESHOLD, bool thick, double dist,
+                      int n_atom, int *n_bond, int max, double avg, const bitmap_t &img, bool thick, double dist,
                       std::vector<letters_t> &letters)
 {
   potrace_dpoint_t (*c)[3];
   std::vector<dash_t> dot;
-  std::vector<std::vector<int> > box(img.columns());
-  int width = img.columns();
-  int height = img.rows();
-
-  for (unsigned int i = 0; i < img.columns(); i++)
-    for (unsigned int j = 0; j < img.rows(); j++)
-      box[i].push_back(get_pixel(img, bg, i, j, THRESHOLD));
+  // The dashes are erased from a copy of the bitmap as they are counted, see count_area():
+  bitmap_t box;
+  if (thick)
+    box = img;
+  int width = img.width;
+  int height = img.height;
 
   while (p != NULL)
     {
@@ -1905,6 +1908,16 @@ int resolve_bridge_bonds(std::vector<atom_t> &atom, int n_atom, std::vector<bond
 void collapse_atoms(std::vector<atom_t> &atom, std::vector<bond_t> &bond,
                     int n_atom, int n_bond, double dist)
 {
+  // No two atoms are closer than that:
+  if (!(dist > 0))
+    return;
+
+  atom_bonds_t index;
+  index_atom_bonds(bond, n_bond, n_atom, index);
+  atom_grid_t grid;
+  build_atom_grid(atom, n_atom, dist, true, grid);
+  std::vector<int> near;
+
   bool found = true;
 
   while (found)
@@ -1912,9 +1925,22 @@ void collapse_atoms(std::vector<atom_t> &atom, std::vector<bond_t> &bond,
       found = false;
       for (int i = 0; i < n_atom; i++)
         if (atom[i].exists)
-          for (int j = 0; j < n_atom; j++)
-            if (atom[j].exists && j != i && distance(atom[i].x, atom[i].y, atom[j].x, atom[j].y) < dist)
+          {
+            // The atoms are merged into atom i in the order of their numbers, each one tested against the centre
+            // of atom i as it moves with the merges; so the next one is the first atom after the last merged one
+            // which is within the distance now:
+            int next = 0;
+            while (true)
               {
+                int j = n_atom;
+                find_atoms_near(grid, atom[i].x, atom[i].y, dist, near);
+                for (unsigned int k = 0; k < near.size(); k++)
+                  if (near[k] >= next && near[k] < j && near[k] != i && atom[near[k]].exists
+                      && distance(atom[i].x, atom[i].y, atom[near[k]].x, atom[near[k]].y) < dist)
+                    j = near[k];
+                if (j == n_atom)
+                  break;
+
                 atom[j].exists = false;
                 atom[i].x = (atom[i].x + atom[j].x) / 2;
                 atom[i].y = (atom[i].y + atom[j].y) / 2;
@@ -1926,20 +1952,28 @@ void collapse_atoms(std::vector<atom_t> &atom, std::vector<bond_t> &bond,
 
                 if (atom[j].label != " " && atom[i].label == " ")
                   atom[i].label = atom[j].label;
-                for (int k = 0; k < n_bond; k++)
-                  if (bond[k].exists)
-                    {
-                      if (bond[k].a == j)
-                        {
-                          bond[k].a = i;
-                        }
-                      else if (bond[k].b == j)
-                        {
-                          bond[k].b = i;
-                        }
-                    }
+                std::vector<int> bonds_j = index.bonds[j];
+                for (unsigned int l = 0; l < bonds_j.size(); l++)
+                  {
+                    int k = bonds_j[l];
+                    if (bond[k].exists)
+                      {
+                        if (bond[k].a == j)
+                          {
+                            set_bond_ends(bond, k, i, bond[k].b, index);
+                          }
+                        else if (bond[k].b == j)
+                          {
+                            set_bond_ends(bond, k, bond[k].a, i, index);
+                          }
+                      }
+                  }
+                remove_grid_atom(grid, j);
+                move_grid_atom(grid, i, atom[i].x, atom[i].y);
+                next = j + 1;
                 found = true;
               }
+          }
     }
 }
 
@@ -1969,132 +2003,155 @@ int fix_one_sided_bonds(std::vector<bond_t> &bond, int n_bond, const std::vector
 {
   double l;
   int n_bond_orig = n_bond;
+  atom_bonds_t index;
+  index_atom_bonds(bond, n_bond, atom.size(), index);
+  atom_grid_t grid;
+  build_atom_grid(atom, atom.size(), avg, false, grid);
+  std::vector<int> near;
+  std::vector<int> candidates;
   for (int i = 0; i < n_bond_orig; i++)
     if (bond[i].exists && bond[i].type < 3 && (l = bond_length(bond, i, atom)) > avg / 3)
-      for (int j = 0; j < n_bond_orig; j++)
-        if (bond[j].exists && j != i && bond[j].type < 3 && fabs(angle_between_bonds(bond, i, j, atom))
-            < D_T_TOLERANCE && bond_length(bond, j, atom) > avg / 3)
+      {
+        // Bond j is changed only if one of its ends is within "thickness" from bond i and projects onto it no farther
+        // than "l" from its first atom. The first atom of bond i stays in place and the atoms do not move, so only the
+        // bonds with an end within "l + thickness" from that atom need to be tested, in the order of their numbers:
+        find_atoms_near(grid, atom[bond[i].a].x, atom[bond[i].a].y, l + fabs(thickness), near);
+        candidates.clear();
+        for (unsigned int k = 0; k < near.size(); k++)
+          if (near[k] < (int) index.bonds.size())
+            for (unsigned int m = 0; m < index.bonds[near[k]].size(); m++)
+              if (index.bonds[near[k]][m] < n_bond_orig)
+                candidates.push_back(index.bonds[near[k]][m]);
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        for (unsigned int c = 0; c < candidates.size(); c++)
           {
-            double d1 = fabs(distance_from_bond_y(atom[bond[i].a].x, atom[bond[i].a].y, atom[bond[i].b].x,
-                                                  atom[bond[i].b].y, atom[bond[j].a].x, atom[bond[j].a].y));
-            double d2 = fabs(distance_from_bond_y(atom[bond[i].a].x, atom[bond[i].a].y, atom[bond[i].b].x,
-                                                  atom[bond[i].b].y, atom[bond[j].b].x, atom[bond[j].b].y));
-            if (d1 < thickness && !(bond[j].a == bond[i].b || bond[j].a == bond[i].a))
+            int j = candidates[c];
+            if (bond[j].exists && j != i && bond[j].type < 3 && fabs(angle_between_bonds(bond, i, j, atom))
+                < D_T_TOLERANCE && bond_length(bond, j, atom) > avg / 3)
               {
-                double l1 = distance_from_bond_x_a(atom[bond[i].a].x, atom[bond[i].a].y, atom[bond[i].b].x,
-                                                   atom[bond[i].b].y, atom[bond[j].a].x, atom[bond[j].a].y);
-                if (l1 > 0 && l1 < l)
+                double d1 = fabs(distance_from_bond_y(atom[bond[i].a].x, atom[bond[i].a].y, atom[bond[i].b].x,
+                                                      atom[bond[i].b].y, atom[bond[j].a].x, atom[bond[j].a].y));
+                double d2 = fabs(distance_from_bond_y(atom[bond[i].a].x, atom[bond[i].a].y, atom[bond[i].b].x,
+                                                      atom[bond[i].b].y, atom[bond[j].b].x, atom[bond[j].b].y));
+                if (d1 < thickness && !(bond[j].a == bond[i].b || bond[j].a == bond[i].a))
                   {
-                    if (bond[j].b == bond[i].b || bond[j].b == bond[i].a)
-                      {
-                        bond[j].exists = false;
-                      }
-                    else
+                    double l1 = distance_from_bond_x_a(atom[bond[i].a].x, atom[bond[i].a].y, atom[bond[i].b].x,
+                                                       atom[bond[i].b].y, atom[bond[j].a].x, atom[bond[j].a].y);
+                    if (l1 > 0 && l1 < l)
                       {
-			bond_t b1(bond[j].a,bond[i].b,bond[i].curve);
-                        b1.type = bond[i].type;
-			b1.hash = bond[i].hash;
-			b1.wedge = bond[i].wedge;
-			b1.arom = bond[i].arom;
-                        b1.conjoined = bond[i].conjoined;
-			if (n_bond < MAX_ATOMS)
-			  {
-			    bond.push_back(b1);
-			    n_bond++;
-			  }
-                        bond[i].b = bond[j].a;
-                        bond[i].wedge = false;
+                        if (bond[j].b == bond[i].b || bond[j].b == bond[i].a)
+                          {
+                            bond[j].exists = false;
+                          }
+                        else
+                          {
+			    bond_t b1(bond[j].a,bond[i].b,bond[i].curve);
+                            b1.type = bond[i].type;
+			    b1.hash = bond[i].hash;
+			    b1.wedge = bond[i].wedge;
+			    b1.arom = bond[i].arom;
+                            b1.conjoined = bond[i].conjoined;
+			    if (n_bond < MAX_ATOMS)
+			      {
+				bond.push_back(b1);
+				n_bond++;
+			      }
+                            set_bond_ends(bond, i, bond[i].a, bond[j].a, index);
+                            bond[i].wedge = false;
+                          }
                       }
                   }
-              }
-            else if (d2 < thickness && !(bond[j].b == bond[i].b || bond[j].b == bond[i].a))
-              {
-                double l1 = distance_from_bond_x_a(atom[bond[i].a].x, atom[bond[i].a].y, atom[bond[i].b].x,
-                                                   atom[bond[i].b].y, atom[bond[j].b].x, atom[bond[j].b].y);
-                if (l1 > 0 && l1 < l)
+                else if (d2 < thickness && !(bond[j].b == bond[i].b || bond[j].b == bond[i].a))
                   {
-                    if (bond[j].a == bond[i].b || bond[j].a == bond[i].a)
+                    double l1 = distance_from_bond_x_a(atom[bond[i].a].x, atom[bond[i].a].y, atom[bond[i].b].x,
+                                                       atom[bond[i].b].y, atom[bond[j].b].x, atom[bond[j].b].y);
+                    if (l1 > 0 && l1 < l)
                       {
-                        bond[j].exists = false;
-                      }
-                    else
-                      {
-			bond_t b1(bond[j].b,bond[i].b,bond[i].curve);
-                        b1.type = bond[i].type;
-			b1.hash = bond[i].hash;
-			b1.wedge = bond[i].wedge;
-			b1.arom = bond[i].arom;
-                        b1.conjoined = bond[i].conjoined;
-			if (n_bond < MAX_ATOMS)
-			  {
-			    bond.push_back(b1);
-			    n_bond++;
-			  }
-                        bond[i].b = bond[j].b;
-                        bond[i].wedge = false;
+                        if (bond[j].a == bond[i].b || bond[j].a == bond[i].a)
+                          {
+                            bond[j].exists = false;
+                          }
+                        else
+                          {
+			    bond_t b1(bond[j].b,bond[i].b,bond[i].curve);
+                            b1.type = bond[i].type;
+			    b1.hash = bond[i].hash;
+			    b1.wedge = bond[i].wedge;
+			    b1.arom = bond[i].arom;
+                            b1.conjoined = bond[i].conjoined;
+			    if (n_bond < MAX_ATOMS)
+			      {
+				bond.push_back(b1);
+				n_bond++;
+			      }
+                            set_bond_ends(bond, i, bond[i].a, bond[j].b, index);
+                            bond[i].wedge = false;
+                          }
                       }
                   }
               }
           }
+      }
 
   return (n_bond);
 }
 
-int thickness_hor(const Image &image, int x1, int y1, const ColorGray &bgColor, double THRESHOLD_BOND)
+int thickness_hor(const bitmap_t &image, int x1, int y1)
 {
   int i = 0, s = 0, w = 0;
-  int width = image.columns();
-  s = get_pixel(image, bgColor, x1, y1, THRESHOLD_BOND);
+  int width = image.width;
+  s = get_pixel(image, x1, y1);
 
   if (s == 0 && x1 + 1 < width)
     {
       x1++;
-      s = get_pixel(image, bgColor, x1, y1, THRESHOLD_BOND);
+      s = get_pixel(image, x1, y1);
     }
   if (s == 0 && x1 - 2 >= 0)
     {
       x1 -= 2;
-      s = get_pixel(image, bgColor, x1, y1, THRESHOLD_BOND);
+      s = get_pixel(image, x1, y1);
     }
   if (s == 1)
     {
       while (x1 + i < width && s == 1)
-        s = get_pixel(image, bgColor, x1 + i++, y1, THRESHOLD_BOND);
+        s = get_pixel(image, x1 + i++, y1);
       w = i - 1;
       i = 1;
       s = 1;
       while (x1 - i >= 0 && s == 1)
-        s = get_pixel(image, bgColor, x1 - i++, y1, THRESHOLD_BOND);
+        s = get_pixel(image, x1 - i++, y1);
       w += i - 1;
     }
   return (w);
 }
 
-int thickness_ver(const Image &image, int x1, int y1, const ColorGray &bgColor, double THRESHOLD_BOND)
+int thickness_ver(const bitmap_t &image, int x1, int y1)
 {
   int i = 0, s = 0, w = 0;
-  int height = image.rows();
-  s = get_pixel(image, bgColor, x1, y1, THRESHOLD_BOND);
+  int height = image.height;
+  s = get_pixel(image, x1, y1);
 
   if (s == 0 && y1 + 1 < height)
     {
       y1++;
-      s = get_pixel(image, bgColor, x1, y1, THRESHOLD_BOND);
+      s = get_pixel(image, x1, y1);
     }
   if (s == 0 && y1 - 2 >= 0)
     {
       y1 -= 2;
-      s = get_pixel(image, bgColor, x1, y1, THRESHOLD_BOND);
+      s = get_pixel(image, x1, y1);
     }
   if (s == 1)
     {
       while (y1 + i < height && s == 1)
-        s = get_pixel(image, bgColor, x1, y1 + i++, THRESHOLD_BOND);
+        s = get_pixel(image, x1, y1 + i++);
       w = i - 1;
       i = 1;
       s = 1;
       while (y1 - i >= 0 && s == 1)
-        s = get_pixel(image, bgColor, x1, y1 - i++, THRESHOLD_BOND);
+        s = get_pixel(image, x1, y1 - i++);
       w += i - 1;
     }
   return (w);
@@ -2105,9 +2162,8 @@ bool comp_thickness(const std::pair<int, double> &a, const std::pair<int, double
   return a.second < b.second;
 }
 
-double find_wedge_bonds(const Image &image, std::vector<atom_t> &atom, int n_atom,
-                        std::vector<bond_t> &bond, int n_bond, const ColorGray &bgColor,
-                        double THRESHOLD_BOND, double max_dist_double_bond, double avg, int limit,
+double find_wedge_bonds(const bitmap_t &image, std::vector<atom_t> &atom, int n_atom,
+                        std::vector<bond_t> &bond, int n_bond, double max_dist_double_bond, double avg, int limit,
                         int dist)
 {
   double l;
@@ -2127,8 +2183,8 @@ double find_wedge_bonds(const Image &image, std::vector<atom_t> &atom, int n_ato
         int y1 = int((atom[bond[i].a].y + atom[bond[i].b].y) / 2);
 
         int w = 0, max_c, min_c, sign = 1;
-        int w3_ver = thickness_ver(image, x1, y1, bgColor, THRESHOLD_BOND);
-        int w3_hor = thickness_hor(image, x1, y1, bgColor, THRESHOLD_BOND);
+        int w3_ver = thickness_ver(image, x1, y1);
+        int w3_hor = thickness_hor(image, x1, y1);
         if (w3_ver == 0 && w3_hor == 0)
           continue;
         if ((w3_ver < w3_hor && w3_ver > 0) || w3_hor == 0)
@@ -2143,7 +2199,7 @@ double find_wedge_bonds(const Image &image, std::vector<atom_t> &atom, int n_ato
               {
                 int y = int(atom[bond[i].a].y + (atom[bond[i].b].y - atom[bond[i].a].y) * (j - atom[bond[i].a].x)
                             / (atom[bond[i].b].x - atom[bond[i].a].x));
-                int t = thickness_ver(image, j, y, bgColor, THRESHOLD_BOND);
+                int t = thickness_ver(image, j, y);
                 if (abs(t - old) > 2)
                   break;
                 if (t < 2 * MAX_BOND_THICKNESS && t < avg / 3 && t > 0)
@@ -2161,7 +2217,7 @@ double find_wedge_bonds(const Image &image, std::vector<atom_t> &atom, int n_ato
               {
                 int y = int(atom[bond[i].a].y + (atom[bond[i].b].y - atom[bond[i].a].y) * (j - atom[bond[i].a].x)
                             / (atom[bond[i].b].x - atom[bond[i].a].x));
-                int t = thickness_ver(image, j, y, bgColor, THRESHOLD_BOND);
+                int t = thickness_ver(image, j, y);
                 if (abs(t - old) > 2)
                   break;
                 if (t < 2 * MAX_BOND_THICKNESS && t < avg / 3 && t > 0)
@@ -2188,7 +2244,7 @@ double find_wedge_bonds(const Image &image, std::vector<atom_t> &atom, int n_ato
               {
                 int x = int(atom[bond[i].a].x + (atom[bond[i].b].x - atom[bond[i].a].x) * (j - atom[bond[i].a].y)
                             / (atom[bond[i].b].y - atom[bond[i].a].y));
-                int t = thickness_hor(image, x, j, bgColor, THRESHOLD_BOND);
+                int t = thickness_hor(image, x, j);
                 if (abs(t - old) > 2)
                   break;
                 if (t < 2 * MAX_BOND_THICKNESS && t < avg / 3 && t > 0)
@@ -2206,7 +2262,7 @@ double find_wedge_bonds(const Image &image, std::vector<atom_t> &atom, int n_ato
               {
                 int x = int(atom[bond[i].a].x + (atom[bond[i].b].x - atom[bond[i].a].x) * (j - atom[bond[i].a].y)
                             / (atom[bond[i].b].y - atom[bond[i].a].y));
-                int t = thickness_hor(image, x, j, bgColor, THRESHOLD_BOND);
+                int t = thickness_hor(image, x, j);
                 if (abs(t - old) > 2)
                   break;
                 if (t < 2 * MAX_BOND_THICKNESS && t < avg / 3 && t > 0)
@@ -2544,6 +2600,8 @@ void find_old_aromatic_bonds(const potrace_path_t *p, std::vector<bond_t> &bond,
 
 void flatten_bonds(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &atom, double maxh)
 {
+  atom_bonds_t index;
+  index_atom_bonds(bond, n_bond, atom.size(), index);
   bool found = true;
 
   while (found)
@@ -2557,13 +2615,18 @@ void flatten_bonds(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &a
             double li = bond_length(bond, i, atom);
             if (atom[bond[i].a].label == " ")
               {
-                for (int j = 0; j < n_bond; j++)
-                  if (j != i && bond[j].exists && bond[j].type < 3 && (bond[i].a == bond[j].a || bond[i].a
-                      == bond[j].b))
-                    {
-                      n++;
-                      f = j;
-                    }
+                // The last of the bonds at the atom is taken, as when all bonds are scanned:
+                const std::vector<int> &bonds_a = index.bonds[bond[i].a];
+                for (unsigned int k = 0; k < bonds_a.size(); k++)
+                  {
+                    int j = bonds_a[k];
+                    if (j != i && bond[j].exists && bond[j].type < 3)
+                      {
+                        n++;
+                        if (n == 1 || j > f)
+                          f = j;
+                      }
+                  }
                 double lf = bond_length(bond, f, atom);
                 if (n == 1)
                   {
@@ -2577,7 +2640,7 @@ void flatten_bonds(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &a
                           {
                             bond[f].exists = false;
                             atom[bond[f].b].exists = false;
-                            bond[i].a = bond[f].a;
+                            set_bond_ends(bond, i, bond[f].a, bond[i].b, index);
                             if (lf > li)
                               bond[i].type = bond[f].type;
                             if (bond[f].arom)
@@ -2601,12 +2664,9 @@ void flatten_bonds(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &a
                             atom[bond[f].a].exists = false;
 
                             if (bond[f].hash || bond[f].wedge)
-                              {
-                                bond[i].a = bond[i].b;
-                                bond[i].b = bond[f].b;
-                              }
+                              set_bond_ends(bond, i, bond[i].b, bond[f].b, index);
                             else
-                              bond[i].a = bond[f].b;
+                              set_bond_ends(bond, i, bond[f].b, bond[i].b, index);
                             if (lf > li)
                               bond[i].type = bond[f].type;
                             if (bond[f].arom)
@@ -2625,12 +2685,17 @@ void flatten_bonds(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &a
             f = i;
             if (atom[bond[i].b].label == " ")
               {
-                for (int j = 0; j < n_bond; j++)
-                  if (j != i && bond[j].exists && bond[j].type < 3 && (bond[i].b == bond[j].a || bond[i].b == bond[j].b))
-                    {
-                      n++;
-                      f = j;
-                    }
+                const std::vector<int> &bonds_b = index.bonds[bond[i].b];
+                for (unsigned int k = 0; k < bonds_b.size(); k++)
+                  {
+                    int j = bonds_b[k];
+                    if (j != i && bond[j].exists && bond[j].type < 3)
+                      {
+                        n++;
+                        if (n == 1 || j > f)
+                          f = j;
+                      }
+                  }
                 double lf = bond_length(bond, f, atom);
                 if (n == 1)
                   {
@@ -2645,12 +2710,9 @@ void flatten_bonds(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &a
                             bond[f].exists = false;
                             atom[bond[f].b].exists = false;
                             if (bond[f].hash || bond[f].wedge)
-                              {
-                                bond[i].b = bond[i].a;
-                                bond[i].a = bond[f].a;
-                              }
+                              set_bond_ends(bond, i, bond[f].a, bond[i].a, index);
                             else
-                              bond[i].b = bond[f].a;
+                              set_bond_ends(bond, i, bond[i].a, bond[f].a, index);
                             if (lf > li)
                               bond[i].type = bond[f].type;
                             if (bond[f].arom)
@@ -2672,7 +2734,7 @@ void flatten_bonds(std::vector<bond_t> &bond, int n_bond, std::vector<atom_t> &a
                           {
                             bond[f].exists = false;
                             atom[bond[f].a].exists = false;
-                            bond[i].b = bond[f].b;
+                            set_bond_ends(bond, i, bond[i].a, bond[f].b, index);
                             if (lf > li)
                               bond[i].type = bond[f].type;
                             if (bond[f].arom)
@@ -2697,12 +2759,14 @@ void mark_terminal_atoms(const std::vector<bond_t> &bond, int n_bond,
   for (int i = 0; i < n_atom; i++)
     atom[i].terminal = false;
 
+  atom_bonds_t index;
+  index_atom_bonds(bond, n_bond, atom.size(), index);
   for (int j = 0; j < n_bond; j++)
     if (bond[j].exists && bond[j].type == 1 && !bond[j].arom)
       {
-        if (terminal_bond(bond[j].a, j, bond, n_bond))
+        if (terminal_bond(bond[j].a, j, bond, index))
           atom[bond[j].a].terminal = true;
-        if (terminal_bond(bond[j].b, j, bond, n_bond))
+        if (terminal_bond(bond[j].b, j, bond, index))
           atom[bond[j].b].terminal = true;
       }
 }
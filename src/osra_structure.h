@@ -98,16 +98,14 @@ void collapse_doubleup_bonds(std::vector<bond_t> &bond, int n_bond);
 // atom - vector of atoms
 // bond - vector of bonds
 // n_bond - number of bonds
-// image - original image
-// threshold - black-white binarization threshold
-// bgColor - background color
+// image - binarized original image
 // dist - distance below which it's considered the same bond no matter whether the  other conditions are met or not
 // avg - average bond length
 //
 // Returns:
 // Average bond thickness
-double skeletize(std::vector<atom_t> &atom, std::vector<bond_t> &bond, int n_bond, const Image &image,
-                 double threshold, const ColorGray &bgColor, double dist, double avg);
+double skeletize(std::vector<atom_t> &atom, std::vector<bond_t> &bond, int n_bond, const bitmap_t &image,
+                 double dist, double avg);
 
 // Function: dist_double_bonds()
 //
@@ -219,14 +217,11 @@ int find_atoms(const potrace_path_t *p, std::vector<atom_t> &atom, std::vector<b
 // n_bond - pointer to the number of bonds
 // max - maximum area for a dash
 // avg - average bond length
-// img - original image
-// bg - background color
-// THRESHOLD - black-white binarization threshold
+// img - binarized original image
 // thick - flag set if the image was subject to thinning
 // dist - maximum dashed bond length
 int find_dashed_bonds(const potrace_path_t *p, std::vector<atom_t> &atom, std::vector<bond_t> &bond,
-                      int n_atom, int *n_bond, int max, double avg, const Image &img,
-                      const ColorGray &bg, double THRESHOLD, bool thick, double dist,
+                      int n_atom, int *n_bond, int max, double avg, const bitmap_t &img, bool thick, double dist,
                       std::vector<letters_t> &letters);
 
 // Function: find_small_bonds()
@@ -312,13 +307,11 @@ int fix_one_sided_bonds(std::vector<bond_t> &bond, int n_bond, const std::vector
 // Detects wedge stereo-bonds
 //
 // Parameters:
-// image -  original image
+// image -  binarized original image
 // atom - vector of atoms
 // n_atom - number of atoms
 // bond - vector of bonds
 // n_bond - number of bonds
-// bgColor - background color
-// THRESHOLD_BOND - black-white binarization threshold
 // max_dist_double_bond - maximum distance between double bonds
 // avg - average bond length
 // limit - minimum difference between the thick and thin ends of the bond
@@ -326,9 +319,8 @@ int fix_one_sided_bonds(std::vector<bond_t> &bond, int n_bond, const std::vector
 //
 // Returns:
 // Bond thickness
-double find_wedge_bonds(const Image &image, std::vector<atom_t> &atom, int n_atom, std::vector<bond_t> &bond,
-                        int n_bond, const ColorGray &bgColor, double THRESHOLD_BOND,
-                        double max_dist_double_bond, double avg, int limit, int dist = 0);
+double find_wedge_bonds(const bitmap_t &image, std::vector<atom_t> &atom, int n_atom, std::vector<bond_t> &bond,
+                        int n_bond, double max_dist_double_bond, double avg, int limit, int dist = 0);
 
 // Function: collapse_double_bonds()
 //
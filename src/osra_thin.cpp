@@ -144,33 +144,20 @@ void thin1(unsigned char * const ptr, unsigned int xsize, unsigned int ysize)
   free(qb);
 }
 
-Image thin_image(const Image &box, double THRESHOLD_BOND, const ColorGray &bgColor)
+bitmap_t thin_image(const bitmap_t &box)
 {
-  Image image(Geometry(box.columns(), box.rows()), "white");
-  image.type(GrayscaleType);
-  unsigned int xsize = box.columns();
-  unsigned int ysize = box.rows();
-  unsigned char *ptr = (unsigned char*) malloc(xsize * ysize * sizeof(unsigned char));
-
-  for (unsigned int i = 0; i < xsize; i++)
-    for (unsigned int j = 0; j < ysize; j++)
-      ptr[i + j * xsize] = get_pixel(box, bgColor, i, j, THRESHOLD_BOND);
+  bitmap_t image = box;
+  unsigned int xsize = box.width;
+  unsigned int ysize = box.height;
 
   if (xsize>1 && ysize>1)
-    thin1(ptr, xsize, ysize);
-
-  for (unsigned int i = 0; i < xsize; i++)
-    for (unsigned int j = 0; j < ysize; j++)
-      if (ptr[i + j * xsize] == 1)
-        image.pixelColor(i, j, "black");
+    thin1(&image.pixels[0], xsize, ysize);
 
-  free(ptr);
   return (image);
 }
 
 
-double noise_factor(const Image &image, int width, int height, const ColorGray &bgColor, double THRESHOLD_BOND,
-                    int resolution, int &max, double &nf45)
+double noise_factor(const bitmap_t &image, int width, int height, int resolution, int &max, double &nf45)
 {
   int max_thick = 40;
   std::vector<double> n(max_thick, 0);
@@ -181,10 +168,10 @@ double noise_factor(const Image &image, int width, int height, const ColorGray &
       int j = 0;
       while (j < height)
         {
-          while (!get_pixel(image, bgColor, i, j, THRESHOLD_BOND) && j < height)
+          while (!get_pixel(image, i, j) && j < height)
             j++;
           int l = 0;
-          while (get_pixel(image, bgColor, i, j, THRESHOLD_BOND) && j < height)
+          while (get_pixel(image, i, j) && j < height)
             {
               l++;
               j++;
@@ -199,10 +186,10 @@ double noise_factor(const Image &image, int width, int height, const ColorGray &
       int j = 0;
       while (j < width)
         {
-          while (!get_pixel(image, bgColor, j, i, THRESHOLD_BOND) && j < width)
+          while (!get_pixel(image, j, i) && j < width)
             j++;
           int l = 0;
-          while (get_pixel(image, bgColor, j, i, THRESHOLD_BOND) && j < width)
+          while (get_pixel(image, j, i) && j < width)
             {
               l++;
               j++;
@@ -217,10 +204,10 @@ double noise_factor(const Image &image, int width, int height, const ColorGray &
       int j = 0;
       while (j < width && i+j < height)
         {
-          while (!get_pixel(image, bgColor, j, i+j, THRESHOLD_BOND) && j < width && i+j < height)
+          while (!get_pixel(image, j, i+j) && j < width && i+j < height)
             j++;
           int l = 0;
-          while (get_pixel(image, bgColor, j, i+j, THRESHOLD_BOND) && j < width && i+j < height)
+          while (get_pixel(image, j, i+j) && j < width && i+j < height)
             {
               l++;
               j++;
@@ -235,10 +222,10 @@ double noise_factor(const Image &image, int width, int height, const ColorGray &
       int j = width - 1;
       while (j >= 0 && i+(width-1-j) < height)
         {
-          while (!get_pixel(image, bgColor, j, i+(width-1-j), THRESHOLD_BOND) && j >= 0 && i+(width-1-j) < height)
+          while (!get_pixel(image, j, i+(width-1-j)) && j >= 0 && i+(width-1-j) < height)
             j--;
           int l = 0;
-          while (get_pixel(image, bgColor, j, i+(width-1-j), THRESHOLD_BOND) && j >= 0 && i+(width-1-j) < height)
+          while (get_pixel(image, j, i+(width-1-j)) && j >= 0 && i+(width-1-j) < height)
             {
               l++;
               j--;
@@ -253,10 +240,10 @@ double noise_factor(const Image &image, int width, int height, const ColorGray &
       int j = 0;
       while (j < height && i+j < width)
         {
-          while (!get_pixel(image, bgColor, i+j, j, THRESHOLD_BOND) && j < height && i+j < width)
+          while (!get_pixel(image, i+j, j) && j < height && i+j < width)
             j++;
           int l = 0;
-          while (get_pixel(image, bgColor, i+j, j, THRESHOLD_BOND) && j < height && i+j < width)
+          while (get_pixel(image, i+j, j) && j < height && i+j < width)
             {
               l++;
               j++;
@@ -271,10 +258,10 @@ double noise_factor(const Image &image, int width, int height, const ColorGray &
       int j = height - 1;
       while (j > 0 && i+(height-1-j) < width)
         {
-          while (!get_pixel(image, bgColor, i+(height-1-j), j, THRESHOLD_BOND) && j > 0 && i+(height-1-j) < width)
+          while (!get_pixel(image, i+(height-1-j), j) && j > 0 && i+(height-1-j) < width)
             j--;
           int l = 0;
-          while (get_pixel(image, bgColor, i+(height-1-j), j, THRESHOLD_BOND) && j > 0 && i+(height-1-j) < width)
+          while (get_pixel(image, i+(height-1-j), j) && j > 0 && i+(height-1-j) < width)
             {
               l++;
               j--;
@@ -21,9 +21,7 @@
 //
 // Image thinning routines and noise factor computation
 //
-#include <Magick++.h>
-
-using namespace Magick;
+#include "osra.h" // bitmap_t
 
 //
 // Section: Functions
@@ -34,11 +32,9 @@ using namespace Magick;
 // computes attributes of line thickness histogram
 //
 // Parameters:
-// image - image to be processed
+// image - binarized image to be processed
 // width - image width
 // height - image height
-// bgColor - background color
-// THRESHOLD_BOND - black-white binarization threshold
 // resolution - resolution for which we're performing processing
 // max - position of the maximum of the thickness histogram (most common thickness)
 // nf45 - ratio of number of lines with thickness 4 to the number of lines with thickness 5
@@ -47,18 +43,15 @@ using namespace Magick;
 // Ratio of the number of lines with thickness 2 to number of lines of thickness 3
 // or, if max == 2, ratio of the count of lines with thickness 1 to number of lines of thickness 2
 // or, if max == 1, ratio of the count of lines with thickness 2 to number of lines of thickness 1
-double noise_factor(const Image &image, int width, int height, const ColorGray &bgColor, double THRESHOLD_BOND,
-                    int resolution, int &max, double &nf45);
+double noise_factor(const bitmap_t &image, int width, int height, int resolution, int &max, double &nf45);
 
 // Function: thin_image()
 //
 // Performs image thinning based on Rosenfeld's algorithm
 //
 // Parameters:
-// box - original image
-// THRESHOLD_BOND - black-white binarization threshold
-// bgColor - background color
+// box - binarized original image
 //
 // Returns:
-// Thinned image
-Image thin_image(const Image &box, double THRESHOLD_BOND, const ColorGray &bgColor);
+// Thinned binarized image
+bitmap_t thin_image(const bitmap_t &box);
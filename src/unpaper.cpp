@@ -41,6 +41,8 @@ const char* VERSION = "0.3";
 #include <math.h>
 #include <time.h>
 
+#include <vector>
+
 #include <Magick++.h>
 
 /* --- preprocessor macros ------------------------------------------------ */
@@ -2084,24 +2086,37 @@ double detectEdgeRotation(float deskewScanRange, float deskewScanStep, int deske
   double rangeRad;
   double stepRad;
   double rotation;
-  int peak;
   int maxPeak;
   double detectedRotation;
-  double m;
+  int n;
+  int i;
 
   rangeRad = degreesToRadians((double)deskewScanRange);
   stepRad = degreesToRadians((double)deskewScanStep);
-  detectedRotation = 0.0;
-  maxPeak = 0;
   // iteratively increase test angle,  alterating between +/- sign while increasing absolute value
+  std::vector<double> rotations;
   for (rotation = 0.0; rotation <= rangeRad; rotation = (rotation>=0.0) ? -(rotation + stepRad) : -rotation )
     {
-      m = tan(rotation);
-      peak = detectEdgeRotationPeak(m, deskewScanSize, deskewScanDepth, shiftX, shiftY, left, top, right, bottom, image);
-      if (peak > maxPeak)
+      rotations.push_back(rotation);
+    }
+
+  // the test angles are independent of each other, the first one with the highest peak is taken
+  n = rotations.size();
+  std::vector<int> peaks(n);
+  #pragma omp parallel for schedule(dynamic) default(shared)
+  for (i = 0; i < n; i++)
+    {
+      peaks[i] = detectEdgeRotationPeak(tan(rotations[i]), deskewScanSize, deskewScanDepth, shiftX, shiftY, left, top, right, bottom, image);
+    }
+
+  detectedRotation = 0.0;
+  maxPeak = 0;
+  for (i = 0; i < n; i++)
+    {
+      if (peaks[i] > maxPeak)
         {
-          detectedRotation = rotation;
-          maxPeak = peak;
+          detectedRotation = rotations[i];
+          maxPeak = peaks[i];
         }
     }
   return radiansToDegrees(detectedRotation);
@@ -2218,62 +2233,93 @@ void rotate(double radians, struct IMAGE* source, struct IMAGE* target)
   m21 = -sinval;
   m22 = cosval;
 
-  // step through all pixels of the target image,
-  // symmetrically in all four quadrants to reduce trigonometric calculations
-
-  for (dY = 0; dY <= midMax; dY++)
+  // step through all pixels of the target image, row by row in parallel;
+  // the former walk stepped symmetrically through all four quadrants (dY outer, dX inner, quadrants I to IV),
+  // and the quadrants overlap in the middle row and column, so each pixel is mapped back from the quadrant
+  // that wrote it last in that walk
+  #pragma omp parallel for schedule(dynamic, 16) default(shared) private(x, dX, dY, diffX, diffY, oldX, oldY, pixel)
+  for (y = 0; y < h; y++)
     {
-
-      for (dX = 0; dX <= midMax; dX++)
+      for (x = 0; x < w; x++)
         {
+          int quadrant = 0;
+          int step = -1;
+          int s;
 
-          // matrix multiplication to get rotated pixel pos (as in quadrant I)
-          diffX = dX * m11 + dY * m21;
-          diffY = dX * m12 + dY * m22;
-
-          // quadrant I
-          x = midX + dX;
-          y = midY - dY;
-          if ((x < w) && (y >= 0))
+          // quadrant I: x = midX + dX, y = midY - dY
+          if (x >= midX && y <= midY)
             {
-              oldX = midX + diffX;
-              oldY = midY - diffY;
-              pixel = getPixel(oldX, oldY, source);
-              setPixel(pixel, x, y, target);
+              step = ((midY - y) * (midMax + 1) + x - midX) * 4;
+              quadrant = 1;
             }
-
-          // quadrant II
-          x = halfX - dY;
-          y = midY - dX;
-          if ((x >=0) && (y >= 0))
+          // quadrant II: x = halfX - dY, y = midY - dX
+          if (x <= halfX && y <= midY)
             {
-              oldX = halfX - diffY;
-              oldY = midY - diffX;
-              pixel = getPixel(oldX, oldY, source);
-              setPixel(pixel, x, y, target);
+              s = ((halfX - x) * (midMax + 1) + midY - y) * 4 + 1;
+              if (s > step)
+                {
+                  step = s;
+                  quadrant = 2;
+                }
             }
-
-          // quadrant III
-          x = halfX - dX;
-          y = halfY + dY;
-          if ((x >=0) && (y < h))
+          // quadrant III: x = halfX - dX, y = halfY + dY
+          if (x <= halfX && y >= halfY)
             {
-              oldX = halfX - diffX;
-              oldY = halfY + diffY;
-              pixel = getPixel(oldX, oldY, source);
-              setPixel(pixel, x, y, target);
+              s = ((y - halfY) * (midMax + 1) + halfX - x) * 4 + 2;
+              if (s > step)
+                {
+                  step = s;
+                  quadrant = 3;
+                }
+            }
+          // quadrant IV: x = midX + dY, y = halfY + dX
+          if (x >= midX && y >= halfY)
+            {
+              s = ((x - midX) * (midMax + 1) + y - halfY) * 4 + 3;
+              if (s > step)
+                {
+                  step = s;
+                  quadrant = 4;
+                }
             }
 
-          // quadrant IV
-          x = midX + dY;
-          y = halfY + dX;
-          if ((x < w) && (y < h))
+          switch (quadrant)
             {
+            case 1:
+              dX = x - midX;
+              dY = midY - y;
+              diffX = dX * m11 + dY * m21;
+              diffY = dX * m12 + dY * m22;
+              oldX = midX + diffX;
+              oldY = midY - diffY;
+              break;
+            case 2:
+              dY = halfX - x;
+              dX = midY - y;
+              diffX = dX * m11 + dY * m21;
+              diffY = dX * m12 + dY * m22;
+              oldX = halfX - diffY;
+              oldY = midY - diffX;
+              break;
+            case 3:
+              dX = halfX - x;
+              dY = y - halfY;
+              diffX = dX * m11 + dY * m21;
+              diffY = dX * m12 + dY * m22;
+              oldX = halfX - diffX;
+              oldY = halfY + diffY;
+              break;
+            default:
+              dY = x - midX;
+              dX = y - halfY;
+              diffX = dX * m11 + dY * m21;
+              diffY = dX * m12 + dY * m22;
               oldX = midX + diffY;
               oldY = halfY + diffX;
-              pixel = getPixel(oldX, oldY, source);
-              setPixel(pixel, x, y, target);
+              break;
             }
+          pixel = getPixel(oldX, oldY, source);
+          setPixel(pixel, x, y, target);
         }
     }
 }
@@ -3388,12 +3434,17 @@ void applyBorder(int border[EDGES_COUNT], int borderColor, struct IMAGE* image)
     }
 }
 
+/**
+ * Copies the gray levels of the image into a newly allocated 8-bit grayscale buffer.
+ * The pixels are read from the pixel cache row by row, the gray level being the red channel as in ColorGray::shade().
+ */
 inline void fromImageToStruct(const Magick::Image &source, struct IMAGE* image, int* type)
 {
   *type = PGM;
 
   image->bitdepth = 8;
   image->color = FALSE;
+  image->background = WHITE;
   image->width = source.columns();
   image->height = source.rows();
 
@@ -3401,35 +3452,50 @@ inline void fromImageToStruct(const Magick::Image &source, struct IMAGE* image,
   int inputSize = bytesPerLine * image->height;
 
   image->buffer = (unsigned char*) malloc(inputSize);
-  Magick::ColorGray c;
+  memset(image->buffer, WHITE, inputSize);
 
   for (int j = 0; j < image->height; j++)
-    for (int i = 0; i < image->width; i++)
-      {
-        c = source.pixelColor(i, j);
-        image->buffer[j * bytesPerLine + i] = (unsigned char) (255 * c.shade());
-      }
+    {
+      const Magick::PixelPacket *row = source.getConstPixels(0, j, image->width, 1);
+      if (row == NULL)
+        continue;
+      unsigned char *out = image->buffer + j * bytesPerLine;
+      for (int i = 0; i < image->width; i++)
+        out[i] = (unsigned char) (255. * row[i].red / MaxRGB);
+    }
 
   image->bufferGrayscale = image->buffer;
   image->bufferLightness = image->buffer;
   image->bufferDarknessInverse = image->buffer;
 }
 
+/**
+ * Writes the grayscale buffer back into the image, row by row through the pixel cache.
+ */
 inline void fromStructToImage(Magick::Image &target, struct IMAGE* image)
 {
   int bytesPerLine = image->width;
-  Magick::ColorGray c;
+  int width = ((int) target.columns() < image->width) ? (int) target.columns() : image->width;
+  int height = ((int) target.rows() < image->height) ? (int) target.rows() : image->height;
 
   target.modifyImage();
-  target.erase();
+  target.classType(Magick::DirectClass);
+  if (width != (int) target.columns() || height != (int) target.rows())
+    target.erase();
 
-  for (int j = 0; j < image->height; j++)
-    for (int i = 0; i < image->width; i++)
-      {
-        //printf("%d ", image->buffer[j * bytesPerLine + i]);
-        c.shade((1. * image->buffer[j * bytesPerLine + i]) / 255);
-        target.pixelColor(i, j, c);
-      }
+  for (int j = 0; j < height; j++)
+    {
+      Magick::PixelPacket *row = target.getPixels(0, j, width, 1);
+      if (row == NULL)
+        continue;
+      const unsigned char *in = image->buffer + j * bytesPerLine;
+      for (int i = 0; i < width; i++)
+        {
+          row[i].red = row[i].green = row[i].blue = (Magick::Quantum) (MaxRGB * in[i] / 255.);
+          row[i].opacity = OpaqueOpacity;
+        }
+      target.syncPixels();
+    }
 
   //target.write("debug.png");
 }
@@ -3439,9 +3505,9 @@ inline void fromStructToImage(Magick::Image &target, struct IMAGE* image)
  ****************************************************************************/
 
 /**
- * The main program.
+ * The main program, run for one round on the page image. The resulting sheet is passed back in its place.
  */
-int unpaper(Magick::Image &picture, double &radians, int &unpaper_dx, int &unpaper_dy)
+static int unpaper_sheet(struct IMAGE* input, double &radians, int &unpaper_dx, int &unpaper_dy)
 {
 
 
@@ -3810,7 +3876,8 @@ int unpaper(Magick::Image &picture, double &radians, int &unpaper_dx, int &unpap
 
           //  success = loadImage(inputFilenamesResolved[j], &page, &inputType);
 
-          fromImageToStruct(picture,&page,&inputType);
+          page = *input;
+          inputType = PGM;
 
           inputTypeName = (char*)FILETYPE_NAMES[inputType];
           inputTypeNames[j] = inputTypeName;
@@ -3977,6 +4044,8 @@ int unpaper(Magick::Image &picture, double &radians, int &unpaper_dx, int &unpap
                     }
                   if (outputType == -1)
                     {
+                      // the input page may have been moved into the sheet, which is passed back to be freed by the caller
+                      *input = sheet;
                       return 2;
                     }
                 }
@@ -4446,62 +4515,16 @@ int unpaper(Magick::Image &picture, double &radians, int &unpaper_dx, int &unpap
                   endTime = clock();
                 }
 
-              // --- write output file ---
-
-              // write split pages output
+              // --- pass the sheet back in place of the input page ---
 
               if (writeoutput == TRUE)
                 {
-                  success = TRUE;
-                  page.width = sheet.width / outputCount;
-                  page.height = sheet.height;
-                  page.bitdepth = sheet.bitdepth;
-                  page.color = sheet.color;
-                  for ( j = 0; success && (j < outputCount); j++)
-                    {
-                      // get pagebuffer
-                      if ( outputCount == 1 )
-                        {
-                          page.buffer = sheet.buffer;
-                          page.bufferGrayscale = sheet.bufferGrayscale;
-                          page.bufferLightness = sheet.bufferLightness;
-                          page.bufferDarknessInverse = sheet.bufferDarknessInverse;
-                        }
-                      else     // generic case: copy page-part of sheet into own buffer
-                        {
-                          if (page.color)
-                            {
-                              page.buffer = (unsigned char*)malloc( page.width * page.height * 3 );
-                              page.bufferGrayscale = (unsigned char*)malloc( page.width * page.height );
-                              page.bufferLightness = (unsigned char*)malloc( page.width * page.height );
-                              page.bufferDarknessInverse = (unsigned char*)malloc( page.width * page.height );
-                            }
-                          else
-                            {
-                              page.buffer = (unsigned char*)malloc( page.width * page.height );
-                              page.bufferGrayscale = page.buffer;
-                              page.bufferLightness = page.buffer;
-                              page.bufferDarknessInverse = page.buffer;
-                            }
-                          copyImageArea(page.width * j, 0, page.width, page.height, &sheet, 0, 0, &page);
-                        }
-
-                      //success = saveImage(outputFilenamesResolved[j], &page, outputType, overwrite, blackThreshold);
-
-                      fromStructToImage(picture,&page);
-
-                      if ( outputCount > 1 )
-                        {
-                          freeImage(&page);
-                        }
-                      if (success == FALSE)
-                        {
-                          exitCode = 2;
-                        }
-                    }
+                  *input = sheet;
+                }
+              else
+                {
+                  freeImage(&sheet);
                 }
-
-              freeImage(&sheet);
               sheet.buffer = NULL;
 
               if (showTime)
@@ -4522,3 +4545,27 @@ int unpaper(Magick::Image &picture, double &radians, int &unpaper_dx, int &unpap
 
   return exitCode;
 }
+
+int unpaper(Magick::Image &picture, int rounds, double &radians, int &unpaper_dx, int &unpaper_dy)
+{
+  struct IMAGE sheet;
+  int type;
+  int result = 0;
+
+  // The page is converted once, and all the rounds run on the same buffer:
+  fromImageToStruct(picture, &sheet, &type);
+
+  for (int i = 0; i < rounds && result == 0; i++)
+    {
+      double round_radians = 0;
+      result = unpaper_sheet(&sheet, round_radians, unpaper_dx, unpaper_dy);
+      radians += round_radians;
+    }
+
+  // A failed round leaves the picture as it was, but the buffer is freed either way:
+  if (result == 0)
+    fromStructToImage(picture, &sheet);
+  freeImage(&sheet);
+
+  return result;
+}
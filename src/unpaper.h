@@ -31,10 +31,15 @@
 // Function: unpaper()
 //
 // Performs unpaper image adjustment based on http://unpaper.berlios.de/
+// The image is converted to a gray-level buffer once, all the rounds run on that buffer
+// and the result is written back into the image at the end.
 //
 // Parameters:
 //      picture - image object
+//      rounds - number of adjustment rounds
+//      radians - the total rotation angle is added to this
+//      unpaper_dx, unpaper_dy - the total shift is added to these
 //
 // Returns:
 //      0 in case of success or non-zero error code otherwise
-int unpaper(Magick::Image &picture, double &radians, int &unpaper_dx, int &unpaper_dy);
+int unpaper(Magick::Image &picture, int rounds, double &radians, int &unpaper_dx, int &unpaper_dy);
@@ -0,0 +1,251 @@
+/******************************************************************************
+ OSRA: Optical Structure Recognition Application
+
+ Created by Igor Filippov, 2007-2013 (igor.v.filippov@gmail.com)
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along with
+ this program; if not, write to the Free Software Foundation, Inc., 51 Franklin
+ St, Fifth Floor, Boston, MA 02110-1301, USA
+ *****************************************************************************/
+
+// Regression test for find_connected_components(): the segments and their margins should come out exactly as the
+// former flood fill over the whole bitmap has found them, pixel by pixel and in the same order.
+
+#include <string.h> // strlen()
+
+#include <list>
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include "osra.h"
+#include "osra_segment.h"
+
+using namespace std;
+
+void find_connected_components(const bitmap_t &bitmap, vector<list<point_t> > &segments,
+                               vector<vector<point_t> > &margins, bool adaptive);
+
+// The flood fill find_connected_components() used to do:
+void reference_connected_components(const bitmap_t &bitmap, vector<list<point_t> > &segments,
+                                    vector<vector<point_t> > &margins, bool adaptive)
+{
+  point_t p;
+  list<point_t> points;
+  unsigned int speckle_area = 2;
+  if (adaptive)
+    {
+      int speckle_side = min(bitmap.width, bitmap.height) / 200;
+      speckle_area = speckle_side * speckle_side;
+      if (speckle_area < 2) speckle_area = 2;
+    }
+
+  vector<vector<int> > tmp(bitmap.width, vector<int> (bitmap.height, 0));
+
+  for (int i = 0; i < bitmap.width; i++)
+    for (int j = 0; j < bitmap.height; j++)
+      if (bitmap.pixels[j * bitmap.width + i] == 1)
+        tmp[i][j] = 1;
+
+  for (int i = 0; i < bitmap.width; i++)
+    for (int j = 0; j < bitmap.height; j++)
+      if (tmp[i][j] == 1)
+        {
+          tmp[i][j] = 2;
+          p.x = i;
+          p.y = j;
+          points.push_back(p);
+          list<point_t> new_segment;
+          vector<point_t> new_margin;
+          int counter = 0;
+          point_t p1;
+          while (!points.empty())
+            {
+              p = points.back();
+              points.pop_back();
+              new_segment.push_back(p);
+              tmp[p.x][p.y] = -1;
+              bool on_the_margin = false;
+
+              int x_lower = p.x > 1 ? p.x - 1 : 0;
+              int y_lower = p.y > 1 ? p.y - 1 : 0;
+              int x_upper = min(p.x + 2, bitmap.width);
+              int y_upper = min(p.y + 2, bitmap.height);
+
+              for (int k = x_lower; k < x_upper; k++)
+                for (int l = y_lower; l < y_upper; l++)
+                  {
+                    if (tmp[k][l] == 1)
+                      {
+                        p1.x = k;
+                        p1.y = l;
+                        points.push_back(p1);
+                        tmp[k][l] = 2;
+                      }
+                    else if (k != p.x && l != p.y && tmp[k][l] == 0)
+                      {
+                        on_the_margin = true;
+                      }
+                  }
+
+              if (on_the_margin && (new_margin.size() < PARTS_IN_MARGIN || (counter % PARTS_IN_MARGIN) == 0))
+                new_margin.push_back(p);
+              if (on_the_margin)
+                counter++;
+            }
+          if (segments.size() > MAX_SEGMENTS)
+            return;
+          if (new_segment.size() > speckle_area)
+            {
+              segments.push_back(new_segment);
+              margins.push_back(new_margin);
+            }
+        }
+}
+
+static unsigned int seed = 1;
+
+static unsigned int next_random()
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static bool same_points(const point_t &a, const point_t &b)
+{
+  return a.x == b.x && a.y == b.y;
+}
+
+// Runs both versions on the bitmap and reports the first difference, if any
+static bool compare(const string &name, const bitmap_t &bitmap, bool adaptive)
+{
+  vector<list<point_t> > segments, reference_segments;
+  vector<vector<point_t> > margins, reference_margins;
+  find_connected_components(bitmap, segments, margins, adaptive);
+  reference_connected_components(bitmap, reference_segments, reference_margins, adaptive);
+
+  if (segments.size() != reference_segments.size() || margins.size() != reference_margins.size())
+    {
+      cerr << name << ": " << segments.size() << " segments instead of " << reference_segments.size() << endl;
+      return false;
+    }
+  for (unsigned int i = 0; i < segments.size(); i++)
+    {
+      if (segments[i].size() != reference_segments[i].size()
+          || !equal(segments[i].begin(), segments[i].end(), reference_segments[i].begin(), same_points))
+        {
+          cerr << name << ": pixels of segment " << i << " differ" << endl;
+          return false;
+        }
+      if (margins[i].size() != reference_margins[i].size()
+          || !equal(margins[i].begin(), margins[i].end(), reference_margins[i].begin(), same_points))
+        {
+          cerr << name << ": margin of segment " << i << " differs" << endl;
+          return false;
+        }
+    }
+  return true;
+}
+
+// Builds the bitmap from rows of text, '#' being a set pixel
+static bitmap_t draw(const char **rows, int height)
+{
+  bitmap_t bitmap;
+  bitmap.width = strlen(rows[0]);
+  bitmap.height = height;
+  bitmap.pixels.resize(bitmap.width * bitmap.height);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < bitmap.width; x++)
+      bitmap.pixels[y * bitmap.width + x] = rows[y][x] == '#' ? 1 : 0;
+  return bitmap;
+}
+
+static bitmap_t random_bitmap(int width, int height, int density, int blobs)
+{
+  bitmap_t bitmap;
+  bitmap.width = width;
+  bitmap.height = height;
+  bitmap.pixels.resize(width * height);
+  for (int i = 0; i < width * height; i++)
+    bitmap.pixels[i] = (int) (next_random() % 100) < density ? 1 : 0;
+  for (int b = 0; b < blobs; b++)
+    {
+      int x0 = next_random() % width, y0 = next_random() % height, r = 1 + next_random() % 12;
+      for (int y = max(y0 - r, 0); y < min(y0 + r, height); y++)
+        for (int x = max(x0 - r, 0); x < min(x0 + r, width); x++)
+          if ((x - x0) * (x - x0) + (y - y0) * (y - y0) <= r * r)
+            bitmap.pixels[y * width + x] = 1;
+    }
+  return bitmap;
+}
+
+int main()
+{
+  int failures = 0;
+
+  // A ring with a dot inside, a diagonal line joined to the ring, and two speckles:
+  const char *shapes[] =
+  {
+    "..........##",
+    ".#####....#.",
+    ".#...#...#..",
+    ".#.#.#..#...",
+    ".#...#.#....",
+    ".######.....",
+    "............",
+    "#.........##",
+  };
+  bitmap_t bitmap = draw(shapes, 8);
+  vector<list<point_t> > segments;
+  vector<vector<point_t> > margins;
+  find_connected_components(bitmap, segments, margins, false);
+  if (segments.size() != 1 || segments[0].size() != 16 + 7)
+    {
+      cerr << "shapes: expected one segment of 23 pixels, found " << segments.size() << " segments" << endl;
+      failures++;
+    }
+  failures += !compare("shapes", bitmap, false);
+
+  const char *empty[] = { "....", "....", };
+  failures += !compare("empty", draw(empty, 2), false);
+  const char *full[] = { "###", "###", "###", };
+  failures += !compare("full", draw(full, 3), false);
+  const char *column[] = { "#", "#", "#", "#", };
+  failures += !compare("column", draw(column, 4), false);
+  const char *row[] = { "#####", };
+  failures += !compare("row", draw(row, 1), false);
+
+  // More blocks of four pixels than MAX_SEGMENTS, so that the search stops:
+  bitmap_t blocks;
+  blocks.width = blocks.height = 306;
+  blocks.pixels.assign(blocks.width * blocks.height, 0);
+  for (int y = 0; y < blocks.height; y++)
+    for (int x = 0; x < blocks.width; x++)
+      if (x % 3 != 2 && y % 3 != 2)
+        blocks.pixels[y * blocks.width + x] = 1;
+  failures += !compare("blocks", blocks, false);
+
+  for (int i = 0; i < 200; i++)
+    {
+      int width = 1 + next_random() % 120;
+      int height = 1 + next_random() % 90;
+      int density = next_random() % 70;
+      int blobs = next_random() % 10;
+      failures += !compare("random", random_bitmap(width, height, density, blobs), i % 2 == 0);
+    }
+  // Large enough for the adaptive speckle size to grow:
+  failures += !compare("large", random_bitmap(450, 420, 20, 60), true);
+
+  if (failures == 0)
+    cout << "OK" << endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+/******************************************************************************
+ OSRA: Optical Structure Recognition Application
+
+ Created by Igor Filippov, 2007-2013 (igor.v.filippov@gmail.com)
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along with
+ this program; if not, write to the Free Software Foundation, Inc., 51 Franklin
+ St, Fifth Floor, Boston, MA 02110-1301, USA
+ *****************************************************************************/
+
+// Regression test for find_fragments(): the fragments should come out exactly as the former search has found them,
+// in the same order and with the atoms of every fragment in the same order.
+
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include "osra.h"
+#include "osra_fragments.h"
+
+using namespace std;
+
+// The search find_fragments() used to do:
+vector<vector<int> > reference_fragments(const vector<bond_t> &bond, int n_bond, const vector<atom_t> &atom)
+{
+  vector<vector<int> > frags;
+  vector<int> pool;
+  int n = 0;
+
+  for (int i = 0; i < n_bond; i++)
+    if (bond[i].exists && atom[bond[i].a].exists && atom[bond[i].b].exists)
+      pool.push_back(i);
+
+  while (!pool.empty())
+    {
+      frags.resize(n + 1);
+      frags[n].push_back(bond[pool.back()].a);
+      frags[n].push_back(bond[pool.back()].b);
+      pool.pop_back();
+      bool found = true;
+
+      while (found)
+        {
+          found = false;
+          unsigned int i = 0;
+          while (i < pool.size())
+            {
+              bool found_a = false;
+              bool found_b = false;
+              bool newfound = false;
+              for (unsigned int k = 0; k < frags[n].size(); k++)
+                {
+                  if (frags[n][k] == bond[pool[i]].a)
+                    found_a = true;
+                  else if (frags[n][k] == bond[pool[i]].b)
+                    found_b = true;
+                }
+              if (found_a && !found_b)
+                {
+                  frags[n].push_back(bond[pool[i]].b);
+                  pool.erase(pool.begin() + i);
+                  found = true;
+                  newfound = true;
+                }
+              if (!found_a && found_b)
+                {
+                  frags[n].push_back(bond[pool[i]].a);
+                  pool.erase(pool.begin() + i);
+                  found = true;
+                  newfound = true;
+                }
+              if (found_a && found_b)
+                {
+                  pool.erase(pool.begin() + i);
+                  newfound = true;
+                }
+              if (!newfound)
+                i++;
+            }
+        }
+      n++;
+    }
+  return (frags);
+}
+
+static unsigned int seed = 1;
+
+static unsigned int next_random()
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+// Runs both versions on the molecule and reports the first difference, if any
+static bool compare(const string &name, const vector<bond_t> &bond, const vector<atom_t> &atom)
+{
+  const vector<vector<int> > &frags = find_fragments(bond, bond.size(), atom);
+  const vector<vector<int> > &reference = reference_fragments(bond, bond.size(), atom);
+
+  if (frags.size() != reference.size())
+    {
+      cerr << name << ": " << frags.size() << " fragments instead of " << reference.size() << endl;
+      return false;
+    }
+  for (unsigned int i = 0; i < frags.size(); i++)
+    if (frags[i] != reference[i])
+      {
+        cerr << name << ": atoms of fragment " << i << " differ" << endl;
+        return false;
+      }
+  return true;
+}
+
+static vector<atom_t> make_atoms(int n)
+{
+  vector<atom_t> atom(n);
+  for (int i = 0; i < n; i++)
+    atom[i].exists = true;
+  return atom;
+}
+
+int main()
+{
+  int failures = 0;
+
+  // A ring of four atoms with a tail, a separate pair of atoms, and a bond to an atom which does not exist:
+  vector<atom_t> atom = make_atoms(9);
+  atom[8].exists = false;
+  vector<bond_t> bond;
+  bond.push_back(bond_t(0, 1));
+  bond.push_back(bond_t(1, 2));
+  bond.push_back(bond_t(2, 3));
+  bond.push_back(bond_t(3, 0));
+  bond.push_back(bond_t(3, 4));
+  bond.push_back(bond_t(5, 6));
+  bond.push_back(bond_t(6, 8));
+  bond.push_back(bond_t(7, 2));
+  bond[5].exists = false;
+
+  // The last bond is taken first, then the atoms are added sweep after sweep:
+  int expected[] = { 7, 2, 1, 3, 0, 4 };
+  const vector<vector<int> > &frags = find_fragments(bond, bond.size(), atom);
+  if (frags.size() != 1 || frags[0] != vector<int>(expected, expected + 6))
+    {
+      cerr << "ring: unexpected fragments" << endl;
+      failures++;
+    }
+  failures += !compare("ring", bond, atom);
+
+  // A chain with the bonds in reverse order, so that every sweep adds one atom only:
+  atom = make_atoms(20);
+  bond.clear();
+  for (int i = 18; i >= 0; i--)
+    bond.push_back(bond_t(i, i + 1));
+  bond.push_back(bond_t(10, 11));
+  failures += !compare("chain", bond, atom);
+
+  failures += !compare("none", vector<bond_t>(), make_atoms(3));
+
+  // Bonds joining an atom to itself are left out, remove_zero_bonds() removes them before:
+  for (int i = 0; i < 300; i++)
+    {
+      int n = 1 + next_random() % 80;
+      atom = make_atoms(n);
+      for (int a = 0; a < n; a++)
+        atom[a].exists = next_random() % 10 != 0;
+      bond.clear();
+      int n_bond = next_random() % (2 * n);
+      for (int b = 0; b < n_bond && n > 1; b++)
+        {
+          int a1 = next_random() % n;
+          int a2 = (a1 + 1 + next_random() % (n - 1)) % n;
+          if (next_random() % 2 == 0 && !bond.empty())
+            a1 = bond[next_random() % bond.size()].b;
+          if (a1 == a2)
+            continue;
+          bond.push_back(bond_t(a1, a2));
+          bond.back().exists = next_random() % 8 != 0;
+        }
+      failures += !compare("random", bond, atom);
+    }
+
+  if (failures == 0)
+    cout << "OK" << endl;
+  return failures == 0 ? 0 : 1;
+}
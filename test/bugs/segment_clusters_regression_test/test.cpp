@@ -0,0 +1,186 @@
+/******************************************************************************
+ OSRA: Optical Structure Recognition Application
+
+ Created by Igor Filippov, 2007-2013 (igor.v.filippov@gmail.com)
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along with
+ this program; if not, write to the Free Software Foundation, Inc., 51 Franklin
+ St, Fifth Floor, Boston, MA 02110-1301, USA
+ *****************************************************************************/
+
+// Regression test for assemble_clusters(): the clusters should have the same segments and come in the same order as
+// the ones the former flood fill has assembled, the segments of a cluster being in ascending order, and the segments
+// should be marked as taken the same way.
+
+#include <list>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include "osra.h"
+#include "osra_segment.h"
+
+using namespace std;
+
+list<list<int> > assemble_clusters(const vector<vector<point_t> > &margins, int dist,
+                                   const vector<vector<neighbor_t> > &neighbors, vector<int> &avail, bool text);
+
+// The flood fill assemble_clusters() used to do:
+list<list<int> > reference_clusters(const vector<vector<point_t> > &margins, int dist,
+                                    const vector<vector<neighbor_t> > &neighbors, vector<int> &avail)
+{
+  list<list<int> > clusters;
+  list<int> bag;
+
+  for (unsigned int s = 0; s < margins.size(); s++)
+    if (avail[s] == 1)
+      {
+        bag.push_back(s);
+        avail[s] = 2;
+        list<int> new_cluster;
+        while (!bag.empty())
+          {
+            int c = bag.back();
+            bag.pop_back();
+            new_cluster.push_back(c);
+            avail[c] = 0;
+            for (vector<neighbor_t>::const_iterator n = neighbors[c].begin(); n != neighbors[c].end(); n++)
+              if (avail[n->segment] == 1 && n->distance < dist)
+                {
+                  bag.push_back(n->segment);
+                  avail[n->segment] = 2;
+                }
+          }
+        clusters.push_back(new_cluster);
+      }
+
+  return (clusters);
+}
+
+static unsigned int seed = 1;
+
+static unsigned int next_random()
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static bool comp_neighbors(const neighbor_t &a, const neighbor_t &b)
+{
+  return a.segment < b.segment;
+}
+
+// Adds the pair to the neighbor lists of both segments, as build_segment_neighbors() does
+static void add_pair(vector<vector<neighbor_t> > &neighbors, int s1, int s2, int d)
+{
+  neighbors[s1].push_back(neighbor_t(s2, d, 1));
+  neighbors[s2].push_back(neighbor_t(s1, d, 1));
+}
+
+// Runs both versions on the neighbor lists and reports the first difference, if any
+static bool compare(const string &name, vector<vector<neighbor_t> > &neighbors, const vector<int> &avail, int dist)
+{
+  for (unsigned int s = 0; s < neighbors.size(); s++)
+    sort(neighbors[s].begin(), neighbors[s].end(), comp_neighbors);
+  vector<vector<point_t> > margins(neighbors.size());
+
+  vector<int> taken(avail), reference_taken(avail);
+  const list<list<int> > &clusters = assemble_clusters(margins, dist, neighbors, taken, false);
+  const list<list<int> > &reference = reference_clusters(margins, dist, neighbors, reference_taken);
+
+  if (clusters.size() != reference.size())
+    {
+      cerr << name << ": " << clusters.size() << " clusters instead of " << reference.size() << endl;
+      return false;
+    }
+  list<list<int> >::const_iterator r = reference.begin();
+  for (list<list<int> >::const_iterator c = clusters.begin(); c != clusters.end(); c++, r++)
+    {
+      vector<int> segments(c->begin(), c->end());
+      vector<int> reference_segments(r->begin(), r->end());
+      sort(reference_segments.begin(), reference_segments.end());
+      if (segments != reference_segments)
+        {
+          cerr << name << ": cluster of segment " << r->front() << " differs" << endl;
+          return false;
+        }
+    }
+  if (taken != reference_taken)
+    {
+      cerr << name << ": segments are marked differently" << endl;
+      return false;
+    }
+  return true;
+}
+
+int main()
+{
+  int failures = 0;
+
+  // Segments 0, 2 and 4 are in a chain, 1 is near 3 which is not available, 5 has no neighbors:
+  vector<vector<neighbor_t> > neighbors(6);
+  add_pair(neighbors, 0, 2, 3);
+  add_pair(neighbors, 2, 4, 10);
+  add_pair(neighbors, 1, 3, 1);
+  int availability[] = { 1, 1, 1, -1, 1, 1 };
+  vector<int> avail(availability, availability + 6);
+  for (int i = 0; i < 6; i++)
+    sort(neighbors[i].begin(), neighbors[i].end(), comp_neighbors);
+
+  vector<int> taken(avail);
+  list<list<int> > clusters = assemble_clusters(vector<vector<point_t> >(6), 5, neighbors, taken, false);
+  int expected[][3] = { { 0, 2, -1 }, { 1, -1, -1 }, { 4, -1, -1 }, { 5, -1, -1 } };
+  bool same = clusters.size() == 4;
+  int k = 0;
+  for (list<list<int> >::const_iterator c = clusters.begin(); same && c != clusters.end(); c++, k++)
+    {
+      int l = 0;
+      for (list<int>::const_iterator s = c->begin(); same && s != c->end(); s++, l++)
+        same = l < 3 && *s == expected[k][l];
+      same = same && (l == 3 || expected[k][l] == -1);
+    }
+  if (!same)
+    {
+      cerr << "chain: unexpected clusters" << endl;
+      failures++;
+    }
+  failures += !compare("chain", neighbors, avail, 5);
+  failures += !compare("chain", neighbors, avail, 11);
+  failures += !compare("chain", neighbors, avail, 0);
+
+  vector<vector<neighbor_t> > none;
+  failures += !compare("none", none, vector<int>(), MAX_DIST);
+
+  for (int i = 0; i < 200; i++)
+    {
+      int n = next_random() % 300;
+      neighbors.assign(n, vector<neighbor_t>());
+      avail.assign(n, 1);
+      for (int s = 0; s < n; s++)
+        if (next_random() % 5 == 0)
+          avail[s] = (next_random() % 2 == 0) ? 0 : -1;
+      int pairs = n > 1 ? next_random() % (3 * n) : 0;
+      for (int p = 0; p < pairs; p++)
+        {
+          int s1 = next_random() % n;
+          int s2 = (s1 + 1 + next_random() % (next_random() % 2 == 0 ? 5 : n - 1)) % n;
+          if (s1 != s2)
+            add_pair(neighbors, min(s1, s2), max(s1, s2), next_random() % MAX_DIST);
+        }
+      failures += !compare("random", neighbors, avail, next_random() % MAX_DIST);
+    }
+
+  if (failures == 0)
+    cout << "OK" << endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+/******************************************************************************
+ OSRA: Optical Structure Recognition Application
+
+ Created by Igor Filippov, 2007-2013 (igor.v.filippov@gmail.com)
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2 of the License, or (at your option) any later
+ version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License along with
+ this program; if not, write to the Free Software Foundation, Inc., 51 Franklin
+ St, Fifth Floor, Boston, MA 02110-1301, USA
+ *****************************************************************************/
+
+// Regression test for build_segment_neighbors(): the neighbor lists should hold exactly the pairs of segments the
+// former dense distance matrix had a distance for, with the same distances and area ratios, and the features
+// histogram should be the same.
+
+#include <limits.h> // INT_MAX
+
+#include <list>
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include "osra.h"
+#include "osra_segment.h"
+
+using namespace std;
+
+unsigned int distance_between_points(const point_t &p1, const point_t &p2);
+unsigned int distance_between_segments(const vector<point_t> &s1, const vector<point_t> &s2);
+unsigned int area_ratio(unsigned int a, unsigned int b);
+void build_segment_neighbors(const vector<vector<point_t> > &margins, unsigned int max_dist,
+                             vector<vector<neighbor_t> > &neighbors, vector<vector<int> > &features,
+                             const vector<list<point_t> > &segments, unsigned int max_area_ratio);
+
+// The matrices build_segment_neighbors() has replaced:
+void reference_distance_matrix(const vector<vector<point_t> > &margins, unsigned int max_dist,
+                               vector<vector<int> > &distance_matrix, vector<vector<int> > &features,
+                               const vector<list<point_t> > &segments, unsigned int max_area_ratio,
+                               vector<vector<int> > &area_matrix)
+{
+  unsigned int d;
+  unsigned int ar;
+
+  for (unsigned int s1 = 0; s1 < margins.size(); s1++)
+    for (unsigned int s2 = s1 + 1; s2 < margins.size(); s2++)
+      if (distance_between_points(margins[s1].front(), margins[s2].front()) < (PARTS_IN_MARGIN
+          * margins[s1].size() + PARTS_IN_MARGIN * margins[s2].size()) / 2 + max_dist)
+        {
+          d = distance_between_segments(margins[s1], margins[s2]);
+          if (d < max_dist)
+            {
+              distance_matrix[s1][s2] = d;
+              distance_matrix[s2][s1] = d;
+              ar = area_ratio(segments[s1].size(), segments[s2].size());
+              area_matrix[s1][s2] = ar;
+              area_matrix[s2][s1] = ar;
+              if (ar < max_area_ratio && d < max_dist)
+                features[ar][d]++;
+            }
+        }
+}
+
+static unsigned int seed = 1;
+
+static unsigned int next_random()
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+// Runs both versions on the segments and reports the first difference, if any
+static bool compare(const string &name, const vector<list<point_t> > &segments, const vector<vector<point_t> > &margins,
+                    unsigned int max_dist, unsigned int max_area_ratio)
+{
+  vector<vector<neighbor_t> > neighbors;
+  vector<vector<int> > features(max_area_ratio, vector<int> (max_dist, 0));
+  build_segment_neighbors(margins, max_dist, neighbors, features, segments, max_area_ratio);
+
+  vector<vector<int> > distance_matrix(segments.size(), vector<int> (segments.size(), INT_MAX));
+  vector<vector<int> > area_matrix(segments.size(), vector<int> (segments.size(), INT_MAX));
+  vector<vector<int> > reference_features(max_area_ratio, vector<int> (max_dist, 0));
+  reference_distance_matrix(margins, max_dist, distance_matrix, reference_features, segments, max_area_ratio,
+                            area_matrix);
+
+  if (neighbors.size() != segments.size())
+    {
+      cerr << name << ": " << neighbors.size() << " neighbor lists for " << segments.size() << " segments" << endl;
+      return false;
+    }
+  for (unsigned int s1 = 0; s1 < segments.size(); s1++)
+    {
+      // The neighbors of a segment are listed in the order of the matrix row:
+      vector<neighbor_t>::const_iterator n = neighbors[s1].begin();
+      for (unsigned int s2 = 0; s2 < segments.size(); s2++)
+        if (distance_matrix[s1][s2] != INT_MAX)
+          {
+            if (n == neighbors[s1].end() || n->segment != (int) s2 || n->distance != distance_matrix[s1][s2]
+                || n->area_ratio != area_matrix[s1][s2])
+              {
+                cerr << name << ": neighbor " << s2 << " of segment " << s1 << " is missing or differs" << endl;
+                return false;
+              }
+            n++;
+          }
+      if (n != neighbors[s1].end())
+        {
+          cerr << name << ": segment " << s1 << " has extra neighbor " << n->segment << endl;
+          return false;
+        }
+    }
+  if (features != reference_features)
+    {
+      cerr << name << ": features differ" << endl;
+      return false;
+    }
+  return true;
+}
+
+// Adds a segment: a filled rectangle, with its outline as the margin
+static void add_segment(vector<list<point_t> > &segments, vector<vector<point_t> > &margins, int x1, int y1, int x2,
+                        int y2)
+{
+  list<point_t> segment;
+  vector<point_t> margin;
+  for (int x = x1; x <= x2; x++)
+    for (int y = y1; y <= y2; y++)
+      {
+        segment.push_back(point_t(x, y));
+        if (x == x1 || x == x2 || y == y1 || y == y2)
+          margin.push_back(point_t(x, y));
+      }
+  segments.push_back(segment);
+  margins.push_back(margin);
+}
+
+// Adds a segment of scattered points around the given one, with some of them as the margin
+static void add_random_segment(vector<list<point_t> > &segments, vector<vector<point_t> > &margins, int x0, int y0)
+{
+  list<point_t> segment;
+  vector<point_t> margin;
+  int spread = 1 + next_random() % 60;
+  int n = 1 + next_random() % 80;
+  for (int i = 0; i < n; i++)
+    {
+      point_t p(x0 + next_random() % spread, y0 + next_random() % spread);
+      segment.push_back(p);
+      if (margin.empty() || next_random() % 3 == 0)
+        margin.push_back(p);
+    }
+  segments.push_back(segment);
+  margins.push_back(margin);
+}
+
+int main()
+{
+  int failures = 0;
+
+  // Two boxes MAX_DIST - 1 apart, one exactly MAX_DIST away from the second one, and a small box inside the first one:
+  vector<list<point_t> > segments;
+  vector<vector<point_t> > margins;
+  add_segment(segments, margins, 0, 0, 20, 20);
+  add_segment(segments, margins, 20 + MAX_DIST - 1, 0, 40 + MAX_DIST, 10);
+  add_segment(segments, margins, 40 + 2 * MAX_DIST, 0, 50 + 2 * MAX_DIST, 10);
+  add_segment(segments, margins, 5, 5, 7, 7);
+
+  vector<vector<neighbor_t> > neighbors;
+  vector<vector<int> > features(MAX_AREA_RATIO, vector<int> (MAX_DIST, 0));
+  build_segment_neighbors(margins, MAX_DIST, neighbors, features, segments, MAX_AREA_RATIO);
+  if (neighbors.size() != 4 || neighbors[0].size() != 2 || neighbors[0][0].segment != 1
+      || neighbors[0][0].distance != MAX_DIST - 1 || neighbors[0][1].segment != 3 || neighbors[1].size() != 1
+      || neighbors[2].size() != 0)
+    {
+      cerr << "boxes: unexpected neighbors" << endl;
+      failures++;
+    }
+  failures += !compare("boxes", segments, margins, MAX_DIST, MAX_AREA_RATIO);
+
+  failures += !compare("none", vector<list<point_t> >(), vector<vector<point_t> >(), MAX_DIST, MAX_AREA_RATIO);
+
+  for (int i = 0; i < 100; i++)
+    {
+      segments.clear();
+      margins.clear();
+      int n = next_random() % 150;
+      int size = 50 + next_random() % 1500;
+      for (int s = 0; s < n; s++)
+        add_random_segment(segments, margins, next_random() % size, next_random() % size);
+      unsigned int max_dist = (i % 4 == 0) ? next_random() % 120 : MAX_DIST;
+      unsigned int max_area_ratio = (i % 3 == 0) ? 1 + next_random() % 10 : MAX_AREA_RATIO;
+      failures += !compare("random", segments, margins, max_dist, max_area_ratio);
+    }
+
+  if (failures == 0)
+    cout << "OK" << endl;
+  return failures == 0 ? 0 : 1;
+}